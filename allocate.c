@@ -107,6 +107,21 @@ void (*__MALLOC_HOOK_VOLATILE __malloc_initialize_hook) (void) = jm_initialize_a
 #endif
 
 
+/* Tell the fault handler that the contents of an external block of
+ * usable_size bytes are no longer needed.  A free chunk holds
+ * dlmalloc's free-list links in its first few words and its size in
+ * its last word, so we leave those alone. */
+static inline void
+discard_external_block (void *ptr, size_t usable_size)
+{
+  const size_t headbytes = 8*sizeof(size_t);  /* Bytes dlmalloc may write at the start */
+  const size_t tailbytes = sizeof(size_t);    /* Bytes dlmalloc may write at the end */
+
+  if (ptr && usable_size > headbytes + tailbytes)
+    jm_discard_memory((char *)ptr + headbytes, usable_size - headbytes - tailbytes);
+}
+
+
 /* Call either the JumboMem-internal or JumboMem-external version of
  * free(). */
 MAYBE_STATIC void
@@ -119,8 +134,11 @@ jm_internal_free (void *ptr  MAYBE_CALLER)
     INITIALIZE_IF_NECESSARY();
     mspace_free(jm_mspace, ptr);
   }
-  else
+  else {
+    if (ptr)
+      discard_external_block(ptr, dlmalloc_usable_size(ptr));
     dlfree(ptr);
+  }
   JM_RETURN();
 }
 
@@ -209,8 +227,14 @@ jm_internal_realloc (void *ptr, size_t size  MAYBE_CALLER)
     if ((void *)jm_globals.memregion <= result && result < (void *)jm_globals.memregion+jm_globals.extent)
       jm_abort("Internal error: Internal buffer %p is within the external range of memory", result);
   }
-  else
+  else {
+    size_t old_size = ptr ? dlmalloc_usable_size(ptr) : 0;   /* Usable size of the original block */
+
+    /* If dlrealloc() moved the block, it freed the original. */
     result = dlrealloc(ptr, size);
+    if (result && result != ptr)
+      discard_external_block(ptr, old_size);
+  }
   jm_debug_printf(5, "%s realloc(%p, %lu) ==> %p\n",
                   JM_INTERNAL_INVOCATION() ? "Internal" : "External", ptr, size, result);
   JM_RETURN(result);
@@ -556,7 +580,7 @@ jm_mmap (void *start, size_t length, int prot, int flags, int fd, off_t offset)
       if (brk(dataend+length) == 0) {
 	address = (*original_mmap)(dataend, length, prot, flags|MAP_FIXED, fd, offset);
 	if (!(address == MAP_FAILED
-	      || ((void *)jm_globals.memregion <= address && address < (void *)jm_globals.memregion+jm_globals.extent))) {
+	      || ((void *)jm_globals.memregion <= address && address < (void *)jm_globals.memregion+jm_globals.max_extent))) {
 	  JM_RETURN(address);
 	}
 	jm_debug_printf(4, "Failed to mmap() memory at address %p; retrying elsewhere\n", dataend);
@@ -569,14 +593,14 @@ jm_mmap (void *start, size_t length, int prot, int flags, int fd, off_t offset)
     /* Specify a desired map address lying just past the
      * JumboMem-controlled memory region.  Abort if mmap() returns an
      * address within the JumboMem-controlled memory region. */
-    address = (*original_mmap)((void *)(jm_globals.memregion+jm_globals.extent),
+    address = (*original_mmap)((void *)(jm_globals.memregion+jm_globals.max_extent),
                                length, prot, flags, fd, offset);
     if (address == MAP_FAILED)
       jm_abort("mmap() failed to allocate %lu bytes at or above address %p (%s)",
-               length, jm_globals.memregion+jm_globals.extent, jm_strerror(errno));
-    if ((void *)jm_globals.memregion <= address && address < (void *)jm_globals.memregion+jm_globals.extent)
+               length, jm_globals.memregion+jm_globals.max_extent, jm_strerror(errno));
+    if ((void *)jm_globals.memregion <= address && address < (void *)jm_globals.memregion+jm_globals.max_extent)
       jm_abort("Failed to prevent mmap() from allocating %lu bytes within [%p, %p]",
-               length, jm_globals.memregion, jm_globals.memregion+jm_globals.extent);
+               length, jm_globals.memregion, jm_globals.memregion+jm_globals.max_extent);
     JM_RETURN(address);
   }
 }
@@ -597,10 +621,11 @@ jm_morecore (long int increment)
 #endif
 
   /* Return memory we had previously mmap()'ed.  Fail if we didn't
-   * mmap() enough memory. */
+   * mmap() enough memory and can't grow the global address space. */
   if (jm_globals.endaddress+increment < jm_globals.memregion
-      || jm_globals.endaddress+increment > jm_globals.memregion+jm_globals.extent
-      || increment < 0) {
+      || increment < 0
+      || (jm_globals.endaddress+increment > jm_globals.memregion+jm_globals.extent
+          && !jm_grow_address_space((size_t)(jm_globals.endaddress+increment-jm_globals.memregion)))) {
     jm_debug_printf(3, "Failed to allocate %ld bytes of JumboMem memory.\n", increment);
     JM_RETURN(MFAIL);
   }
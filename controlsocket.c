@@ -0,0 +1,388 @@
+/*------------------------------------------------------------
+ * JumboMem memory server: Run-time control socket
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+/*
+ * If JM_CONTROL names a file, the master listens on a Unix-domain
+ * socket of that name.  An operator can connect to the socket (e.g.,
+ * with "socat - UNIX-CONNECT:<file>") and issue line-oriented
+ * commands to retune a running program.  Every command is answered
+ * with zero or more lines of output followed by a line beginning with
+ * either "OK" or "ERROR".
+ */
+
+#include "jumbomem.h"
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* Define the longest command line we accept. */
+#ifndef MAX_COMMAND_LEN
+# define MAX_COMMAND_LEN 1024
+#endif
+
+/* Define the debug level that "trace start" switches to. */
+#ifndef TRACE_DEBUG_LEVEL
+# define TRACE_DEBUG_LEVEL 4
+#endif
+
+extern JUMBOMEM_GLOBALS jm_globals;     /* All of our global variables */
+static char *socket_name = NULL;        /* Name of the socket file; NULL=disabled */
+static int listen_fd = -1;              /* Socket on which we accept connections */
+static pthread_t control_thread;        /* Thread that services the socket */
+static volatile int shutting_down = 0;  /* 1=jm_finalize_control_socket() was called */
+static int saved_debuglevel = -1;       /* Debug level before "trace start" (-1=not tracing) */
+
+
+/* Send a formatted string to the client. */
+static void
+reply (int client_fd, const char *format, ...)
+{
+  char message[MAX_COMMAND_LEN];   /* Formatted message */
+  va_list args;                    /* Argument list */
+  size_t msglen;                   /* Number of bytes to send */
+  size_t sent;                     /* Number of bytes sent so far */
+
+  va_start(args, format);
+  (void) vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  msglen = strlen(message);
+  for (sent=0; sent<msglen; ) {
+    ssize_t numbytes = send(client_fd, message+sent, msglen-sent, MSG_NOSIGNAL);
+
+    if (numbytes <= 0)
+      return;    /* The client went away; there's no one left to tell. */
+    sent += numbytes;
+  }
+}
+
+
+/* Parse a string as either an unsigned integer or a boolean value.
+ * Return 1 on success, 0 on failure. */
+static int
+parse_value (const char *valuestr, unsigned long *value)
+{
+  char *endptr;          /* Pointer to the first non-digit in valuestr */
+
+  if (!valuestr || !*valuestr)
+    return 0;
+  if (strchr("yYtT", valuestr[0])) {
+    *value = 1;
+    return 1;
+  }
+  if (strchr("nNfF", valuestr[0])) {
+    *value = 0;
+    return 1;
+  }
+  if (valuestr[0] == '-')
+    return 0;
+  *value = strtoul(valuestr, &endptr, 0);
+  return *endptr == '\0';
+}
+
+
+/* Describe the current settings in a buffer of a given size.  The
+ * caller sends the description once it no longer holds the
+ * mega-lock. */
+static void
+show_settings (char *buffer, size_t bufsize)
+{
+  static const char *type_name[] = {"none", "next", "delta", "stream"};
+
+  (void) snprintf(buffer, bufsize,
+                  "JM_PREFETCH=%s (using %s, %u %s ahead)\n"
+                  "JM_PREFETCH_DEPTH=%u\n"
+                  "JM_LOCAL_PAGES=%lu (of at most %lu)\n"
+                  "JM_DEBUG=%d%s\n",
+                  jm_globals.prefetch_auto ? "auto" : type_name[jm_globals.prefetch_type],
+                  type_name[jm_globals.prefetch_type], jm_globals.prefetch_depth,
+                  jm_globals.prefetch_depth==1 ? "page" : "pages",
+                  jm_globals.prefetch_max_depth,
+                  jm_globals.local_page_target, jm_globals.local_pages,
+                  jm_globals.debuglevel,
+                  saved_debuglevel == -1 ? "" : " (tracing)");
+}
+
+
+/* Change a single setting.  Return NULL on success or a textual
+ * reason on failure. */
+static const char *
+change_setting (const char *envvar, const char *valuestr)
+{
+  unsigned long value;            /* Numerical value of valuestr */
+
+  /* Change the prefetching technique. */
+  if (!strcmp(envvar, "JM_PREFETCH")) {
+    JUMBOMEM_PREFETCH prefetch_type;   /* New prefetching technique */
+    int prefetch_auto;                 /* 1=self-tuning; 0=fixed */
+    unsigned int max_depth;            /* New maximum depth */
+
+    if (!jm_parse_prefetch_type(valuestr, &prefetch_type, &prefetch_auto))
+      return "Unrecognized value for JM_PREFETCH";
+    if ((prefetch_type != PREFETCH_NONE || prefetch_auto)
+        && jm_page_is_resident(jm_globals.memregion, NULL) == -1)
+      return "The page-replacement algorithm does not support prefetching";
+    max_depth = jm_globals.prefetch_max_depth;
+    if (prefetch_auto && !jm_globals.prefetch_auto)
+      max_depth = JM_MAX_PREFETCH_DEPTH;    /* Give the self-tuner room to grow. */
+    jm_reconfigure_prefetching(prefetch_type, prefetch_auto, max_depth);
+    return NULL;
+  }
+
+  /* Change the prefetch depth. */
+  if (!strcmp(envvar, "JM_PREFETCH_DEPTH")) {
+    if (!parse_value(valuestr, &value) || value < 1 || value > JM_MAX_PREFETCH_DEPTH)
+      return "JM_PREFETCH_DEPTH is out of range";
+    jm_reconfigure_prefetching(jm_globals.prefetch_type, jm_globals.prefetch_auto,
+                               (unsigned int) value);
+    return NULL;
+  }
+
+  /* Change the number of pages to cache locally.  Shrinking takes
+   * effect on the next major fault. */
+  if (!strcmp(envvar, "JM_LOCAL_PAGES")) {
+    if (strchr(valuestr, '%')) {
+      char *endptr;        /* Pointer to the first character that's not part of a number */
+      double percent;      /* Percent of the maximum page count to use */
+
+      percent = strtod(valuestr, &endptr);
+      if (*endptr != '%' || percent < 0.0)
+        return "Unable to parse the JM_LOCAL_PAGES percentage";
+      value = (unsigned long) (jm_globals.local_pages * percent / 100.0);
+    }
+    else if (!parse_value(valuestr, &value))
+      return "JM_LOCAL_PAGES must be a page count or a percentage";
+    if (value < 2 || value > jm_globals.local_pages)
+      return "JM_LOCAL_PAGES is out of range";
+    jm_globals.local_page_target = value;
+    return NULL;
+  }
+
+  /* Pass anything else to the page-replacement algorithm. */
+  if (!parse_value(valuestr, &value))
+    return "Values must be nonnegative integers or booleans";
+  return jm_set_pagereplace_parameter(envvar, value);
+}
+
+
+/* Process a single command.  Return 1 if the client should be
+ * disconnected, 0 otherwise. */
+static int
+process_command (int client_fd, char *command)
+{
+  char *words[4];                 /* Command and its arguments */
+  int numwords = 0;               /* Number of entries in words[] */
+  char *saveptr;                  /* Internal state for strtok_r() */
+  char *oneword;                  /* A single word from the command line */
+  const char *errmsg = NULL;      /* Reason a command failed */
+  char settings[MAX_COMMAND_LEN]; /* Output of the "show" command */
+
+  /* Split the command into words. */
+  for (oneword=strtok_r(command, " \t\r", &saveptr);
+       oneword && numwords<4;
+       oneword=strtok_r(NULL, " \t\r", &saveptr))
+    words[numwords++] = oneword;
+  if (numwords == 0)
+    return 0;
+  if (!strcmp(words[0], "quit"))
+    return 1;
+  if (!strcmp(words[0], "help")) {
+    reply(client_fd, "set <variable> <value>  Change JM_PREFETCH, JM_PREFETCH_DEPTH, JM_LOCAL_PAGES,\n");
+    reply(client_fd, "                        or a page-replacement parameter (e.g., JM_NRU_INTERVAL)\n");
+    reply(client_fd, "show                    Show the current settings\n");
+    reply(client_fd, "stats                   Write fault statistics to the JumboMem log\n");
+    reply(client_fd, "trace start|stop        Start or stop logging every page fault\n");
+    reply(client_fd, "quit                    Close the connection\n");
+    reply(client_fd, "OK\n");
+    return 0;
+  }
+
+  /* All remaining commands modify or inspect state shared with the
+   * fault handler.  We never write to the client while holding the
+   * mega-lock lest a client that stops reading stall the program. */
+  settings[0] = '\0';
+  jm_enter_critical_section();
+  if (shutting_down)
+    errmsg = "JumboMem is shutting down";
+  else if (!strcmp(words[0], "show") && numwords == 1)
+    show_settings(settings, sizeof(settings));
+  else if (!strcmp(words[0], "set") && numwords == 3) {
+    if ((errmsg=change_setting(words[1], words[2])) == NULL)
+      jm_debug_printf(2, "Control socket set %s to %s.\n", words[1], words[2]);
+  }
+  else if (!strcmp(words[0], "stats") && numwords == 1) {
+#ifdef JM_DEBUG
+    jm_report_fault_statistics(0);
+#else
+    errmsg = "JumboMem was compiled without statistics support";
+#endif
+  }
+  else if (!strcmp(words[0], "trace") && numwords == 2) {
+#ifdef JM_DEBUG
+    if (!strcmp(words[1], "start")) {
+      if (saved_debuglevel == -1) {
+        saved_debuglevel = jm_globals.debuglevel;
+        if (jm_globals.debuglevel < TRACE_DEBUG_LEVEL)
+          jm_globals.debuglevel = TRACE_DEBUG_LEVEL;
+      }
+    }
+    else if (!strcmp(words[1], "stop")) {
+      if (saved_debuglevel != -1) {
+        jm_globals.debuglevel = saved_debuglevel;
+        saved_debuglevel = -1;
+      }
+    }
+    else
+      errmsg = "Usage: trace start|stop";
+#else
+    errmsg = "JumboMem was compiled without tracing support";
+#endif
+  }
+  else
+    errmsg = "Unrecognized command (try \"help\")";
+  jm_exit_critical_section();
+
+  /* Report success or failure. */
+  if (settings[0])
+    reply(client_fd, "%s", settings);
+  if (errmsg)
+    reply(client_fd, "ERROR %s\n", errmsg);
+  else
+    reply(client_fd, "OK\n");
+  return 0;
+}
+
+
+/* Service one client until it disconnects. */
+static void
+serve_client (int client_fd)
+{
+  char buffer[MAX_COMMAND_LEN];  /* Partial command text */
+  size_t buflen = 0;             /* Number of valid bytes in buffer[] */
+
+  while (!shutting_down) {
+    ssize_t numbytes;            /* Number of bytes received */
+    char *newline;               /* End of the current command */
+
+    numbytes = recv(client_fd, buffer+buflen, sizeof(buffer)-buflen-1, 0);
+    if (numbytes <= 0)
+      return;
+    buflen += numbytes;
+    buffer[buflen] = '\0';
+    while ((newline=strchr(buffer, '\n'))) {
+      *newline = '\0';
+      if (process_command(client_fd, buffer))
+        return;
+      buflen -= newline+1 - buffer;
+      memmove(buffer, newline+1, buflen+1);
+    }
+    if (buflen == sizeof(buffer)-1) {
+      reply(client_fd, "ERROR Command too long\n");
+      buflen = 0;
+    }
+  }
+}
+
+
+/* Accept connections on the control socket one at a time. */
+static void *
+control_thread_main (void *notused JM_UNUSED)
+{
+  jm_mark_thread_internal();
+  while (!shutting_down) {
+    int client_fd;               /* Socket connected to a client */
+
+    if ((client_fd=accept(listen_fd, NULL, NULL)) == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    serve_client(client_fd);
+    (void) close(client_fd);
+  }
+  return NULL;
+}
+
+
+/* Listen for commands on a Unix-domain socket if JM_CONTROL is set. */
+void
+jm_initialize_control_socket (void)
+{
+  struct sockaddr_un address;    /* Address of our socket */
+  struct stat statbuf;           /* Information about a preexisting file */
+  char *envname;                 /* Value of JM_CONTROL */
+
+  if (!(envname=getenv("JM_CONTROL")) || !*envname)
+    return;
+  if (strlen(envname) >= sizeof(address.sun_path))
+    jm_abort("JM_CONTROL names a file with too long a name (\"%s\")", envname);
+  socket_name = (char *) jm_malloc(strlen(envname) + 1);
+  strcpy(socket_name, envname);
+
+  /* Replace a stale socket left behind by a previous run but refuse
+   * to clobber anything else. */
+  if (lstat(socket_name, &statbuf) == 0) {
+    if (!S_ISSOCK(statbuf.st_mode))
+      jm_abort("JM_CONTROL names a file (%s) that is not a socket", socket_name);
+    (void) unlink(socket_name);
+  }
+
+  /* Create the socket. */
+  if ((listen_fd=socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    jm_abort("Failed to create a control socket (%s)", jm_strerror(errno));
+  memset((void *)&address, 0, sizeof(struct sockaddr_un));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_name);
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(struct sockaddr_un)) == -1)
+    jm_abort("Failed to bind the control socket to %s (%s)", socket_name, jm_strerror(errno));
+  if (listen(listen_fd, 1) == -1)
+    jm_abort("Failed to listen on the control socket (%s)", jm_strerror(errno));
+
+  /* Service the socket from a separate thread. */
+  if (pthread_create(&control_thread, NULL, control_thread_main, NULL))
+    jm_abort("Failed to create a thread to service the control socket");
+  jm_debug_printf(2, "Listening for control commands on %s.\n", socket_name);
+}
+
+
+/* Stop accepting commands and remove the control socket.  We don't
+ * wait for the control thread to exit because it may be blocked on
+ * the mega-lock, which our caller holds. */
+void
+jm_finalize_control_socket (void)
+{
+  if (!socket_name)
+    return;
+  shutting_down = 1;
+  (void) shutdown(listen_fd, SHUT_RDWR);
+  (void) close(listen_fd);
+  (void) unlink(socket_name);
+  jm_free(socket_name);
+  socket_name = NULL;
+}
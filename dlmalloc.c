@@ -1171,6 +1171,18 @@ int mspace_mallopt(int, int);
 #ifndef LACKS_STRING_H
 #include <string.h>      /* for memset etc */
 #endif  /* LACKS_STRING_H */
+/* Added by SDP to let JumboMem avoid touching pages that are known
+   to contain only zeros when clearing or copying memory. */
+#ifdef CALLOC_CLEAR
+extern void CALLOC_CLEAR(void *, size_t);
+#else
+#define CALLOC_CLEAR(mem, n) memset(mem, 0, n)
+#endif
+#ifdef REALLOC_COPY
+extern void REALLOC_COPY(void *, const void *, size_t);
+#else
+#define REALLOC_COPY(dest, src, n) memcpy(dest, src, n)
+#endif
 #if USE_BUILTIN_FFS
 #ifndef LACKS_STRINGS_H
 #include <strings.h>     /* for ffs */
@@ -3795,7 +3807,7 @@ static void* internal_realloc(mstate m, void* oldmem, size_t bytes) {
       void* newmem = internal_malloc(m, bytes);
       if (newmem != 0) {
         size_t oc = oldsize - overhead_for(oldp);
-        memcpy(newmem, oldmem, (oc < bytes)? oc : bytes);
+        REALLOC_COPY(newmem, oldmem, (oc < bytes)? oc : bytes);
         internal_free(m, oldmem);
       }
       return newmem;
@@ -3968,7 +3980,7 @@ static void** ialloc(mstate m,
   assert(!is_mmapped(p));
 
   if (opts & 0x2) {       /* optionally clear the elements */
-    memset((size_t*)mem, 0, remainder_size - SIZE_T_SIZE - array_size);
+    CALLOC_CLEAR((size_t*)mem, remainder_size - SIZE_T_SIZE - array_size);
   }
 
   /* If not provided, allocate the pointer array as final part of chunk */
@@ -4267,7 +4279,7 @@ void* dlcalloc(size_t n_elements, size_t elem_size) {
   }
   mem = dlmalloc(req);
   if (mem != 0 && calloc_must_clear(mem2chunk(mem)))
-    memset(mem, 0, req);
+    CALLOC_CLEAR(mem, req);
   return mem;
 }
 
@@ -4670,7 +4682,7 @@ void* mspace_calloc(mspace msp, size_t n_elements, size_t elem_size) {
   }
   mem = internal_malloc(ms, req);
   if (mem != 0 && calloc_must_clear(mem2chunk(mem)))
-    memset(mem, 0, req);
+    CALLOC_CLEAR(mem, req);
   return mem;
 }
 
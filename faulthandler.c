@@ -34,6 +34,57 @@
 # define MAX_PAGE_DELTA 4
 #endif
 
+/* Define the number of major faults over which a self-tuning
+ * prefetcher measures its accuracy before adjusting itself. */
+#ifndef PREFETCH_WINDOW
+# define PREFETCH_WINDOW 64
+#endif
+
+/* Define the percentage of prefetched pages that must be used for a
+ * self-tuning prefetcher to prefetch one page deeper and the
+ * percentage below which it halves its prefetch depth. */
+#ifndef PREFETCH_GROW_PCT
+# define PREFETCH_GROW_PCT 75
+#endif
+#ifndef PREFETCH_SHRINK_PCT
+# define PREFETCH_SHRINK_PCT 40
+#endif
+
+/* Define the number of pages immediately behind a sequential write
+ * stream that write-behind leaves in place in case the program is
+ * still finishing them. */
+#ifndef WRITE_BEHIND_LAG
+# define WRITE_BEHIND_LAG 1
+#endif
+
+/* Define the relative costs of evicting a page: sending a dirty page
+ * to a slave, writing a dirty page to the file tier, each transfer
+ * already queued on the page's slave, refaulting on a page that an
+ * active prefetch stream has just passed, and taking a page from a
+ * range that is down to its reserved share of the cache. */
+#ifndef EVICT_COST_SEND
+# define EVICT_COST_SEND 2
+#endif
+#ifndef EVICT_COST_FILE
+# define EVICT_COST_FILE 4
+#endif
+#ifndef EVICT_COST_QUEUED
+# define EVICT_COST_QUEUED 1
+#endif
+#ifndef EVICT_COST_REFAULT
+# define EVICT_COST_REFAULT 4
+#endif
+#ifndef EVICT_COST_RESERVED
+# define EVICT_COST_RESERVED 1000
+#endif
+
+/* Define the number of pages a sequential writer may pass through
+ * without faulting (because they were already resident) and still be
+ * considered the same write stream. */
+#ifndef WRITE_STREAM_GAP
+# define WRITE_STREAM_GAP 8
+#endif
+
 /* Import all of our shared global variables */
 extern JUMBOMEM_GLOBALS jm_globals;
 
@@ -60,7 +111,46 @@ typedef struct {
 
 static ASYNC_INFO fetch_info;
 static ASYNC_INFO evict_info;
-static ASYNC_INFO prefetch_info;
+static ASYNC_INFO prefetch_info[JM_MAX_PREFETCH_DEPTH];
+static unsigned int next_prefetch_slot = 0;   /* Slot in prefetch_info[] to recycle next */
+static int prefetch_hints = 0;   /* 1=the program has requested prefetches itself */
+
+/* Keep track of which pages have ever been written to a slave or to
+ * the file tier.  The rest have no remote content and can be mapped
+ * without fetching anything. */
+static unsigned char *populated = NULL;   /* One bit per page of jm_globals.max_extent */
+static char *next_fresh_fault = NULL;     /* Page following the previous batch of fresh pages */
+#define PAGE_IS_POPULATED(ADDR) \
+  (populated[GET_PAGE_NUMBER(ADDR)/8] & (1 << (GET_PAGE_NUMBER(ADDR)%8)))
+#define MARK_POPULATED(ADDR) \
+  (populated[GET_PAGE_NUMBER(ADDR)/8] |= 1 << (GET_PAGE_NUMBER(ADDR)%8))
+
+/* Keep track of runs of sequential write faults.  Once a run is long
+ * enough, or if the program said it would overwrite a range, pages
+ * the writer has moved past are written back and evicted right away
+ * so output doesn't crowd other data out of the local cache. */
+static char *write_stream_next = NULL;    /* Page on which a sequential writer should fault next */
+static unsigned long write_stream_length = 0;   /* Number of consecutive sequential write faults */
+static char *write_behind_next = NULL;    /* First page of the current stream not yet written back */
+static char *write_only_start = NULL;     /* Start of the range the program will overwrite */
+static char *write_only_end = NULL;       /* Address past the end of the above */
+
+/* Keep track of how well each prefetching technique would have
+ * predicted the most recent faults so that a self-tuning prefetcher
+ * can switch techniques and adjust its depth. */
+typedef struct {
+  char *prev_fault_addr;          /* Previously faulted page */
+  ptrdiff_t prev_delta;           /* Distance in bytes between the previous two faults */
+  char *predicted_from;           /* Fault address from which the predictions below were made */
+  ptrdiff_t predicted_stride[PREFETCH_STREAM+1];  /* Stride each technique predicted (0=none) */
+  unsigned long faults;           /* Major faults observed in the current window */
+  unsigned long used;             /* Prefetched pages consumed in the current window */
+  unsigned long wasted;           /* Prefetched pages discarded in the current window */
+  unsigned long shadow_hits[PREFETCH_STREAM+1];   /* Faults each technique would have predicted */
+  unsigned long mode_changes;     /* Number of times the technique or depth changed */
+} PREFETCH_TUNER;
+
+static PREFETCH_TUNER tuner;
 
 /* Define various statistics to keep track of if debugging is enabled. */
 #ifdef JM_DEBUG
@@ -74,6 +164,13 @@ static unsigned long bad_prefetches = 0;  /* Number of prefetches whose data we
 static unsigned long pages_sent = 0;      /* Number of pages sent to slaves */
 static unsigned long pages_received = 0;  /* Number of pages received from slaves */
 static unsigned long clean_evictions = 0; /* Number of pages evicted without communication */
+static unsigned long fresh_pages = 0;     /* Number of pages mapped without fetching */
+static unsigned long fresh_batches = 0;   /* Number of faults that mapped more than one fresh page */
+static unsigned long zero_pages_skipped = 0;  /* Number of known-zero pages jm_zero_memory() didn't touch */
+static unsigned long pages_discarded = 0; /* Number of pages whose remote content was discarded */
+static unsigned long write_streams = 0;   /* Number of sequential write streams detected */
+static unsigned long pages_written_behind = 0;  /* Number of pages evicted behind a write stream */
+static unsigned long cheaper_victims = 0; /* Number of times a costlier first-choice victim was passed over */
 static unsigned long page_deltas[MAX_PAGE_DELTA*2+1];   /* Tallies of deltas between faulted pages */
 static unsigned long predictable_deltas = 0;   /* Number of deltas that matched the previous delta */
 static unsigned long unpredictable_deltas = 0; /* Number of deltas that differed from the previous delta */
@@ -84,23 +181,74 @@ static struct rusage usage0;              /* Resource usage at initialization ti
 #endif
 
 
+/* Route a page transfer either to the page's slave or, if the page
+ * lies beyond the slaves' capacity, to the file tier.  File-tier
+ * transfers complete immediately and return file_tier_state. */
+static char file_tier_state;
+
+static inline void *
+backing_fetch_begin (char *fetch_addr, char *fetch_page)
+{
+  if (IN_FILE_TIER(fetch_addr)) {
+    jm_file_tier_fetch(fetch_addr, fetch_page);
+    return (void *) &file_tier_state;
+  }
+  return jm_fetch_begin(fetch_addr, fetch_page, jm_globals.pagesize);
+}
+
+static inline void
+backing_fetch_end (void *state)
+{
+  if (state != (void *) &file_tier_state)
+    jm_fetch_end(state);
+}
+
+static inline void *
+backing_evict_begin (char *evict_addr, char *evict_page)
+{
+  if (IN_FILE_TIER(evict_addr)) {
+    jm_file_tier_evict(evict_addr, evict_page);
+    return (void *) &file_tier_state;
+  }
+  return jm_evict_begin(evict_addr, evict_page, jm_globals.pagesize);
+}
+
+static inline void
+backing_evict_end (void *state)
+{
+  if (state != (void *) &file_tier_state)
+    jm_evict_end(state);
+}
+
+
 /* Fetch into a static buffer if extra_memcpy is set.  If extra_memcpy
- * is not set, fetch directly into the global memory region. */
+ * is not set, fetch directly into the global memory region.  Fetches
+ * from slaves are hedged if JM_HEDGE is set, in which case
+ * fetch_info.state is NULL. */
 static inline void
 fetch_begin (char *address, int protflags)
 {
+  char *target = jm_globals.extra_memcpy ? fetch_info.buffer : address;
+
   fetch_info.address = address;
   fetch_info.extra.protflags = protflags;
-  fetch_info.state = jm_fetch_begin(address,
-                                    jm_globals.extra_memcpy ? fetch_info.buffer : address);
+  if (jm_globals.hedge_percentile && !IN_FILE_TIER(address)) {
+    fetch_info.state = NULL;
+    jm_hedged_fetch_begin(address, target);
+  }
+  else
+    fetch_info.state = backing_fetch_begin(address, target);
 }
 
 static inline void
 fetch_end (void)
 {
-  jm_fetch_end(fetch_info.state);
+  if (fetch_info.state)
+    backing_fetch_end(fetch_info.state);
+  else
+    jm_hedged_fetch_end();
   if (jm_globals.extra_memcpy)
-    memcpy((void *)fetch_info.address, (void *)fetch_info.buffer, jm_globals.pagesize);
+    jm_copy_page(fetch_info.address, fetch_info.buffer, jm_globals.pagesize);
   if (fetch_info.extra.protflags != (PROT_READ|PROT_WRITE)) {
     jm_debug_printf(4, "Changing the permissions of page %p to 0x%08X.\n",
                     fetch_info.address, fetch_info.extra.protflags);
@@ -122,13 +270,23 @@ evict_begin (char *address, int clean)
 {
   evict_info.address = address;
   evict_info.extra.clean = clean;
+  jm_quota_page_evicted(address);
+  if (jm_globals.hedge_percentile && !IN_FILE_TIER(address)) {
+    /* A clean page still matches its slave's copy and can be
+     * replicated; a dirty page's replica is now stale. */
+    if (!clean)
+      jm_invalidate_replica(address);
+    else if (PAGE_IS_POPULATED(address))
+      jm_replicate_page(address);
+  }
   if (!clean) {
+    MARK_POPULATED(address);
     if (jm_globals.extra_memcpy) {
-      memcpy((void *)evict_info.buffer, (void *)address, jm_globals.pagesize);
-      evict_info.state = jm_evict_begin(address, evict_info.buffer);
+      jm_copy_page(evict_info.buffer, address, jm_globals.pagesize);
+      evict_info.state = backing_evict_begin(address, evict_info.buffer);
     }
     else
-      evict_info.state = jm_evict_begin(address, address);
+      evict_info.state = backing_evict_begin(address, address);
   }
   if (jm_globals.async_evict) {
     /* If we're evicting asynchronously we need to revoke write access
@@ -148,7 +306,7 @@ static inline void
 evict_end (void)
 {
   if (!evict_info.extra.clean)
-    jm_evict_end(evict_info.state);
+    backing_evict_end(evict_info.state);
   jm_remove_backing_store(evict_info.address, jm_globals.pagesize);
   evict_info.address = NULL;
 #ifdef JM_DEBUG
@@ -162,60 +320,221 @@ evict_end (void)
 
 /* Prefetches always involve a memcpy() because the target isn't yet
  * mapped.  Also, the calling code manually sets and clears
- * prefetch_info.address. */
+ * prefetch_info[].address. */
 static inline void
-prefetch_begin (char *fetch_addr, char *fetch_page)
+prefetch_begin (ASYNC_INFO *pfinfo, char *fetch_addr)
 {
-  prefetch_info.state = jm_fetch_begin(fetch_addr, fetch_page);
+  if (!pfinfo->buffer)
+    pfinfo->buffer = (char *) jm_valloc(jm_globals.pagesize);
+  pfinfo->address = fetch_addr;
+  pfinfo->state = backing_fetch_begin(fetch_addr, pfinfo->buffer);
 }
 
 static inline void
-prefetch_end (void)
+prefetch_end (ASYNC_INFO *pfinfo)
 {
-  jm_fetch_end(prefetch_info.state);
+  backing_fetch_end(pfinfo->state);
 #ifdef JM_DEBUG
   pages_received++;
 #endif
 }
 
 
-/* Prefetch the page after a given page. */
+/* Return the pending prefetch of a given page or NULL if the page
+ * isn't being prefetched. */
+static inline ASYNC_INFO *
+find_prefetch (char *rounded_addr)
+{
+  unsigned int i;
+
+  for (i=0; i<JM_MAX_PREFETCH_DEPTH; i++)
+    if (prefetch_info[i].address == rounded_addr)
+      return &prefetch_info[i];
+  return NULL;
+}
+
+
+/* Complete and discard a pending prefetch whose data we never used. */
 static void
-start_prefetch (char *rounded_addr)
+discard_prefetch (ASYNC_INFO *pfinfo)
+{
+  prefetch_end(pfinfo);
+  pfinfo->address = NULL;
+  tuner.wasted++;
+#ifdef JM_DEBUG
+  bad_prefetches++;
+#endif
+}
+
+
+/* Return a free prefetch slot if there is one.  Otherwise, recycle
+ * the oldest slot, discarding whatever it prefetched. */
+static ASYNC_INFO *
+claim_prefetch_slot (void)
+{
+  ASYNC_INFO *pfinfo;
+  unsigned int i;
+
+  for (i=0; i<JM_MAX_PREFETCH_DEPTH; i++)
+    if (!prefetch_info[i].address)
+      return &prefetch_info[i];
+  pfinfo = &prefetch_info[next_prefetch_slot];
+  next_prefetch_slot = (next_prefetch_slot+1) % JM_MAX_PREFETCH_DEPTH;
+  discard_prefetch(pfinfo);
+  return pfinfo;
+}
+
+
+/* Return the stride in bytes that a given prefetching technique
+ * predicts will follow a fault on a given page or 0 if the technique
+ * makes no prediction. */
+static ptrdiff_t
+prefetch_stride (JUMBOMEM_PREFETCH prefetch_type, char *rounded_addr)
 {
-  size_t pagesize = jm_globals.pagesize;  /* Cache of the JumboMem page size */
+  ptrdiff_t pagesize = (ptrdiff_t) jm_globals.pagesize;  /* Cache of the JumboMem page size */
+  ptrdiff_t delta;         /* Distance from the previous fault */
 
-  /* Select a candidate page to prefetch. */
-  switch (jm_globals.prefetch_type) {
-    /* Prefetch the page following the one that faulted. */
+  if (!tuner.prev_fault_addr)
+    return prefetch_type==PREFETCH_NEXT ? pagesize : 0;
+  delta = rounded_addr - tuner.prev_fault_addr;
+  switch (prefetch_type) {
+    /* Prefetch the page(s) following the one that faulted. */
     case PREFETCH_NEXT:
-      prefetch_info.address = rounded_addr + pagesize;
-      break;
+      return pagesize;
 
-    /* Prefetch the page following the one that faulted. */
+    /* Prefetch at the same distance as between the previous two faults. */
     case PREFETCH_DELTA:
-      {
-        static char *prev_fault_addr = NULL;   /* Previously faulted address */
+      return delta;
 
-        prefetch_info.address = rounded_addr + (rounded_addr-prev_fault_addr);
-        prev_fault_addr = rounded_addr;
-      }
-      break;
+    /* Prefetch ahead of a run of adjacent pages in either direction. */
+    case PREFETCH_STREAM:
+      if ((delta == pagesize || delta == -pagesize) && delta == tuner.prev_delta)
+        return delta;
+      return 0;
 
     /* We should never get here. */
     default:
-      jm_abort("Internal error: Unknown prefetch type %d\n", jm_globals.prefetch_type);
+      jm_abort("Internal error: Unknown prefetch type %d\n", prefetch_type);
       break;
   }
+  return 0;
+}
 
-  /* Cancel the prefetch if the address is invalid or the page is
-   * already resident. */
-  if (prefetch_info.address < jm_globals.memregion
-      || prefetch_info.address >= jm_globals.memregion+jm_globals.extent
-      || jm_page_is_resident(prefetch_info.address, NULL))
-    prefetch_info.address = NULL;
-  else
-    prefetch_begin(prefetch_info.address, prefetch_info.buffer);
+
+/* Prefetch up to jm_globals.prefetch_depth pages following a given
+ * page.  Also, record what each prefetching technique would have
+ * prefetched so the self-tuning prefetcher can score it later. */
+static void
+start_prefetch (char *rounded_addr)
+{
+  ptrdiff_t stride;       /* Distance between prefetched pages */
+  unsigned int depth;     /* Number of pages ahead of rounded_addr */
+  int ptype;
+
+  /* Record each technique's prediction before we update the fault history. */
+  tuner.predicted_from = rounded_addr;
+  for (ptype=PREFETCH_NEXT; ptype<=PREFETCH_STREAM; ptype++)
+    tuner.predicted_stride[ptype] = prefetch_stride((JUMBOMEM_PREFETCH)ptype, rounded_addr);
+  stride = jm_globals.prefetch_type==PREFETCH_NONE ? 0 : tuner.predicted_stride[jm_globals.prefetch_type];
+  if (tuner.prev_fault_addr)
+    tuner.prev_delta = rounded_addr - tuner.prev_fault_addr;
+  tuner.prev_fault_addr = rounded_addr;
+  if (stride == 0)
+    return;
+
+  /* Prefetch each page in turn, skipping pages that are invalid,
+   * already resident, already being prefetched, or that have nothing
+   * to fetch. */
+  for (depth=1; depth<=jm_globals.prefetch_depth; depth++) {
+    char *fetch_addr = rounded_addr + stride*(ptrdiff_t)depth;   /* Page to prefetch */
+
+    if (fetch_addr < jm_globals.memregion
+        || fetch_addr >= jm_globals.memregion+jm_globals.extent
+        || !PAGE_IS_POPULATED(fetch_addr)
+        || find_prefetch(fetch_addr)
+        || jm_page_is_resident(fetch_addr, NULL))
+      continue;
+
+    prefetch_begin(claim_prefetch_slot(), fetch_addr);
+  }
+}
+
+
+/* Score each prefetching technique against the page that just
+ * faulted and, at the end of each window, adjust the prefetching
+ * technique and depth: add one page of depth while prefetches are
+ * accurate and halve the depth when they're not. */
+static void
+tune_prefetch (char *rounded_addr)
+{
+  unsigned int maxahead;       /* Number of pages ahead a prediction counts */
+  JUMBOMEM_PREFETCH best;      /* Technique with the most hits this window */
+  unsigned int prev_depth;     /* Depth before tuning */
+  JUMBOMEM_PREFETCH prev_type; /* Technique before tuning */
+  int ptype;
+
+  /* Determine which techniques would have prefetched the current page. */
+  maxahead = jm_globals.prefetch_depth > 0 ? jm_globals.prefetch_depth : 1;
+  if (tuner.predicted_from)
+    for (ptype=PREFETCH_NEXT; ptype<=PREFETCH_STREAM; ptype++) {
+      ptrdiff_t stride = tuner.predicted_stride[ptype];
+      ptrdiff_t distance = rounded_addr - tuner.predicted_from;
+
+      if (stride != 0
+          && distance % stride == 0
+          && distance/stride >= 1
+          && distance/stride <= (ptrdiff_t)maxahead)
+        tuner.shadow_hits[ptype]++;
+    }
+  if (!jm_globals.prefetch_auto || ++tuner.faults < PREFETCH_WINDOW)
+    return;
+
+  /* Additively increase or multiplicatively decrease the depth based
+   * on how many of our prefetches were used. */
+  prev_depth = jm_globals.prefetch_depth;
+  prev_type = jm_globals.prefetch_type;
+  if (tuner.used + tuner.wasted > 0) {
+    unsigned long accuracy = 100*tuner.used / (tuner.used + tuner.wasted);
+
+    if (accuracy >= PREFETCH_GROW_PCT) {
+      if (jm_globals.prefetch_depth < jm_globals.prefetch_max_depth)
+        jm_globals.prefetch_depth++;
+    }
+    else if (accuracy < PREFETCH_SHRINK_PCT)
+      jm_globals.prefetch_depth /= 2;
+  }
+
+  /* Switch to whichever technique would have predicted the most
+   * faults.  If prefetching is currently off, turn it back on once a
+   * technique becomes accurate enough. */
+  best = PREFETCH_NEXT;
+  for (ptype=PREFETCH_NEXT; ptype<=PREFETCH_STREAM; ptype++)
+    if (tuner.shadow_hits[ptype] > tuner.shadow_hits[best])
+      best = (JUMBOMEM_PREFETCH) ptype;
+  if (jm_globals.prefetch_type == PREFETCH_NONE
+      || tuner.shadow_hits[best] > tuner.shadow_hits[jm_globals.prefetch_type])
+    jm_globals.prefetch_type = best;
+  if (jm_globals.prefetch_depth == 0
+      && 100*tuner.shadow_hits[best] >= PREFETCH_GROW_PCT*tuner.faults)
+    jm_globals.prefetch_depth = 1;
+  if (jm_globals.prefetch_depth != prev_depth || jm_globals.prefetch_type != prev_type) {
+#ifdef JM_DEBUG
+    static const char *type_name[] = {"none", "next", "delta", "stream"};
+#endif
+
+    tuner.mode_changes++;
+    jm_debug_printf(3, "Prefetcher changed from %s/%u to %s/%u (%lu used, %lu wasted, %lu/%lu faults predicted).\n",
+                    type_name[prev_type], prev_depth,
+                    type_name[jm_globals.prefetch_type], jm_globals.prefetch_depth,
+                    tuner.used, tuner.wasted, tuner.shadow_hits[best], tuner.faults);
+  }
+
+  /* Start a new window. */
+  tuner.faults = 0;
+  tuner.used = 0;
+  tuner.wasted = 0;
+  for (ptype=PREFETCH_NEXT; ptype<=PREFETCH_STREAM; ptype++)
+    tuner.shadow_hits[ptype] = 0;
 }
 
 
@@ -224,43 +543,34 @@ start_prefetch (char *rounded_addr)
 static void
 complete_prefetch (char *rounded_addr, int protflags, char *evictable_page, int clean)
 {
+  ASYNC_INFO *pfinfo;      /* Prefetch of the current page, if any */
+
   /* See if we prefetched the current page. */
-  if (prefetch_info.address) {
-    /* We prefetched *something*.  Was it the page we wanted? */
-    prefetch_end();
-    if (prefetch_info.address == rounded_addr) {
-      /* Yes!  Evict an old page and copy in the prefetched page. */
-      if (evictable_page)
-        evict_begin(evictable_page, clean);
-      memcpy((void *)rounded_addr, (void *)prefetch_info.buffer, jm_globals.pagesize);
+  if ((pfinfo=find_prefetch(rounded_addr))) {
+    /* Yes!  Evict an old page and copy in the prefetched page. */
+    prefetch_end(pfinfo);
+    if (evictable_page)
+      evict_begin(evictable_page, clean);
+    jm_copy_page(rounded_addr, pfinfo->buffer, jm_globals.pagesize);
+    pfinfo->address = NULL;
+    tuner.used++;
 #ifdef JM_DEBUG
-      good_prefetches++;
+    good_prefetches++;
 #endif
 
-      /* Set the final permissions on the prefetched page. */
-      if (protflags != (PROT_READ|PROT_WRITE)) {
-        jm_debug_printf(4, "Changing the permissions of prefetched page %p to 0x%08X.\n",
-                        rounded_addr, protflags);
-        if (mprotect((void *)rounded_addr, jm_globals.pagesize, protflags) == -1)
-          jm_abort("Failed to set access permissions on page %p (%s)",
-                   rounded_addr, jm_strerror(errno));
-      }
-    }
-    else {
-      /* No.  Evict an old page, discard the prefetched page and fetch
-       * the correct new page from a remote server. */
-      fetch_begin(rounded_addr, protflags);
-      if (evictable_page)
-        evict_begin(evictable_page, clean);
-      fetch_end();
-#ifdef JM_DEBUG
-      bad_prefetches++;
-#endif
+    /* Set the final permissions on the prefetched page. */
+    if (protflags != (PROT_READ|PROT_WRITE)) {
+      jm_debug_printf(4, "Changing the permissions of prefetched page %p to 0x%08X.\n",
+                      rounded_addr, protflags);
+      if (mprotect((void *)rounded_addr, jm_globals.pagesize, protflags) == -1)
+        jm_abort("Failed to set access permissions on page %p (%s)",
+                 rounded_addr, jm_strerror(errno));
     }
   }
   else {
-    /* We had no prefetches pending -- evict an old page and fetch the
-     * new page from a remote server. */
+    /* No.  Evict an old page and fetch the new page from a remote
+     * server.  Any other pending prefetches remain in flight in case
+     * they're needed by a subsequent fault. */
     fetch_begin(rounded_addr, protflags);
     if (evictable_page)
       evict_begin(evictable_page, clean);
@@ -268,17 +578,446 @@ complete_prefetch (char *rounded_addr, int protflags, char *evictable_page, int
   }
 }
 
+/* Estimate the cost of evicting a page while faulted_page (which may
+ * be NULL) is fetched, in units of roughly one page transfer. */
+static unsigned int
+eviction_cost (char *page_addr, int clean, char *faulted_page)
+{
+  unsigned int cost = 0;   /* Accumulated cost */
+  unsigned int i;
+
+  /* A clean page is simply dropped.  A dirty page must be sent. */
+  if (!clean)
+    cost += IN_FILE_TIER(page_addr) ? EVICT_COST_FILE : EVICT_COST_SEND;
+
+  /* The send waits behind transfers already queued on the same slave,
+   * including the fetch of the faulted page. */
+  if (!clean && !IN_FILE_TIER(page_addr) && jm_globals.numslaves > 1) {
+    uint64_t slave = GET_SLAVE_NUM(page_addr);   /* Slave that would receive the page */
+
+    if (faulted_page && !IN_FILE_TIER(faulted_page) && GET_SLAVE_NUM(faulted_page) == slave)
+      cost += EVICT_COST_QUEUED;
+    if (evict_info.address && GET_SLAVE_NUM(evict_info.address) == slave)
+      cost += EVICT_COST_QUEUED;
+    for (i=0; i<JM_MAX_PREFETCH_DEPTH; i++)
+      if (prefetch_info[i].address
+          && !IN_FILE_TIER(prefetch_info[i].address)
+          && GET_SLAVE_NUM(prefetch_info[i].address) == slave)
+        cost += EVICT_COST_QUEUED;
+  }
+
+  /* A page just behind a prefetched fault is likely still in use. */
+  if (faulted_page && jm_globals.prefetch_depth > 0) {
+    ptrdiff_t distance = page_addr - faulted_page;   /* Byte distance from the fault */
+
+    if (distance < 0)
+      distance = -distance;
+    if (distance <= (ptrdiff_t)(jm_globals.prefetch_depth*jm_globals.pagesize))
+      cost += EVICT_COST_REFAULT;
+  }
+
+  /* A page whose range has a cache reservation is all but exempt
+   * while the range holds no more than its reserved number of pages. */
+  if (jm_quota_reserves(page_addr, faulted_page))
+    cost += EVICT_COST_RESERVED;
+  return cost;
+}
+
+
+/* Given candidate pages to evict, equally ranked by the
+ * page-replacement module, return the index of the cheapest to
+ * evict.  Ties go to the earliest candidate. */
+unsigned int
+jm_cheapest_victim (char **candidates, const int *clean, unsigned int numcandidates, char *faulted_page)
+{
+  unsigned int best = 0;       /* Index of the cheapest candidate so far */
+  unsigned int best_cost;      /* Cost of evicting the above */
+  unsigned int i;
+
+  best_cost = eviction_cost(candidates[0], clean[0], faulted_page);
+  for (i=1; i<numcandidates && best_cost>0; i++) {
+    unsigned int cost = eviction_cost(candidates[i], clean[i], faulted_page);
+
+    if (cost < best_cost) {
+      best = i;
+      best_cost = cost;
+    }
+  }
+#ifdef JM_DEBUG
+  if (best > 0)
+    cheaper_victims++;
+#endif
+  return best;
+}
+
+/* Choose a page to evict in favor of a given page, as
+ * jm_find_replacement_page() does, but first keep the page's range
+ * within its cache quota, if any, by evicting the range's own oldest
+ * pages. */
+static void
+find_replacement_page (char *faulted_page, int *protflags, char **evictable_page, int *clean)
+{
+  char *quota_page;        /* Page evicted to make room within the quota */
+  int quota_clean;         /* 1=the above is clean */
+
+  while (jm_quota_overflow_page(faulted_page, &quota_page, &quota_clean)) {
+    if (evict_info.address)
+      evict_end();
+    evict_begin(quota_page, quota_clean);
+    if (evict_info.address)
+      evict_end();
+  }
+  jm_find_replacement_page(faulted_page, protflags, evictable_page, clean);
+  jm_quota_page_cached(faulted_page);
+}
+
+/* Map a faulted page that has never been populated, plus, if the
+ * faults are sweeping sequentially through fresh pages, up to
+ * jm_globals.fault_around-1 fresh pages that follow it.  None of these pages has
+ * remote content, so a single mmap() fills them all with zeros.  Each
+ * page beyond the first still goes through the page-replacement
+ * policy and may evict an old page.  Return the last page mapped. */
+static char *
+map_fresh_pages (char *rounded_addr, int protflags, char *evictable_page, int clean)
+{
+  size_t pagesize = jm_globals.pagesize;    /* Cache of the JumboMem page size */
+  char *endaddr = jm_globals.memregion + jm_globals.extent;  /* End of the global address space */
+  unsigned long maxpages = 1;    /* Upper bound on the number of pages to map */
+  unsigned long numpages;        /* Number of pages to map */
+  unsigned long i;
+
+  /* Determine how many consecutive fresh pages to map.  We stop at
+   * the first page that is or may be resident, including the page
+   * we're about to evict. */
+  if (rounded_addr == next_fresh_fault) {
+    maxpages = jm_globals.fault_around;
+    if (maxpages > jm_globals.local_page_target/2)
+      maxpages = jm_globals.local_page_target/2;
+  }
+  for (numpages=1; numpages<maxpages; numpages++) {
+    char *nextaddr = rounded_addr + numpages*pagesize;   /* Candidate page */
+
+    if (nextaddr >= endaddr
+        || nextaddr == evictable_page
+        || PAGE_IS_POPULATED(nextaddr)
+        || jm_page_is_resident(nextaddr, NULL) != 0)
+      break;
+  }
+  next_fresh_fault = rounded_addr + numpages*pagesize;
+
+  /* Map all of the pages then set each page's protection as the
+   * page-replacement policy dictates. */
+  jm_debug_printf(4, "Mapping %lu fresh %s at address %p.\n",
+                  numpages, numpages==1 ? "page" : "pages", rounded_addr);
+  jm_assign_backing_store(rounded_addr, numpages*pagesize, PROT_READ|PROT_WRITE);
+  for (i=0; i<numpages; i++) {
+    char *pageaddr = rounded_addr + i*pagesize;   /* Page to account for */
+
+    if (i > 0)
+      find_replacement_page(pageaddr, &protflags, &evictable_page, &clean);
+    if (evictable_page) {
+      if (evict_info.address)
+        evict_end();
+      evict_begin(evictable_page, clean);
+    }
+    if (protflags != (PROT_READ|PROT_WRITE)
+        && mprotect(pageaddr, pagesize, protflags) == -1)
+      jm_abort("Failed to set access permissions on page %p (%s)",
+               pageaddr, jm_strerror(errno));
+  }
+#ifdef JM_DEBUG
+  fresh_pages += numpages;
+  if (numpages > 1)
+    fresh_batches++;
+#endif
+  return next_fresh_fault - pagesize;
+}
+
+/* Change the prefetching technique and depth while the program is
+ * running.  Pending prefetches are discarded because they may no
+ * longer be consumed in order. */
+void
+jm_reconfigure_prefetching (JUMBOMEM_PREFETCH prefetch_type, int prefetch_auto, unsigned int max_depth)
+{
+  unsigned int i;
+
+  for (i=0; i<JM_MAX_PREFETCH_DEPTH; i++)
+    if (prefetch_info[i].address)
+      discard_prefetch(&prefetch_info[i]);
+  memset((void *)&tuner, 0, sizeof(PREFETCH_TUNER));
+  jm_globals.prefetch_type = prefetch_type;
+  jm_globals.prefetch_auto = prefetch_auto;
+  jm_globals.prefetch_max_depth = max_depth;
+  if (prefetch_type == PREFETCH_NONE)
+    jm_globals.prefetch_depth = 0;
+  else
+    jm_globals.prefetch_depth = prefetch_auto ? 1 : max_depth;
+}
+
+
+/* Start prefetching the pages spanned by a range of addresses, up to
+ * JM_MAX_PREFETCH_DEPTH of them, at the program's request.  A later
+ * fault on one of those pages completes its prefetch. */
+void
+jm_prefetch_hint (const char *baseaddr, size_t numbytes)
+{
+  char *startaddr = (char *) baseaddr;        /* First address to prefetch */
+  char *endaddr = (char *) baseaddr + numbytes;   /* Address past the last to prefetch */
+  char *fetch_addr;        /* Page to prefetch */
+  unsigned int numpages;   /* Number of pages prefetched so far */
+
+  JM_ENTER();
+  if (jm_globals.numslaves < 1)
+    JM_RETURN();
+  if (startaddr < jm_globals.memregion)
+    startaddr = jm_globals.memregion;
+  if (endaddr > jm_globals.memregion+jm_globals.extent)
+    endaddr = jm_globals.memregion+jm_globals.extent;
+  if (startaddr >= endaddr)
+    JM_RETURN();
+  fetch_addr = jm_globals.memregion + GET_PAGE_NUMBER(startaddr)*jm_globals.pagesize;
+  for (numpages=0;
+       fetch_addr<endaddr && numpages<JM_MAX_PREFETCH_DEPTH;
+       fetch_addr+=jm_globals.pagesize) {
+    if (!PAGE_IS_POPULATED(fetch_addr)
+        || find_prefetch(fetch_addr)
+        || jm_page_is_resident(fetch_addr, NULL))
+      continue;
+    prefetch_begin(claim_prefetch_slot(), fetch_addr);
+    prefetch_hints = 1;
+    numpages++;
+  }
+  JM_RETURN();
+}
+
+/* Return 1 if a page is known to contain only zeros: it has never
+ * been populated and isn't resident, so the next fault on it will map
+ * a fresh page.  Return 0 if the page may hold nonzero data. */
+static inline int
+page_is_known_zero (char *rounded_addr)
+{
+  return !PAGE_IS_POPULATED(rounded_addr)
+    && jm_page_is_resident(rounded_addr, NULL) == 0;
+}
+
+
+/* Return 1 if a range of addresses lies wholly within the global
+ * address space and we're tracking which of its pages are populated. */
+static inline int
+range_is_tracked (const char *baseaddr, size_t numbytes)
+{
+  return populated
+    && baseaddr >= jm_globals.memregion
+    && baseaddr + numbytes <= jm_globals.memregion + jm_globals.extent;
+}
+
+
+/* Zero a range of memory as memset() would, but leave alone any page
+ * that is known to contain only zeros.  This keeps calloc() from
+ * faulting in, and later evicting, pages that were never written. */
+void
+jm_zero_memory (void *baseaddr, size_t numbytes)
+{
+  char *startaddr = (char *) baseaddr;        /* First address to zero */
+  char *endaddr = (char *) baseaddr + numbytes;   /* Address past the last to zero */
+  size_t pagesize = jm_globals.pagesize;      /* Cache of the JumboMem page size */
+
+  JM_ENTER();
+  if (!range_is_tracked(startaddr, numbytes)) {
+    memset(baseaddr, 0, numbytes);
+    JM_RETURN();
+  }
+  while (startaddr < endaddr) {
+    char *rounded_addr = jm_globals.memregion + GET_PAGE_NUMBER(startaddr)*pagesize;
+    char *nextaddr = rounded_addr + pagesize;    /* Start of the following page */
+
+    if (nextaddr > endaddr)
+      nextaddr = endaddr;
+    if (page_is_known_zero(rounded_addr)) {
+#ifdef JM_DEBUG
+      zero_pages_skipped++;
+#endif
+    }
+    else
+      memset(startaddr, 0, nextaddr - startaddr);
+    startaddr = nextaddr;
+  }
+  JM_RETURN();
+}
+
+
+/* Copy a range of memory as memcpy() would, but zero rather than copy
+ * the parts of the source that are known to contain only zeros.
+ * This keeps realloc() from faulting in untouched source pages. */
+void
+jm_copy_memory (void *target, const void *source, size_t numbytes)
+{
+  char *srcaddr = (char *) source;            /* Current source address */
+  char *endaddr = (char *) source + numbytes; /* Address past the last to copy */
+  char *tgtaddr = (char *) target;            /* Current target address */
+  size_t pagesize = jm_globals.pagesize;      /* Cache of the JumboMem page size */
+
+  JM_ENTER();
+  if (!range_is_tracked(srcaddr, numbytes)) {
+    memcpy(target, source, numbytes);
+    JM_RETURN();
+  }
+  while (srcaddr < endaddr) {
+    char *rounded_addr = jm_globals.memregion + GET_PAGE_NUMBER(srcaddr)*pagesize;
+    char *nextaddr = rounded_addr + pagesize;    /* Start of the following page */
+
+    if (nextaddr > endaddr)
+      nextaddr = endaddr;
+    if (page_is_known_zero(rounded_addr))
+      jm_zero_memory(tgtaddr, nextaddr - srcaddr);
+    else
+      memcpy(tgtaddr, srcaddr, nextaddr - srcaddr);
+    tgtaddr += nextaddr - srcaddr;
+    srcaddr = nextaddr;
+  }
+  JM_RETURN();
+}
+
+
+/* Declare that the contents of a range of memory are no longer
+ * needed.  Each page lying wholly within the range that isn't
+ * resident reverts to being known to contain only zeros, so its next
+ * fault maps a fresh page instead of fetching stale data. */
+void
+jm_discard_memory (void *baseaddr, size_t numbytes)
+{
+  size_t pagesize = jm_globals.pagesize;      /* Cache of the JumboMem page size */
+  char *startaddr;         /* First page to discard */
+  char *endaddr;           /* Address past the last page to discard */
+  char *pageaddr;          /* Current page */
+
+  JM_ENTER();
+  if (numbytes < pagesize || !range_is_tracked((char *)baseaddr, numbytes))
+    JM_RETURN();
+  startaddr = jm_globals.memregion
+    + GET_PAGE_NUMBER((char *)baseaddr + pagesize - 1)*pagesize;
+  endaddr = jm_globals.memregion
+    + GET_PAGE_NUMBER((char *)baseaddr + numbytes)*pagesize;
+  for (pageaddr=startaddr; pageaddr<endaddr; pageaddr+=pagesize) {
+    ASYNC_INFO *pfinfo;    /* Pending prefetch of the current page */
+
+    if (!PAGE_IS_POPULATED(pageaddr) || jm_page_is_resident(pageaddr, NULL) != 0)
+      continue;
+    if ((pfinfo=find_prefetch(pageaddr)))
+      discard_prefetch(pfinfo);
+    populated[GET_PAGE_NUMBER(pageaddr)/8] &= ~(1 << (GET_PAGE_NUMBER(pageaddr)%8));
+#ifdef JM_DEBUG
+    pages_discarded++;
+#endif
+  }
+  JM_RETURN();
+}
+
+
+/* Declare that the program will overwrite a range of memory from
+ * front to back without reading it first.  The range's pages needn't
+ * be fetched, and faults in the range count as a write stream from the
+ * outset. */
+void
+jm_write_only_hint (const char *baseaddr, size_t numbytes)
+{
+  JM_ENTER();
+  jm_discard_memory((void *)baseaddr, numbytes);
+  write_only_start = (char *) baseaddr;
+  write_only_end = (char *) baseaddr + numbytes;
+  JM_RETURN();
+}
+
+
+/* Return 1 if a fault was caused by a write, 0 if it was caused by a
+ * read, or -1 if we can't tell on this platform. */
+static inline int
+fault_is_write (void *context)
+{
+#if defined(__linux__) && defined(REG_ERR)
+  return (((ucontext_t *)context)->uc_mcontext.gregs[REG_ERR] & 0x2) != 0;
+#else
+  return -1;
+#endif
+}
+
+
+/* Account for a major fault on a given page in the detection of
+ * sequential write streams.  If the fault continues a stream, write
+ * back and evict the stream's pages that the writer has moved past.
+ * Return 1 if the fault was a write that a stream may continue from,
+ * 0 otherwise. */
+static int
+track_write_stream (char *rounded_addr, int is_write)
+{
+  size_t pagesize = jm_globals.pagesize;    /* Cache of the JumboMem page size */
+  char *stopaddr;          /* First page not to write back */
+  int hinted;              /* 1=the fault lies in a range the program will overwrite */
+  int clean;               /* 1=the page being written back is clean */
+
+  /* Determine if the fault continues a stream or starts a new one. */
+  hinted = rounded_addr >= write_only_start && rounded_addr < write_only_end;
+  if (hinted && is_write == 0) {
+    /* The program read what it said it would only overwrite. */
+    write_only_start = write_only_end = NULL;
+    hinted = 0;
+  }
+  if (!hinted && is_write != 1) {
+    if (rounded_addr == write_stream_next) {
+      write_stream_length = 0;
+      write_stream_next = NULL;
+    }
+    return 0;
+  }
+  if (!write_stream_next
+      || rounded_addr < write_behind_next
+      || rounded_addr > write_stream_next + WRITE_STREAM_GAP*pagesize) {
+    /* Start a new stream.  (Refaulting on a page the stream already
+     * passed but hasn't yet written back doesn't end the stream, nor
+     * does skipping over a few resident pages.) */
+    write_stream_length = 0;
+    write_stream_next = NULL;
+    write_behind_next = rounded_addr;
+  }
+  write_stream_length++;
+#ifdef JM_DEBUG
+  if (write_stream_length == (hinted ? 1 : jm_globals.write_stream))
+    write_streams++;
+#endif
+  if (!hinted && (!jm_globals.write_stream || write_stream_length < jm_globals.write_stream))
+    return 1;
+
+  /* Write back the pages the writer has moved past. */
+  stopaddr = rounded_addr - WRITE_BEHIND_LAG*pagesize;
+  for (; write_behind_next < stopaddr; write_behind_next += pagesize) {
+    if (!jm_release_page(write_behind_next, &clean))
+      continue;
+    evict_begin(write_behind_next, clean);
+    if (evict_info.address)
+      evict_end();
+#ifdef JM_DEBUG
+    pages_written_behind++;
+#endif
+  }
+  if (hinted && rounded_addr + pagesize >= write_only_end)
+    /* The writer reached the end of the range it said it would overwrite. */
+    write_only_start = write_only_end = NULL;
+  return 1;
+}
+
 /* ---------------------------------------------------------------------- */
 
 /* Convert segmentation faults to remote paging operations. */
 void
-jm_signal_handler (int signum, siginfo_t *siginfo, void *notused JM_UNUSED)
+jm_signal_handler (int signum, siginfo_t *siginfo, void *context)
 {
   size_t pagesize;       /* Cache of the JumboMem page size */
   char *rounded_addr;    /* Faulted address rounded down to a page boundary */
   char *evictable_page;  /* Page to evict from memory */
+  char *last_page;       /* Last page mapped in response to the fault */
   int   clean;           /* 0=evictable page is dirty; 1=clean */
   int   protflags;       /* Protection flags for mmap() or mprotect() */
+  int   in_stream;       /* 1=the fault was a write that a sequential stream may continue from */
   static char *fault_address = NULL;  /* Address that faulted */
 #ifdef JM_DEBUG
   uint64_t starttime;    /* Time at which we began replacing pages */
@@ -288,15 +1027,18 @@ jm_signal_handler (int signum, siginfo_t *siginfo, void *notused JM_UNUSED)
   /* When multiple threads enter the signal handler simultaneously, we
    * need to ensure that only one thread services the fault. */
   JM_ENTER();
-  if (jm_must_exit_signal_handler_now())
+  if (jm_must_exit_signal_handler_now(siginfo->si_code > 0))
     JM_RETURN();
 
   /* Determine if we need to get involved. */
   JM_RECORD_CYCLE("Entered the fault handler");
   pagesize = jm_globals.pagesize;
-  rounded_addr = (char *) (pagesize*((uintptr_t)siginfo->si_addr/pagesize));
-  if (rounded_addr < jm_globals.memregion
-      || rounded_addr >= jm_globals.memregion+jm_globals.extent) {
+  if ((char *)siginfo->si_addr < jm_globals.memregion
+      || (char *)siginfo->si_addr >= jm_globals.memregion+jm_globals.extent) {
+    /* The address may belong to a separately managed region. */
+    if (jm_region_fault((char *)siginfo->si_addr))
+      JM_RETURN();
+
     /* This must be a "real" segmentation fault. */
     jm_debug_printf(4, "Unknown address %p faulted.\n", siginfo->si_addr);
 #ifdef RTLD_NEXT
@@ -308,6 +1050,7 @@ jm_signal_handler (int signum, siginfo_t *siginfo, void *notused JM_UNUSED)
 #endif
     JM_RETURN();
   }
+  rounded_addr = jm_globals.memregion + GET_PAGE_NUMBER((char *)siginfo->si_addr)*pagesize;
 
   /* We do need to get involved.  However, we abort if we're already
    * involved in servicing another fault. */
@@ -317,14 +1060,9 @@ jm_signal_handler (int signum, siginfo_t *siginfo, void *notused JM_UNUSED)
   fault_address = siginfo->si_addr;
   jm_debug_printf(4, "Address %p faulted.\n", siginfo->si_addr);
 
-  /* Freeze all other threads before doing any page operations.
-   * (Although no other thread can be in this critical section, we
-   * need to ensure that no other thread can access a page whose data
-   * has not yet arrived.) */
-  jm_freeze_other_threads();
-
   /* If the page is already resident, change the permissions and
-   * return.  Note that we don't maintain timing statistics for
+   * return.  No data move, so there's no need to freeze the other
+   * threads.  Note that we don't maintain timing statistics for
    * permission alterations. */
   if (jm_page_is_resident(rounded_addr, &protflags)) {
     if (mprotect(rounded_addr, pagesize, protflags) == -1)
@@ -337,6 +1075,12 @@ jm_signal_handler (int signum, siginfo_t *siginfo, void *notused JM_UNUSED)
     JM_RETURN();
   }
 
+  /* Freeze all other threads before doing any page operations.
+   * (Although no other thread can be in this critical section, we
+   * need to ensure that no other thread can access a page whose data
+   * has not yet arrived.) */
+  jm_freeze_other_threads();
+
   /* Keep track of the number of page faults and the time we spent
    * processing them. */
 #ifdef JM_DEBUG
@@ -348,20 +1092,53 @@ jm_signal_handler (int signum, siginfo_t *siginfo, void *notused JM_UNUSED)
   if (evict_info.address)
     evict_end();
 
+  /* If the local cache target was lowered, evict pages without
+   * replacement until we're back within the target. */
+  while (jm_find_surplus_page(&evictable_page, &clean)) {
+    evict_begin(evictable_page, clean);
+    if (evict_info.address)
+      evict_end();
+  }
+
+  /* If the program is writing sequentially through memory, write back
+   * the pages it has finished with.  The slots they free let the
+   * faulted page in without evicting anything else. */
+  in_stream = track_write_stream(rounded_addr, fault_is_write(context));
+
   /* Evict one page and bring in another. */
   JM_RECORD_CYCLE("Finding a replacement page");
-  jm_find_replacement_page(rounded_addr, &protflags, &evictable_page, &clean);
+  find_replacement_page(rounded_addr, &protflags, &evictable_page, &clean);
   JM_RECORD_CYCLE("Found a replacement page");
-  jm_assign_backing_store(rounded_addr, pagesize, PROT_READ|PROT_WRITE);
-  if (jm_globals.prefetch_type != PREFETCH_NONE) {
+  last_page = rounded_addr;
+  if (!PAGE_IS_POPULATED(rounded_addr)) {
+    /* The page has never left the master, so there's nothing to
+     * fetch.  Let the prefetcher see the fault as though it were on
+     * the last fresh page we mapped so that a sequential sweep still
+     * looks sequential. */
+    last_page = map_fresh_pages(rounded_addr, protflags, evictable_page, clean);
+    if (jm_globals.prefetch_type != PREFETCH_NONE || jm_globals.prefetch_auto) {
+      tune_prefetch(rounded_addr);
+      start_prefetch(last_page);
+    }
+  }
+  else if (jm_globals.prefetch_type != PREFETCH_NONE || jm_globals.prefetch_auto) {
     /* Prefetching is enabled -- see if we've already prefetched the
      * page and fetch it if we haven't.  In either case, prefetch the
-     * next page. */
+     * next page(s). */
+    jm_assign_backing_store(rounded_addr, pagesize, PROT_READ|PROT_WRITE);
     complete_prefetch(rounded_addr, protflags, evictable_page, clean);
+    tune_prefetch(rounded_addr);
     start_prefetch(rounded_addr);
   }
+  else if (prefetch_hints) {
+    /* Prefetching is disabled but the program may have asked for the
+     * page to be prefetched. */
+    jm_assign_backing_store(rounded_addr, pagesize, PROT_READ|PROT_WRITE);
+    complete_prefetch(rounded_addr, protflags, evictable_page, clean);
+  }
   else {
     /* Prefetching is disabled -- fetch the page from a remote server. */
+    jm_assign_backing_store(rounded_addr, pagesize, PROT_READ|PROT_WRITE);
     JM_RECORD_CYCLE("Fetching a replacement page");
     fetch_begin(rounded_addr, protflags);
     if (evictable_page) {
@@ -372,6 +1149,8 @@ jm_signal_handler (int signum, siginfo_t *siginfo, void *notused JM_UNUSED)
     fetch_end();
     JM_RECORD_CYCLE("Fetched a replacement page");
   }
+  if (in_stream && last_page + pagesize > write_stream_next)
+    write_stream_next = last_page + pagesize;
 
   /* Maintain statistics of the time spent processing faults. */
 #ifdef JM_DEBUG
@@ -444,17 +1223,26 @@ jm_initialize_signal_handler (void)
   getrusage(RUSAGE_SELF, &usage0);
 #endif
 
-  /* Allocate memory for various page copies. */
-  if (jm_globals.prefetch_type != PREFETCH_NONE)
-    prefetch_info.buffer = (char *) jm_valloc(pagesize);
+  /* Allocate memory for various page copies.  (Prefetch buffers
+   * beyond the initial depth are allocated on first use.) */
+  for (i=0; i<JM_MAX_PREFETCH_DEPTH; i++) {
+    prefetch_info[i].buffer = NULL;
+    prefetch_info[i].address = NULL;
+  }
+  for (i=0; i<jm_globals.prefetch_depth; i++)
+    prefetch_info[i].buffer = (char *) jm_valloc(pagesize);
+  memset((void *)&tuner, 0, sizeof(PREFETCH_TUNER));
   if (jm_globals.extra_memcpy) {
     evict_info.buffer = (char *) jm_valloc(pagesize);
     fetch_info.buffer = (char *) jm_valloc(pagesize);
   }
-  prefetch_info.address = NULL;
   evict_info.address = NULL;
   fetch_info.address = NULL;
 
+  /* Initially, no page has been written anywhere but the master. */
+  populated = (unsigned char *) jm_malloc((jm_globals.max_extent/pagesize + 7) / 8);
+  memset((void *)populated, 0, (jm_globals.max_extent/pagesize + 7) / 8);
+
   /* Initialize (without talking to the slaves) as many pages as we
    * can cache locally. */
   for (i=0; i<localbytes; i+=pagesize) {
@@ -481,50 +1269,72 @@ jm_initialize_signal_handler (void)
 }
 
 
+/* Output the fault handler's statistics at a given debug level.
+ * This is a no-op unless JumboMem was compiled with JM_DEBUG. */
+void
+jm_report_fault_statistics (int level JM_UNUSED)
+{
+#ifdef JM_DEBUG
+  unsigned int i;
+
+  jm_debug_printf(level, "Total number of JumboMem page faults: %lu major, %lu minor\n",
+                  maj_pagefaults, min_pagefaults);
+  if (maj_pagefaults > 0)
+    jm_debug_printf(level, "JumboMem major-fault handling time (min/mean/max usecs): %llu %llu %llu\n",
+                    min_fault_time, total_fault_time/maj_pagefaults, max_fault_time);
+  if (total_fault_time > 0)
+    jm_debug_printf(level, "Mean JumboMem major-fault handling rate: %.1f MB/s\n",
+                    1e6*jm_globals.pagesize*(pages_sent+pages_received)/(total_fault_time*1048576.0));
+  if (jm_globals.prefetch_type != PREFETCH_NONE || jm_globals.prefetch_auto || prefetch_hints)
+    jm_debug_printf(level, "Useful prefetches: %lu; wasted prefetches: %lu\n",
+                    good_prefetches, bad_prefetches);
+  if (jm_globals.prefetch_auto)
+    jm_debug_printf(level, "Self-tuning prefetcher adjustments: %lu; current prefetch depth: %u\n",
+                    tuner.mode_changes, jm_globals.prefetch_depth);
+  jm_debug_printf(level, "Evictions of clean pages: %lu; evictions of dirty pages: %lu\n",
+                  clean_evictions, pages_sent);
+  jm_debug_printf(level, "Total communication: %lu pages sent and %lu pages received\n",
+                  pages_sent, pages_received);
+  jm_debug_printf(level, "Fresh pages mapped without communication: %lu (%lu faults mapped more than one)\n",
+                  fresh_pages, fresh_batches);
+  jm_debug_printf(level, "Known-zero pages left untouched by calloc() or realloc(): %lu; pages discarded by free() or hints: %lu\n",
+                  zero_pages_skipped, pages_discarded);
+  jm_debug_printf(level, "Sequential write streams: %lu; pages written back behind them: %lu\n",
+                  write_streams, pages_written_behind);
+  jm_debug_printf(level, "Evictions that passed over a costlier candidate: %lu\n",
+                  cheaper_victims);
+  jm_debug_printf(level, "Fault deltas:\n");
+  jm_debug_printf(level, "   +/- 1 page:  %lu faults\n",
+                  page_deltas[MAX_PAGE_DELTA+1] + page_deltas[MAX_PAGE_DELTA-1]);
+  for (i=2; i<=MAX_PAGE_DELTA; i++)
+    jm_debug_printf(level, "   +/- %u pages: %lu faults\n",
+                    i, page_deltas[MAX_PAGE_DELTA+i] + page_deltas[MAX_PAGE_DELTA-i]);
+  jm_debug_printf(level, "   +/- other:   %lu faults\n",
+                  page_deltas[MAX_PAGE_DELTA]);
+  if (predictable_deltas + unpredictable_deltas != 0)
+    jm_debug_printf(level, "Trivially predictable fault deltas: %.1f%%\n",
+                    100.0*predictable_deltas/(double)(predictable_deltas+unpredictable_deltas));
+#endif
+}
+
+
 /* Complete any pending operations and restore the original SIGSEGV handler. */
 void
 jm_finalize_signal_handler (void)
 {
-  if (jm_globals.prefetch_type != PREFETCH_NONE && prefetch_info.address)
-    prefetch_end();
+  unsigned int i;
+
+  for (i=0; i<JM_MAX_PREFETCH_DEPTH; i++)
+    if (prefetch_info[i].address)
+      discard_prefetch(&prefetch_info[i]);
   if (evict_info.address)
     evict_end();
   if (fetch_info.address)
     fetch_end();
 
   /* Report some final statistics on a successful exit. */
-#ifdef JM_DEBUG
-  if (!jm_globals.error_exit) {
-    int i;
-
-    jm_debug_printf(2, "Total number of JumboMem page faults: %lu major, %lu minor\n",
-                    maj_pagefaults, min_pagefaults);
-    if (maj_pagefaults > 0)
-      jm_debug_printf(2, "JumboMem major-fault handling time (min/mean/max usecs): %llu %llu %llu\n",
-                      min_fault_time, total_fault_time/maj_pagefaults, max_fault_time);
-    if (total_fault_time > 0)
-      jm_debug_printf(2, "Mean JumboMem major-fault handling rate: %.1f MB/s\n",
-                      1e6*jm_globals.pagesize*(pages_sent+pages_received)/(total_fault_time*1048576.0));
-    if (jm_globals.prefetch_type != PREFETCH_NONE)
-      jm_debug_printf(2, "Useful prefetches: %lu; wasted prefetches: %lu\n",
-                      good_prefetches, bad_prefetches);
-    jm_debug_printf(2, "Evictions of clean pages: %lu; evictions of dirty pages: %lu\n",
-                    clean_evictions, pages_sent);
-    jm_debug_printf(2, "Total communication: %lu pages sent and %lu pages received\n",
-                    pages_sent, pages_received);
-    jm_debug_printf(2, "Fault deltas:\n");
-    jm_debug_printf(2, "   +/- 1 page:  %lu faults\n",
-                    page_deltas[MAX_PAGE_DELTA+1] + page_deltas[MAX_PAGE_DELTA-1]);
-    for (i=2; i<=MAX_PAGE_DELTA; i++)
-      jm_debug_printf(2, "   +/- %d pages: %lu faults\n",
-                      i, page_deltas[MAX_PAGE_DELTA+i] + page_deltas[MAX_PAGE_DELTA-i]);
-    jm_debug_printf(2, "   +/- other:   %lu faults\n",
-                    page_deltas[MAX_PAGE_DELTA]);
-    if (predictable_deltas + unpredictable_deltas != 0)
-      jm_debug_printf(2, "Trivially predictable fault deltas: %.1f%%\n",
-                      100.0*predictable_deltas/(double)(predictable_deltas+unpredictable_deltas));
-  }
-#endif
+  if (!jm_globals.error_exit)
+    jm_report_fault_statistics(2);
 
 #ifdef RTLD_NEXT
   if (jm_original_sigaction(SIGSEGV, &jm_prev_segfaulter, NULL) == -1)
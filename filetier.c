@@ -0,0 +1,212 @@
+/*------------------------------------------------------------
+ * JumboMem memory server: File-backed growth of the global
+ * address space
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+/*
+ * The slaves' combined memory determines the initial size of the
+ * global address space.  If JM_MAXMEM reserves more address space
+ * than that, then once the program exhausts the slaves' capacity,
+ * jm_morecore() grows the address space and the pages beyond the
+ * slaves' capacity are stored in a file on the master.
+ */
+
+#include "jumbomem.h"
+#include <fcntl.h>
+#include <errno.h>
+
+extern JUMBOMEM_GLOBALS jm_globals;     /* All of our global variables */
+static int tier_fd = -1;                /* File holding pages past jm_globals.slave_extent */
+static size_t tier_bytes = 0;           /* Current length of the above */
+static size_t carved_bytes = 0;         /* Slave storage set aside for regions and replicas */
+#ifdef JM_DEBUG
+static unsigned long tier_reads = 0;    /* Number of pages read from the file */
+static unsigned long tier_writes = 0;   /* Number of pages written to the file */
+#endif
+
+
+/* Open the backing file.  We unlink it immediately so it vanishes
+ * when the program exits, however it exits. */
+static void
+open_file_tier (void)
+{
+  char *filename;        /* Name of the backing file */
+  const char *tmpdir;    /* Directory in which to create a default backing file */
+
+  if (getenv("JM_OVERFLOWFILE")) {
+    filename = (char *) jm_malloc(strlen(getenv("JM_OVERFLOWFILE")) + 1);
+    strcpy(filename, getenv("JM_OVERFLOWFILE"));
+  }
+  else {
+    if (!(tmpdir=getenv("TMPDIR")))
+      tmpdir = "/tmp";
+    filename = (char *) jm_malloc(strlen(tmpdir) + 50);
+    sprintf(filename, "%s/jumbomem-%ld.overflow", tmpdir, (long)getpid());
+  }
+  if ((tier_fd=open(filename, O_RDWR|O_CREAT|O_EXCL, 0600)) == -1)
+    jm_abort("Failed to create overflow file %s (%s)", filename, jm_strerror(errno));
+  (void) unlink(filename);
+  jm_debug_printf(2, "Storing memory beyond the slaves' capacity in %s.\n", filename);
+  jm_free(filename);
+}
+
+
+/* Grow the global address space to a given number of bytes, backing
+ * the growth with a file.  Return 1 on success, 0 on failure. */
+int
+jm_grow_address_space (size_t new_extent)
+{
+  /* Ensure we stay within the address space we reserved (none before
+   * JumboMem is initialized) then round up to a multiple of the
+   * JumboMem page size. */
+  if (new_extent > jm_globals.max_extent)
+    return 0;
+
+  /* Slave storage set aside for other purposes doesn't make room for
+   * growth.  Unless JM_MAXMEM reserved more address space than the
+   * slaves originally provided, stay within the slaves' capacity. */
+  if (jm_globals.max_extent <= jm_globals.slave_extent + carved_bytes
+      && new_extent > jm_globals.slave_extent)
+    return 0;
+  new_extent = ((new_extent + jm_globals.pagesize - 1) / jm_globals.pagesize) * jm_globals.pagesize;
+  if (new_extent <= jm_globals.extent)
+    return 1;
+
+  /* Extend the backing file to cover the new pages.  Unwritten pages
+   * read back as zeroes, just like fresh slave memory. */
+  if (tier_fd == -1)
+    open_file_tier();
+  if (ftruncate(tier_fd, (off_t)(new_extent - jm_globals.slave_extent)) == -1) {
+    jm_debug_printf(1, "Failed to grow the overflow file to %lu bytes (%s).\n",
+                    new_extent - jm_globals.slave_extent, jm_strerror(errno));
+    return 0;
+  }
+  tier_bytes = new_extent - jm_globals.slave_extent;
+  jm_debug_printf(2, "Growing the global address space from %sB to %sB.\n",
+                  jm_format_power_of_2((uint64_t)jm_globals.extent, 1),
+                  jm_format_power_of_2((uint64_t)new_extent, 1));
+  jm_globals.extent = new_extent;
+  return 1;
+}
+
+
+/* Set aside numbytes bytes of slave storage from the top of the
+ * global address space and return the address that corresponds to
+ * the first of them.  The caller must ensure that the address space
+ * hasn't grown and that the heap doesn't extend that far. */
+char *
+jm_carve_slave_storage (size_t numbytes)
+{
+  jm_globals.slave_extent -= numbytes;
+  jm_globals.extent = jm_globals.slave_extent;
+  carved_bytes += numbytes;
+  return jm_globals.memregion + jm_globals.slave_extent;
+}
+
+
+/* Give back slave storage set aside by jm_carve_slave_storage().
+ * This is possible only for the most recently carved storage and
+ * only if the address space hasn't since grown.  Return 1 on success,
+ * 0 on failure. */
+int
+jm_return_slave_storage (char *storage, size_t numbytes)
+{
+  if (storage != jm_globals.memregion + jm_globals.slave_extent
+      || jm_globals.extent != jm_globals.slave_extent)
+    return 0;
+  jm_globals.slave_extent += numbytes;
+  jm_globals.extent = jm_globals.slave_extent;
+  carved_bytes -= numbytes;
+  return 1;
+}
+
+
+/* Read a page from the file tier. */
+void
+jm_file_tier_fetch (char *fetch_addr, char *fetch_page)
+{
+  off_t offset = (off_t) ((fetch_addr - jm_globals.memregion) - jm_globals.slave_extent);
+  size_t numread;         /* Number of bytes read so far */
+
+  jm_debug_printf(4, "Reading the page at address %p from the overflow file.\n", fetch_addr);
+  for (numread=0; numread<jm_globals.pagesize; ) {
+    ssize_t numbytes = pread(tier_fd, fetch_page+numread, jm_globals.pagesize-numread,
+                             offset+(off_t)numread);
+
+    if (numbytes == -1 && errno == EINTR)
+      continue;
+    if (numbytes <= 0)
+      jm_abort("Failed to read the page at address %p from the overflow file (%s)",
+               fetch_addr, numbytes==0 ? "unexpected end of file" : jm_strerror(errno));
+    numread += numbytes;
+  }
+#ifdef JM_DEBUG
+  tier_reads++;
+#endif
+}
+
+
+/* Write a page to the file tier. */
+void
+jm_file_tier_evict (char *evict_addr, char *evict_page)
+{
+  off_t offset = (off_t) ((evict_addr - jm_globals.memregion) - jm_globals.slave_extent);
+  size_t numwritten;      /* Number of bytes written so far */
+
+  jm_debug_printf(4, "Writing the page at address %p to the overflow file.\n", evict_addr);
+  for (numwritten=0; numwritten<jm_globals.pagesize; ) {
+    ssize_t numbytes = pwrite(tier_fd, evict_page+numwritten, jm_globals.pagesize-numwritten,
+                              offset+(off_t)numwritten);
+
+    if (numbytes == -1 && errno == EINTR)
+      continue;
+    if (numbytes <= 0)
+      jm_abort("Failed to write the page at address %p to the overflow file (%s)",
+               evict_addr, jm_strerror(errno));
+    numwritten += numbytes;
+  }
+#ifdef JM_DEBUG
+  tier_writes++;
+#endif
+}
+
+
+/* Close the backing file. */
+void
+jm_finalize_file_tier (void)
+{
+  if (tier_fd == -1)
+    return;
+#ifdef JM_DEBUG
+  if (!jm_globals.error_exit)
+    jm_debug_printf(2, "Overflow file: %sB; %lu pages read and %lu pages written\n",
+                    jm_format_power_of_2((uint64_t)tier_bytes, 1), tier_reads, tier_writes);
+#endif
+  (void) close(tier_fd);
+  tier_fd = -1;
+}
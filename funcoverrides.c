@@ -72,6 +72,7 @@ static size_t (*original_fwrite_unlocked)(const void *ptr, size_t size, size_t n
 /* Export the original sigaction() and the original mmap(). */
 int (*jm_original_sigaction)(int, const struct sigaction *, struct sigaction *) = NULL;
 void *(*jm_original_mmap)(void *start, size_t length, int prot, int flags, int fd, off_t offset);
+int (*jm_original_pthread_create)(void *, void *, void *, void *) = NULL;
 
 /* Import a few structures that are defined elsewhere. */
 extern struct sigaction jm_prev_segfaulter;  /* Previous SIGSEGV handler information */
@@ -496,11 +497,11 @@ open (const char *pathname, int flags, ...)
   while (fgets(oneline, LINE_MAX+1, real_meminfo)) {
     if (sscanf(oneline, "MemTotal: %" PRIu64 " kB", &memtotal) == 1)
       fprintf(fake_meminfo, "MemTotal:     %8" PRIu64" kB\n",
-              jm_globals.extent/1024);
+              jm_globals.max_extent/1024);
     else
       if (sscanf(oneline, "MemFree: %" PRIu64 " kB", &memfree) == 1)
         fprintf(fake_meminfo, "MemFree:      %8" PRIu64 " kB\n",
-                (jm_globals.extent - (memtotal-memfree))/1024);
+                (jm_globals.max_extent - (memtotal-memfree))/1024);
       else
         fprintf(fake_meminfo, "%s", oneline);
   }
@@ -678,6 +679,7 @@ jm_initialize_overrides (void)
   original_sigwaitinfo = lookup_function("sigwaitinfo");
   original_ioctl = lookup_function("ioctl");
   jm_original_sigaction = original_sigaction;
+  jm_original_pthread_create = original_pthread_create;
   original_mmap = lookup_function("mmap");
   jm_original_mmap = original_mmap;
   original_open = lookup_function("open");
@@ -165,16 +165,16 @@ reduce_master_memory (void)
   if (jm_globals.extra_memcpy) {
     char *comm_buffer = (char *) jm_malloc(jm_globals.pagesize);
     for (i=0; i<cached_bytes; i+=jm_globals.pagesize)
-      jm_fetch_end(jm_fetch_begin(&jm_globals.memregion[i], comm_buffer));
+      jm_fetch_end(jm_fetch_begin(&jm_globals.memregion[i], comm_buffer, jm_globals.pagesize));
     for (i=0; i<cached_bytes; i+=jm_globals.pagesize)
-      jm_evict_end(jm_evict_begin(&jm_globals.memregion[i], comm_buffer));
+      jm_evict_end(jm_evict_begin(&jm_globals.memregion[i], comm_buffer, jm_globals.pagesize));
     jm_free(comm_buffer);
   }
   else {
     for (i=0; i<cached_bytes; i+=jm_globals.pagesize)
-      jm_fetch_end(jm_fetch_begin(&jm_globals.memregion[i], &jm_globals.memregion[i]));
+      jm_fetch_end(jm_fetch_begin(&jm_globals.memregion[i], &jm_globals.memregion[i], jm_globals.pagesize));
     for (i=0; i<cached_bytes; i+=jm_globals.pagesize)
-      jm_evict_end(jm_evict_begin(&jm_globals.memregion[i], &jm_globals.memregion[i]));
+      jm_evict_end(jm_evict_begin(&jm_globals.memregion[i], &jm_globals.memregion[i], jm_globals.pagesize));
   }
 
   /* Touch every OS page again to determine how many pages actually fit
@@ -224,12 +224,36 @@ additional_diagnostics (void)
     jm_debug_printf(2, "Global memory size: %lu bytes (%sB)\n",
                     jm_globals.extent,
                     jm_format_power_of_2((uint64_t)jm_globals.extent, 1));
-    jm_debug_printf(2, "Prefetching is %s.\n",
-                    jm_globals.prefetch_type==PREFETCH_NONE ? "disabled" : "enabled");
+    if (jm_globals.prefetch_auto)
+      jm_debug_printf(2, "Prefetching is self-tuning (at most %u pages ahead).\n",
+                      jm_globals.prefetch_max_depth);
+    else if (jm_globals.prefetch_type == PREFETCH_NONE)
+      jm_debug_printf(2, "Prefetching is disabled.\n");
+    else
+      jm_debug_printf(2, "Prefetching is enabled (%u %s ahead).\n",
+                      jm_globals.prefetch_depth,
+                      jm_globals.prefetch_depth==1 ? "page" : "pages");
     jm_debug_printf(2, "Asynchronous eviction is %s.\n",
                     jm_globals.async_evict ? "enabled" : "disabled");
     jm_debug_printf(2, "Copy in/copy out is %s.\n",
                     jm_globals.extra_memcpy ? "enabled" : "disabled");
+    if (jm_globals.park_window)
+      jm_debug_printf(2, "Threads stay parked during faults less than %lu microseconds apart.\n",
+                      jm_globals.park_window);
+    else
+      jm_debug_printf(2, "Threads are never parked across page faults.\n");
+    jm_debug_printf(2, "A fault maps up to %lu never-populated %s.\n",
+                    jm_globals.fault_around, jm_globals.fault_around==1 ? "page" : "pages");
+    if (jm_globals.write_stream)
+      jm_debug_printf(2, "Pages behind %lu consecutive sequential write faults are written back right away.\n",
+                      jm_globals.write_stream);
+    else
+      jm_debug_printf(2, "Write-behind is limited to ranges the program says it will overwrite.\n");
+    if (jm_globals.hedge_percentile)
+      jm_debug_printf(2, "Fetches slower than the %uth percentile are also sent to a replica.\n",
+                      jm_globals.hedge_percentile);
+    else
+      jm_debug_printf(2, "Fetches are never hedged.\n");
     jm_debug_printf(2, "JumboMem page size: %ld bytes; OS page size: %d bytes\n",
                     jm_globals.pagesize, jm_globals.ospagesize);
     jm_debug_printf(2, "Using %u slaves.\n", jm_globals.numslaves);
@@ -326,9 +350,28 @@ locate_global_address_space (void)
 	       jm_globals.pagesize, startaddr, jm_strerror(errno));
   }
 
-  /* Store and report information about our address range. */
+  /* Store and report information about our address range.  Aligning
+   * memregion to a JumboMem page boundary also aligns it to a huge-page
+   * boundary when huge pages are in use because every JumboMem page
+   * consists of whole huge pages. */
   if ((uintptr_t)jm_globals.memregion % jm_globals.pagesize != 0)
     jm_globals.memregion += jm_globals.pagesize - ((uintptr_t)jm_globals.memregion % jm_globals.pagesize);
+
+  /* Reserve the addresses into which the global address space may
+   * later grow so that nothing else gets mapped there in the meantime. */
+  if (jm_globals.max_extent > jm_globals.slave_extent) {
+    char *growaddr = jm_globals.memregion + jm_globals.slave_extent;
+    size_t growbytes = jm_globals.max_extent - jm_globals.slave_extent;
+    void *reserved;
+
+    reserved = mmap(growaddr, growbytes, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (reserved != (void *)growaddr) {
+      if (reserved != MAP_FAILED)
+        (void) munmap(reserved, growbytes);
+      jm_abort("Failed to reserve %lu bytes of address space at address %p for growth",
+               growbytes, growaddr);
+    }
+  }
   jm_globals.endaddress = jm_globals.memregion;
   jm_debug_printf(3, "Global address space = [%p, %p].\n",
                   jm_globals.memregion, jm_globals.memregion+jm_globals.extent);
@@ -336,13 +379,52 @@ locate_global_address_space (void)
 
 /* ---------------------------------------------------------------------- */
 
+/* Map a JM_PREFETCH string to a prefetching technique and an
+ * indication of whether that technique is self-tuning.  Return 1 on
+ * success or 0 if the string is not recognized. */
+int
+jm_parse_prefetch_type (const char *prefetch_string, JUMBOMEM_PREFETCH *prefetch_type, int *prefetch_auto)
+{
+  typedef struct {
+    JUMBOMEM_PREFETCH  prefetch_type;    /* Symbolic prefetch type */
+    const char        *prefetch_string;  /* Textual prefetch type */
+  } PREFETCH_ARG;
+  PREFETCH_ARG prefetches[] = {
+    {PREFETCH_NONE,   "none"},
+    {PREFETCH_NEXT,   "next"},
+    {PREFETCH_DELTA,  "delta"},
+    {PREFETCH_STREAM, "stream"}};
+  int i;
+
+  if (!strcmp(prefetch_string, "auto")) {
+    /* Start out streaming and let the fault handler pick the
+     * technique and depth that best match the observed faults. */
+    *prefetch_type = PREFETCH_STREAM;
+    *prefetch_auto = 1;
+    return 1;
+  }
+  for (i=sizeof(prefetches)/sizeof(PREFETCH_ARG)-1; i>=0; i--)
+    if (!strcmp(prefetch_string, prefetches[i].prefetch_string)) {
+      *prefetch_type = prefetches[i].prefetch_type;
+      *prefetch_auto = 0;
+      return 1;
+    }
+  return 0;
+}
+
+
 /* Initialize all of JumboMem. */
 void CONSTRUCT_ATTR
 jm_initialize_all (void)
 {
   char *prefetch_string;           /* String describing the prefetch type */
+  char *hugepages_string;          /* String describing the type of huge pages to use */
+  char *numa_string;               /* String describing the NUMA placement policy */
   size_t slavebytes;               /* Rounded per-slave memory size */
   size_t masterbytes;              /* Maximum number of bytes we can cache locally */
+  ssize_t park_window;             /* Value of JM_PARKTIME */
+  ssize_t write_stream;            /* Value of JM_WRITESTREAM */
+  ssize_t hedge_percentile;        /* Value of JM_HEDGE */
   static int already_called = 0;   /* 0=first invocation; 1=further invocation */
 
   /* Do nothing if we were already initialized by one of the functions
@@ -385,34 +467,90 @@ jm_initialize_all (void)
     jm_globals.pagesize = jm_globals.ospagesize;
   }
 
+  /* Determine if we should back the local cache with huge pages.
+   * This requires that each JumboMem page consist of whole huge
+   * pages. */
+  hugepages_string = getenv("JM_HUGEPAGES");
+  if (!hugepages_string || !strcmp(hugepages_string, "none"))
+    jm_globals.hugepages = HUGEPAGES_NONE;
+  else if (!strcmp(hugepages_string, "thp"))
+    jm_globals.hugepages = HUGEPAGES_THP;
+  else if (!strcmp(hugepages_string, "hugetlb"))
+    jm_globals.hugepages = HUGEPAGES_HUGETLB;
+  else
+    jm_abort("JM_HUGEPAGES must be one of \"none\", \"thp\", or \"hugetlb\" (was \"%s\")",
+             hugepages_string);
+  if (jm_globals.hugepages != HUGEPAGES_NONE) {
+    if (!(jm_globals.hugepagesize=jm_getenv_positive_int("JM_HUGEPAGESIZE")))
+      jm_globals.hugepagesize = jm_get_huge_page_size();
+    if (!jm_globals.hugepagesize) {
+      jm_debug_printf(1, "WARNING: Unable to determine the huge-page size; using ordinary pages.\n");
+      jm_globals.hugepages = HUGEPAGES_NONE;
+    }
+    else if (jm_globals.pagesize % jm_globals.hugepagesize != 0) {
+      jm_debug_printf(1, "WARNING: JM_PAGESIZE (%lu) is not a multiple of the huge-page size (%lu); using ordinary pages.\n",
+                      jm_globals.pagesize, jm_globals.hugepagesize);
+      jm_globals.hugepages = HUGEPAGES_NONE;
+    }
+    else
+      jm_debug_printf(3, "Backing the local cache with %sB %s pages.\n",
+                      jm_format_power_of_2((uint64_t)jm_globals.hugepagesize, 0),
+                      jm_globals.hugepages == HUGEPAGES_THP ? "transparent huge" : "hugetlb");
+  }
+
+  /* Determine how to place the local cache on NUMA nodes.  By default,
+   * we interleave pages across all nodes. */
+  jm_globals.numa_nodes = jm_get_numa_node_count();
+  numa_string = getenv("JM_NUMA");
+  if (!numa_string || !strcmp(numa_string, "interleave"))
+    jm_globals.numa_policy = NUMA_INTERLEAVE;
+  else if (!strcmp(numa_string, "local"))
+    jm_globals.numa_policy = NUMA_LOCAL;
+  else if (!strcmp(numa_string, "none"))
+    jm_globals.numa_policy = NUMA_NONE;
+  else
+    jm_abort("JM_NUMA must be one of \"interleave\", \"local\", or \"none\" (was \"%s\")",
+             numa_string);
+  if (jm_globals.numa_nodes > 1 && jm_globals.numa_policy != NUMA_NONE)
+    jm_debug_printf(3, "Placing the local cache %s %d NUMA nodes.\n",
+                    jm_globals.numa_policy == NUMA_INTERLEAVE ? "round-robin across" : "on the faulting thread's node out of",
+                    jm_globals.numa_nodes);
+
   /* Determine if we should prefetch new pages, asynchronously evict
    * old pages, and/or copy data in and out of message buffers. */
   prefetch_string = getenv("JM_PREFETCH");
   if (!prefetch_string)
     jm_globals.prefetch_type = PREFETCH_NONE;
-  else {
-    typedef struct {
-      JUMBOMEM_PREFETCH  prefetch_type;    /* Symbolic prefetch type */
-      const char        *prefetch_string;  /* Textual prefetch type */
-    } PREFETCH_ARG;
-    PREFETCH_ARG prefetches[] = {
-      {PREFETCH_NONE,  "none"},
-      {PREFETCH_NEXT,  "next"},
-      {PREFETCH_DELTA, "delta"}};
-    int i;
-
-    for (i=sizeof(prefetches)/sizeof(PREFETCH_ARG)-1; i>=0; i--)
-      if (!strcmp(prefetch_string, prefetches[i].prefetch_string)) {
-        jm_globals.prefetch_type = prefetches[i].prefetch_type;
-        break;
-      }
-    if (i < 0)
-      jm_abort("Unrecognized value \"%s\" for JM_PREFETCH", prefetch_string);
-  }
+  else if (!jm_parse_prefetch_type(prefetch_string,
+                                    &jm_globals.prefetch_type,
+                                    &jm_globals.prefetch_auto))
+    jm_abort("Unrecognized value \"%s\" for JM_PREFETCH", prefetch_string);
+  if (!(jm_globals.prefetch_max_depth=jm_getenv_positive_int("JM_PREFETCH_DEPTH")))
+    jm_globals.prefetch_max_depth = jm_globals.prefetch_auto ? JM_MAX_PREFETCH_DEPTH : 1;
+  if (jm_globals.prefetch_max_depth > JM_MAX_PREFETCH_DEPTH)
+    jm_abort("JM_PREFETCH_DEPTH must be no greater than %d", JM_MAX_PREFETCH_DEPTH);
+  if (jm_globals.prefetch_type == PREFETCH_NONE)
+    jm_globals.prefetch_depth = 0;
+  else
+    jm_globals.prefetch_depth = jm_globals.prefetch_auto ? 1 : jm_globals.prefetch_max_depth;
   if ((jm_globals.async_evict=jm_getenv_boolean("JM_ASYNCEVICT")) == -1)
     jm_globals.async_evict = 0;
   if ((jm_globals.extra_memcpy=jm_getenv_boolean("JM_MEMCPY")) == -1)
     jm_globals.extra_memcpy = 0;
+  if ((park_window=jm_getenv_nonnegative_int("JM_PARKTIME")) == -1)
+    park_window = 0;
+  jm_globals.park_window = (unsigned long) park_window;
+  if (!(jm_globals.fault_around=jm_getenv_positive_int("JM_FAULTAROUND")))
+    jm_globals.fault_around = JM_DEFAULT_FAULT_AROUND;
+  if ((write_stream=jm_getenv_nonnegative_int("JM_WRITESTREAM")) == -1)
+    write_stream = JM_DEFAULT_WRITE_STREAM;
+  jm_globals.write_stream = (unsigned long) write_stream;
+  if ((hedge_percentile=jm_getenv_nonnegative_int("JM_HEDGE")) == -1)
+    hedge_percentile = 0;
+  if (hedge_percentile > 99)
+    jm_abort("JM_HEDGE must be a percentile from 1 to 99 (or 0 to disable hedging)");
+  jm_globals.hedge_percentile = (unsigned int) hedge_percentile;
+  jm_initialize_page_copy();
 
   /* Spawn a bunch of slaves. */
   grab_memory();
@@ -425,6 +563,8 @@ jm_initialize_all (void)
   if (jm_globals.numslaves < 1) {
     jm_debug_printf(1, "JumboMem requires at least one slave; allocating all memory locally.\n");
     jm_globals.extent = slavebytes;
+    jm_globals.slave_extent = jm_globals.extent;
+    jm_globals.max_extent = jm_globals.extent;
     locate_global_address_space();
     jm_assign_backing_store(jm_globals.memregion, jm_globals.extent, PROT_READ|PROT_WRITE);
     jm_debug_printf(2, "Locally allocated %lu bytes (%sB) of memory.\n",
@@ -447,6 +587,35 @@ jm_initialize_all (void)
   jm_debug_printf(3, "%lu bytes/slave * %u slaves = %lu total bytes (%sB).\n",
                   jm_globals.slavebytes, jm_globals.numslaves, jm_globals.extent,
                   jm_format_power_of_2((uint64_t)jm_globals.extent, 1));
+  jm_globals.slave_extent = jm_globals.extent;
+
+  /* Determine how far the global address space is allowed to grow.
+   * Memory beyond the slaves' capacity is stored in a file. */
+  jm_globals.max_extent = jm_getenv_positive_int("JM_MAXMEM");
+  jm_globals.max_extent = ((jm_globals.max_extent + jm_globals.pagesize - 1) / jm_globals.pagesize) * jm_globals.pagesize;
+  if (jm_globals.max_extent < jm_globals.extent)
+    jm_globals.max_extent = jm_globals.extent;
+  else if (jm_globals.max_extent > jm_globals.extent)
+    jm_debug_printf(3, "The global address space may grow to %lu bytes (%sB).\n",
+                    jm_globals.max_extent,
+                    jm_format_power_of_2((uint64_t)jm_globals.max_extent, 1));
+
+  /* Precompute the divisors that map addresses to pages and slaves. */
+  jm_initialize_divisor(&jm_globals.pagediv, jm_globals.pagesize, jm_globals.max_extent);
+#ifdef JM_DIST_BLOCK
+  jm_initialize_divisor(&jm_globals.slavediv, jm_globals.slavebytes, jm_globals.slave_extent);
+#else
+  jm_initialize_divisor(&jm_globals.slavediv, jm_globals.numslaves,
+                        jm_globals.slave_extent/jm_globals.pagesize);
+#endif
+  jm_debug_printf(3, "Dividing by the page size with a %s and by the slave %s with a %s.\n",
+                  jm_globals.pagediv.shift >= 0 ? "shift" : jm_globals.pagediv.reciprocal ? "reciprocal" : "division",
+#ifdef JM_DIST_BLOCK
+                  "memory size",
+#else
+                  "count",
+#endif
+                  jm_globals.slavediv.shift >= 0 ? "shift" : jm_globals.slavediv.reciprocal ? "reciprocal" : "division");
   locate_global_address_space();
 
   /* Start running the page-replacement algorithm. */
@@ -458,6 +627,12 @@ jm_initialize_all (void)
     reduce_master_memory();
   local_pages = jm_globals.local_pages;   /* The page-replacement code might alter the number of locally cached pages. */
   jm_initialize_pagereplace();
+  jm_globals.local_page_target = jm_globals.local_pages;
+
+  /* Set aside slave memory for replicas of read-mostly pages.  This
+   * requires knowing whether the page-replacement algorithm can tell
+   * clean pages from dirty ones. */
+  jm_initialize_replicas();
 
   /* Output some additional diagnostics. */
 #ifdef JM_DEBUG
@@ -468,6 +643,9 @@ jm_initialize_all (void)
    * managed memory region. */
   jm_initialize_signal_handler();
 
+  /* Let an operator retune the running program. */
+  jm_initialize_control_socket();
+
   /* Begin using the global address space. */
 #ifdef JM_DEBUG
   if (jm_globals.debuglevel >= 2)
@@ -507,8 +685,13 @@ jm_finalize_all (void)
 #endif
 
     /* Tell all of our modules to shut down cleanly. */
+    jm_finalize_control_socket();
     jm_finalize_signal_handler();
+    jm_finalize_replicas();
+    jm_finalize_regions();
+    jm_finalize_quotas();
     jm_finalize_pagereplace();
+    jm_finalize_file_tier();
     jm_finalize_memory();
     jm_finalize_slaves();       /* Does not necessarily return. */
 
@@ -0,0 +1,473 @@
+/* ----------------------------------------------------------------------
+ * Standalone JumboMem memory server: allocate and lock memory once and
+ * lease it to masters from any number of independent JumboMem jobs
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "jmserver.h"
+
+/* Define the maximum number of simultaneous leases. */
+#ifndef MAX_LEASES
+# define MAX_LEASES 1024
+#endif
+
+/* Define the largest page size a master may request. */
+#define MAX_PAGE_SIZE (1UL<<30)
+
+/* Define one master's lease of a contiguous range of our memory. */
+typedef struct {
+  int    in_use;           /* 1=lease is active; 0=slot is available */
+  size_t offset;           /* Offset of the lease into our memory pool */
+  size_t bytes;            /* Number of bytes leased */
+} LEASE;
+
+static char *progname;                /* Name of this program */
+static char *pool;                    /* Memory we lease to masters */
+static size_t pool_bytes;             /* Number of bytes in the above */
+static size_t quota = 0;              /* Maximum bytes per lease (0=unlimited) */
+static int verbose = 0;               /* 1=report leases; 0=run quietly */
+static LEASE leases[MAX_LEASES];      /* All leases, active or not */
+static pthread_mutex_t lease_lock = PTHREAD_MUTEX_INITIALIZER;   /* Protect leases[] */
+
+
+/* Parse a number of bytes with an optional k/m/g/t suffix or, if
+ * total is nonzero, a percentage of total.  Abort on error. */
+static size_t
+parse_bytes (const char *optname, const char *str, size_t total)
+{
+  char *endptr;            /* First character past the number */
+  double value;            /* Number as parsed */
+
+  value = strtod(str, &endptr);
+  if (endptr == str || value < 0.0)
+    goto bad_value;
+  switch (tolower(*endptr)) {
+    case '\0':
+      break;
+    case '%':
+      if (!total)
+        goto bad_value;
+      value = total*value/100.0;
+      endptr++;
+      break;
+    case 't':
+      value *= 1024.0;
+    case 'g':
+      value *= 1024.0;
+    case 'm':
+      value *= 1024.0;
+    case 'k':
+      value *= 1024.0;
+      endptr++;
+      break;
+    default:
+      goto bad_value;
+  }
+  if (*endptr == '\0')
+    return (size_t) value;
+
+ bad_value:
+  fprintf(stderr, "%s: Invalid value \"%s\" for %s\n", progname, str, optname);
+  exit(1);
+}
+
+
+/* Read exactly numbytes bytes from a socket.  Return 1 on success or
+ * 0 if the peer disconnected or an error occurred. */
+static int
+read_fully (int sockfd, void *buffer, size_t numbytes)
+{
+  char *bufptr = (char *) buffer;
+
+  while (numbytes > 0) {
+    ssize_t numread = read(sockfd, bufptr, numbytes);
+
+    if (numread == -1 && errno == EINTR)
+      continue;
+    if (numread <= 0)
+      return 0;
+    bufptr += numread;
+    numbytes -= numread;
+  }
+  return 1;
+}
+
+
+/* Write exactly numbytes bytes to a socket.  Return 1 on success or
+ * 0 on error. */
+static int
+write_fully (int sockfd, const void *buffer, size_t numbytes)
+{
+  const char *bufptr = (const char *) buffer;
+
+  while (numbytes > 0) {
+    ssize_t numwritten = write(sockfd, bufptr, numbytes);
+
+    if (numwritten == -1 && errno == EINTR)
+      continue;
+    if (numwritten <= 0)
+      return 0;
+    bufptr += numwritten;
+    numbytes -= numwritten;
+  }
+  return 1;
+}
+
+
+/* Return the number of free bytes following a given pool offset
+ * (i.e., up to the next active lease).  lease_lock must be held. */
+static size_t
+free_bytes_at (size_t offset)
+{
+  size_t limit = pool_bytes;   /* End of the free region */
+  int i;
+
+  for (i=0; i<MAX_LEASES; i++)
+    if (leases[i].in_use && leases[i].offset >= offset && leases[i].offset < limit)
+      limit = leases[i].offset;
+  return limit - offset;
+}
+
+
+/* Return the total number of unleased bytes.  lease_lock must be held. */
+static size_t
+total_free_bytes (void)
+{
+  size_t leased = 0;       /* Total bytes leased */
+  int i;
+
+  for (i=0; i<MAX_LEASES; i++)
+    if (leases[i].in_use)
+      leased += leases[i].bytes;
+  return pool_bytes - leased;
+}
+
+
+/* Lease up to a given number of bytes (0=as many as allowed), rounded
+ * down to a multiple of the page size.  Return the lease or NULL if no
+ * memory is available. */
+static LEASE *
+acquire_lease (size_t request, size_t pagesize)
+{
+  LEASE *lease = NULL;     /* Lease to return */
+  size_t best_offset = 0;  /* Offset of the largest free region */
+  size_t best_bytes = 0;   /* Size of the largest free region */
+  int i;
+
+  /* Find an unused lease slot. */
+  if (request == 0 || (quota && request > quota))
+    request = quota ? quota : pool_bytes;
+  pthread_mutex_lock(&lease_lock);
+  for (i=0; i<MAX_LEASES; i++)
+    if (!leases[i].in_use) {
+      lease = &leases[i];
+      break;
+    }
+  if (!lease) {
+    pthread_mutex_unlock(&lease_lock);
+    return NULL;
+  }
+
+  /* Find the first free region of the pool that's large enough or,
+   * failing that, the largest free region.  Free regions begin either
+   * at offset 0 or at the end of an active lease. */
+  for (i=-1; i<MAX_LEASES && best_bytes<request; i++) {
+    size_t offset;         /* Start of a candidate free region */
+    size_t bytes;          /* Size of the candidate free region */
+
+    if (i >= 0) {
+      if (!leases[i].in_use)
+        continue;
+      offset = leases[i].offset + leases[i].bytes;
+    }
+    else
+      offset = 0;
+    offset = ((offset + pagesize - 1) / pagesize) * pagesize;
+    if (offset >= pool_bytes)
+      continue;
+    bytes = free_bytes_at(offset);
+    if (bytes > best_bytes) {
+      best_offset = offset;
+      best_bytes = bytes;
+    }
+  }
+
+  /* Lease the memory and clear it so one job can't see another
+   * job's data. */
+  if (request > best_bytes)
+    request = best_bytes;
+  request = (request / pagesize) * pagesize;
+  if (request == 0) {
+    pthread_mutex_unlock(&lease_lock);
+    return NULL;
+  }
+  lease->in_use = 1;
+  lease->offset = best_offset;
+  lease->bytes = request;
+  pthread_mutex_unlock(&lease_lock);
+  memset(pool + lease->offset, 0, lease->bytes);
+  return lease;
+}
+
+
+/* Return a lease's memory to the pool. */
+static void
+release_lease (LEASE *lease)
+{
+  pthread_mutex_lock(&lease_lock);
+  lease->in_use = 0;
+  pthread_mutex_unlock(&lease_lock);
+}
+
+
+/* Serve a single master until it disconnects. */
+static void *
+serve_master (void *arg)
+{
+  int sockfd = (int) (intptr_t) arg;   /* Socket connected to the master */
+  LEASE *lease = NULL;     /* Memory leased to the master */
+  size_t pagesize = 0;     /* Master's page size */
+  JMS_HEADER header;       /* Command header */
+
+  while (read_fully(sockfd, &header, sizeof(JMS_HEADER))) {
+    uint64_t arg1 = jms_ntoh64(header.arg1);   /* First argument in host byte order */
+    uint64_t arg2 = jms_ntoh64(header.arg2);   /* Second argument in host byte order */
+
+    switch (ntohl(header.command)) {
+      case JMS_HELLO:
+        /* Lease memory to the master. */
+        if (lease || arg1 == 0 || arg1 > MAX_PAGE_SIZE)
+          goto disconnect;
+        pagesize = (size_t) arg1;
+        lease = acquire_lease((size_t)arg2, pagesize);
+        if (verbose)
+          fprintf(stderr, "%s: Leased %lu bytes at offset %lu to connection %d\n",
+                  progname, lease ? lease->bytes : 0UL, lease ? lease->offset : 0UL, sockfd);
+        pthread_mutex_lock(&lease_lock);
+        header.arg1 = jms_hton64(lease ? lease->bytes : 0);
+        header.arg2 = jms_hton64(total_free_bytes());
+        pthread_mutex_unlock(&lease_lock);
+        if (!write_fully(sockfd, &header, sizeof(JMS_HEADER)) || !lease)
+          goto disconnect;
+        break;
+
+      case JMS_TRIM:
+        /* Shrink the master's lease. */
+        if (!lease)
+          goto disconnect;
+        pthread_mutex_lock(&lease_lock);
+        if (arg1 < lease->bytes)
+          lease->bytes = (arg1 / pagesize) * pagesize;
+        header.arg1 = jms_hton64(lease->bytes);
+        header.arg2 = jms_hton64(total_free_bytes());
+        pthread_mutex_unlock(&lease_lock);
+        if (!write_fully(sockfd, &header, sizeof(JMS_HEADER)))
+          goto disconnect;
+        break;
+
+      case JMS_PUT:
+        /* Store all or part of a page. */
+        if (arg2 == 0)
+          arg2 = pagesize;
+        if (!lease || arg1 >= lease->bytes || arg1 % pagesize + arg2 > pagesize)
+          goto disconnect;
+        if (!read_fully(sockfd, pool + lease->offset + arg1, (size_t)arg2))
+          goto disconnect;
+        break;
+
+      case JMS_GET:
+        /* Return all or part of a page. */
+        if (arg2 == 0)
+          arg2 = pagesize;
+        if (!lease || arg1 >= lease->bytes || arg1 % pagesize + arg2 > pagesize)
+          goto disconnect;
+        if (!write_fully(sockfd, pool + lease->offset + arg1, (size_t)arg2))
+          goto disconnect;
+        break;
+
+      case JMS_BYE:
+      default:
+        goto disconnect;
+    }
+  }
+
+ disconnect:
+  if (lease) {
+    if (verbose)
+      fprintf(stderr, "%s: Releasing %lu bytes at offset %lu from connection %d\n",
+              progname, lease->bytes, lease->offset, sockfd);
+    release_lease(lease);
+  }
+  close(sockfd);
+  return NULL;
+}
+
+
+/* Create a socket that listens on either a TCP port or a Unix-domain
+ * socket. */
+static int
+create_listener (int port, const char *sockname)
+{
+  int sockfd;              /* Listening socket */
+
+  if (sockname) {
+    struct sockaddr_un addr;   /* Unix-domain address */
+
+    if (strlen(sockname) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "%s: Socket name %s is too long\n", progname, sockname);
+      exit(1);
+    }
+    if ((sockfd=socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+      perror("socket");
+      exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sockname);
+    (void) unlink(sockname);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+      perror(sockname);
+      exit(1);
+    }
+  }
+  else {
+    struct sockaddr_in addr;   /* TCP address */
+    int one = 1;               /* Value to pass to setsockopt() */
+
+    if ((sockfd=socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+      perror("socket");
+      exit(1);
+    }
+    (void) setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+      perror("bind");
+      exit(1);
+    }
+  }
+  if (listen(sockfd, 64) == -1) {
+    perror("listen");
+    exit(1);
+  }
+  return sockfd;
+}
+
+
+int main (int argc, char *argv[])
+{
+  size_t physmem;          /* Bytes of physical memory on this node */
+  int port = JMS_DEFAULT_PORT;   /* TCP port on which to listen */
+  char *sockname = NULL;   /* Unix-domain socket on which to listen */
+  int listenfd;            /* Listening socket */
+  int i;
+
+  /* Parse the command line. */
+  progname = argv[0];
+  physmem = (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGESIZE);
+  pool_bytes = (physmem / 10) * 9;
+  for (i=1; i<argc; i++) {
+    char *arg = argv[i];
+
+    if (!strncmp(arg, "--memory=", 9))
+      pool_bytes = parse_bytes("--memory", arg+9, physmem);
+    else if (!strncmp(arg, "--quota=", 8))
+      quota = parse_bytes("--quota", arg+8, 0);
+    else if (!strncmp(arg, "--port=", 7))
+      port = atoi(arg+7);
+    else if (!strncmp(arg, "--socket=", 9))
+      sockname = arg+9;
+    else if (!strcmp(arg, "--verbose"))
+      verbose = 1;
+    else {
+      fprintf(stderr, "Usage: %s [--memory=<bytes>|<percent>%%] [--quota=<bytes>] [--port=<number>] [--socket=<filename>] [--verbose]\n",
+              progname);
+      exit(!strcmp(arg, "--help") ? 0 : 1);
+    }
+  }
+
+  /* Allocate, populate, and lock our memory pool once and for all. */
+  pool_bytes = (pool_bytes / sysconf(_SC_PAGESIZE)) * sysconf(_SC_PAGESIZE);
+  pool = mmap(NULL, pool_bytes, PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+  if (pool == MAP_FAILED) {
+    fprintf(stderr, "%s: Failed to allocate %lu bytes of memory (%s)\n",
+            progname, pool_bytes, strerror(errno));
+    exit(1);
+  }
+  if (mlock(pool, pool_bytes) == -1 && verbose)
+    fprintf(stderr, "%s: Failed to lock %lu bytes of memory into RAM (%s)\n",
+            progname, pool_bytes, strerror(errno));
+
+  /* Serve each master in a separate thread. */
+  signal(SIGPIPE, SIG_IGN);
+  listenfd = create_listener(port, sockname);
+  if (verbose) {
+    if (sockname)
+      fprintf(stderr, "%s: Serving %lu bytes of memory on %s\n", progname, pool_bytes, sockname);
+    else
+      fprintf(stderr, "%s: Serving %lu bytes of memory on port %d\n", progname, pool_bytes, port);
+  }
+  while (1) {
+    int clientfd;          /* Socket connected to a master */
+    pthread_t thread;      /* Thread that serves the master */
+    int one = 1;           /* Value to pass to setsockopt() */
+
+    if ((clientfd=accept(listenfd, NULL, NULL)) == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      perror("accept");
+      exit(1);
+    }
+    if (!sockname)
+      (void) setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (pthread_create(&thread, NULL, serve_master, (void *)(intptr_t)clientfd) != 0) {
+      close(clientfd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*----------------------------------------------------------------
+ * JumboMem memory server: Protocol spoken between a master and a
+ * standalone memory-server daemon (jmserver)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *----------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+#ifndef _JMSERVER_H_
+#define _JMSERVER_H_
+
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+/* Define the default TCP port on which jmserver listens. */
+#define JMS_DEFAULT_PORT 7077
+
+/* Define the commands a master can send to a jmserver daemon.  Every
+ * command begins with a JMS_HEADER.  A JMS_PUT header is followed by
+ * the data to store.  The server replies to JMS_HELLO and JMS_TRIM
+ * with a JMS_HEADER and to JMS_GET with the requested data; it
+ * replies to nothing else.  Replies arrive in the order the commands
+ * were sent.  A JMS_PUT or JMS_GET transfers arg2 bytes (0=a full
+ * page), which must not cross a page boundary. */
+typedef enum {
+  JMS_HELLO = 0x4a4d0001,  /* Lease arg2 bytes (0=as many as allowed) with page size arg1 */
+  JMS_TRIM,                /* Shrink our lease to arg1 bytes */
+  JMS_PUT,                 /* Store arg2 bytes at lease offset arg1 */
+  JMS_GET,                 /* Return arg2 bytes at lease offset arg1 */
+  JMS_BYE                  /* Release our lease and disconnect */
+} JMS_COMMAND;
+
+/* Define the header that starts every command and every non-page
+ * reply.  All fields are in network byte order.  In a reply, command
+ * echoes the request, arg1 is the number of bytes leased, and arg2 is
+ * the number of bytes the server has left to lease. */
+typedef struct {
+  uint32_t command;        /* One of JMS_COMMAND */
+  uint32_t unused;         /* Padding; should be zero */
+  uint64_t arg1;           /* First argument */
+  uint64_t arg2;           /* Second argument */
+} JMS_HEADER;
+
+/* Convert a 64-bit integer between host and network byte order. */
+static inline uint64_t
+jms_hton64 (uint64_t value)
+{
+  if (htonl(1) == 1)
+    return value;
+  return ((uint64_t)htonl((uint32_t)(value & 0xffffffff)) << 32) | htonl((uint32_t)(value >> 32));
+}
+
+#define jms_ntoh64(VALUE) jms_hton64(VALUE)
+
+#endif
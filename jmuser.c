@@ -56,6 +56,33 @@ static void (*jm_enter_critical_section)(void) = NULL;
 /* Allow other threads to enter a critical section. */
 static void (*jm_exit_critical_section)(void) = NULL;
 
+/* Return the communicator that spans all of the masters. */
+static int (*jm_get_master_comm)(void *) = NULL;
+
+/* Start prefetching a range of addresses. */
+static void (*jm_prefetch_hint)(const char *, size_t) = NULL;
+
+/* Fault a range of addresses into the local cache. */
+static void (*jm_touch_memory_region)(const char *, size_t) = NULL;
+
+/* Declare that a range of addresses will be overwritten. */
+static void (*jm_write_only_hint)(const char *, size_t) = NULL;
+
+/* Bound the caching of a range of memory. */
+static int (*jm_set_cache_quota)(const char *, size_t, size_t, size_t) = NULL;
+
+/* Create a separately managed region. */
+static void *(*jm_region_create)(size_t, size_t, int) = NULL;
+
+/* Destroy a region. */
+static int (*jm_region_destroy)(void *) = NULL;
+
+/* Map part of a file into a region. */
+static void *(*jm_map_file)(const char *, off_t, size_t, int) = NULL;
+
+/* Write a file-backed region's modified pages to its file. */
+static int (*jm_region_sync)(void *) = NULL;
+
 
 /* Initialize the interface to JumboMem's internals.  On failure,
  * selfhandle will still be NULL. */
@@ -66,6 +93,15 @@ initialize_jmu (void)
     return;
   jm_enter_critical_section = dlsym(selfhandle, "jm_enter_critical_section");
   jm_exit_critical_section  = dlsym(selfhandle, "jm_exit_critical_section");
+  jm_get_master_comm        = dlsym(selfhandle, "jm_get_master_comm");
+  jm_prefetch_hint          = dlsym(selfhandle, "jm_prefetch_hint");
+  jm_touch_memory_region    = dlsym(selfhandle, "jm_touch_memory_region");
+  jm_write_only_hint        = dlsym(selfhandle, "jm_write_only_hint");
+  jm_set_cache_quota        = dlsym(selfhandle, "jm_set_cache_quota");
+  jm_region_create          = dlsym(selfhandle, "jm_region_create");
+  jm_region_destroy         = dlsym(selfhandle, "jm_region_destroy");
+  jm_map_file               = dlsym(selfhandle, "jm_map_file");
+  jm_region_sync            = dlsym(selfhandle, "jm_region_sync");
   if (!jm_enter_critical_section || !jm_exit_critical_section) {
     dlclose(selfhandle);
     selfhandle = NULL;
@@ -111,3 +147,154 @@ jmu_free (void *ptr)
   free(ptr);
   jm_exit_critical_section();
 }
+
+
+/* Store the communicator that spans all of the JumboMem masters.
+ * (comm is really an MPI_Comm *.  We avoid including mpi.h so this
+ * file can be compiled without MPI.) */
+int
+jmu_get_master_comm (void *comm)
+{
+  int retval;
+
+  RETURN_IF_NO_JM(0);
+  if (!jm_get_master_comm)
+    return 0;
+  jm_enter_critical_section();
+  retval = jm_get_master_comm(comm);
+  jm_exit_critical_section();
+  return retval;
+}
+
+
+/* Start fetching a range of addresses in the background. */
+void
+jmu_prefetch_hint (const void *addr, size_t numbytes)
+{
+  RETURN_IF_NO_JM();
+  if (!jm_prefetch_hint)
+    return;
+  jm_enter_critical_section();
+  jm_prefetch_hint((const char *)addr, numbytes);
+  jm_exit_critical_section();
+}
+
+
+/* Bring a range of addresses into the master's memory. */
+void
+jmu_acquire (const void *addr, size_t numbytes)
+{
+  RETURN_IF_NO_JM();
+  if (!jm_touch_memory_region)
+    return;
+  jm_enter_critical_section();
+  jm_touch_memory_region((const char *)addr, numbytes);
+  jm_exit_critical_section();
+}
+
+
+/* Declare that a range of addresses will be overwritten without
+ * first being read. */
+void
+jmu_write_only_hint (void *addr, size_t numbytes)
+{
+  RETURN_IF_NO_JM();
+  if (!jm_write_only_hint)
+    return;
+  jm_enter_critical_section();
+  jm_write_only_hint((const char *)addr, numbytes);
+  jm_exit_critical_section();
+}
+
+
+/* Reserve and limit the master's caching of a range of addresses.
+ * Return 0 on success or -1 on failure. */
+int
+jmu_cache_quota (const void *addr, size_t numbytes, size_t min_bytes, size_t max_bytes)
+{
+  int retval;
+
+  RETURN_IF_NO_JM(-1);
+  if (!jm_set_cache_quota)
+    return -1;
+  jm_enter_critical_section();
+  retval = jm_set_cache_quota((const char *)addr, numbytes, min_bytes, max_bytes);
+  jm_exit_critical_section();
+  return retval;
+}
+
+
+/* Create a region that JumboMem manages with its own page size and
+ * policy.  Return its base address or NULL on failure. */
+void *
+jmu_region_create (size_t numbytes, size_t pagesize, int policy)
+{
+  void *retval;
+
+  RETURN_IF_NO_JM(NULL);
+  if (!jm_region_create)
+    return NULL;
+  jm_enter_critical_section();
+  retval = jm_region_create(numbytes, pagesize, policy);
+  jm_exit_critical_section();
+  return retval;
+}
+
+
+/* Destroy a region.  Return 0 on success or -1 on failure. */
+int
+jmu_region_destroy (void *region)
+{
+  int retval;
+
+  RETURN_IF_NO_JM(-1);
+  if (!jm_region_destroy)
+    return -1;
+  jm_enter_critical_section();
+  retval = jm_region_destroy(region);
+  jm_exit_critical_section();
+  return retval;
+}
+
+
+/* Map part of a file into a region cached in the slaves' memory.
+ * Return its base address or NULL on failure. */
+void *
+jmu_map_file (const char *path, off_t offset, size_t len, int flags)
+{
+  void *retval;
+
+  RETURN_IF_NO_JM(NULL);
+  if (!jm_map_file)
+    return NULL;
+  jm_enter_critical_section();
+  retval = jm_map_file(path, offset, len, flags);
+  jm_exit_critical_section();
+  return retval;
+}
+
+
+/* Write a file-backed region's modified pages to its file.  Return 0
+ * on success or -1 on failure. */
+int
+jmu_sync_file (void *region)
+{
+  int retval;
+
+  RETURN_IF_NO_JM(-1);
+  if (!jm_region_sync)
+    return -1;
+  jm_enter_critical_section();
+  retval = jm_region_sync(region);
+  jm_exit_critical_section();
+  return retval;
+}
+
+
+/* Write back and destroy a file-backed region.  Return 0 on success
+ * or -1 on failure. */
+int
+jmu_unmap_file (void *region)
+{
+  return jmu_region_destroy(region);
+}
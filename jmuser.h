@@ -30,6 +30,10 @@
 #include <sys/types.h>
 #include <inttypes.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Invoke malloc() as if it were called internally by JumboMem. */
 extern void *jmu_malloc(size_t numbytes);
 
@@ -38,3 +42,73 @@ extern void *jmu_realloc(void *ptr, size_t numbytes);
 
 /* Invoke free() as if it were called internally by JumboMem. */
 extern void jmu_free(void *ptr);
+
+/* Start fetching the pages spanned by a range of addresses in the
+ * background so a later access to them needn't wait.  This is only a
+ * hint; at most a few pages are fetched ahead. */
+extern void jmu_prefetch_hint(const void *addr, size_t numbytes);
+
+/* Bring the pages spanned by a range of addresses into the master's
+ * memory before returning. */
+extern void jmu_acquire(const void *addr, size_t numbytes);
+
+/* Promise to overwrite a range of addresses from front to back
+ * without first reading it.  JumboMem discards the range's old
+ * contents instead of fetching them and writes each page back as soon
+ * as the program moves past it. */
+extern void jmu_write_only_hint(void *addr, size_t numbytes);
+
+/* Reserve at least min_bytes and at most max_bytes (0=unlimited) of
+ * the master's cache for the pages spanned by a range of addresses
+ * allocated with malloc().  A reservation keeps a hot index cached
+ * while the program sweeps through other data; a limit keeps a bulk
+ * scan from evicting everything else.  Setting both to 0 removes the
+ * range's quota.  Return 0 on success or -1 on failure. */
+extern int jmu_cache_quota(const void *addr, size_t numbytes, size_t min_bytes, size_t max_bytes);
+
+/* Policy flags for jmu_region_create().  Combine at most one
+ * replacement policy, at most one placement, and any of the rest. */
+#define JMU_REGION_RANDOM      0x0000   /* Evict a random page (default) */
+#define JMU_REGION_FIFO        0x0001   /* Evict the page cached the longest */
+#define JMU_REGION_STRIPE      0x0000   /* Stripe each page across the slaves (default) */
+#define JMU_REGION_WHOLE       0x0010   /* Store each page on a single slave */
+#define JMU_REGION_TRACK_DIRTY 0x0100   /* Send back only pages that were written */
+#define JMU_REGION_PREFETCH(DEPTH) (((DEPTH)&0xff) << 16)  /* Fetch DEPTH pages ahead of sequential faults */
+
+/* Create a region of numbytes bytes that JumboMem manages separately
+ * from the rest of memory, with its own page size (a multiple or a
+ * divisor of the JumboMem page size) and policy.  Return the region's
+ * base address or NULL on failure. */
+extern void *jmu_region_create(size_t numbytes, size_t pagesize, int policy);
+
+/* Destroy a region created by jmu_region_create() or jmu_map_file().
+ * Return 0 on success or -1 on failure. */
+extern int jmu_region_destroy(void *region);
+
+/* Flag for jmu_map_file(), which also accepts the JMU_REGION_* flags. */
+#define JMU_MAP_WRITE          0x1000   /* Allow the program to modify the file */
+
+/* Map len bytes of a file, starting at a given offset, into a region
+ * whose pages are read from the file on first use and cached in the
+ * slaves' memory.  If len is 0, map the rest of the file.  Return the
+ * region's base address or NULL on failure. */
+extern void *jmu_map_file(const char *path, off_t offset, size_t len, int flags);
+
+/* Write the modified pages of a file-backed region to the file.
+ * Return 0 on success or -1 on failure. */
+extern int jmu_sync_file(void *region);
+
+/* Write back and destroy a file-backed region.  Return 0 on success
+ * or -1 on failure. */
+extern int jmu_unmap_file(void *region);
+
+#ifdef MPI_VERSION
+/* Store in *comm the communicator that spans all of the JumboMem
+ * masters.  MPI programs should use this in place of MPI_COMM_WORLD.
+ * Return 1 on success or 0 if JumboMem isn't managing MPI. */
+extern int jmu_get_master_comm(MPI_Comm *comm);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
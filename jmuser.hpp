@@ -0,0 +1,231 @@
+/*---------------------------------------------------------------
+ * JumboMem memory server: C++ interface to JumboMem internals
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *---------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+/*
+ * This header lets C++ programs choose where their data live without
+ * changing the behavior of the global malloc():
+ *
+ *   jm::local_allocator<T>   allocates in the master's own memory,
+ *                            which JumboMem never pages out.  Use it
+ *                            for indexes and other hot metadata.
+ *
+ *   jm::remote_allocator<T>  allocates in JumboMem's paged memory,
+ *                            optionally giving each allocation its
+ *                            own region (see jmu_region_create()).
+ *
+ *   jm::stream_view<T>       iterates over an array while fetching
+ *                            the next chunk in the background.
+ *
+ * Link with -ljmuser as for jmuser.h.
+ */
+
+#ifndef JMUSER_HPP
+#define JMUSER_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <iterator>
+#include "jmuser.h"
+
+namespace jm {
+
+/* Allocate memory that stays in the master's local memory. */
+template <typename T>
+class local_allocator {
+public:
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+  template <typename U> struct rebind { typedef local_allocator<U> other; };
+
+  local_allocator() throw() {}
+  template <typename U> local_allocator(const local_allocator<U> &) throw() {}
+
+  T *allocate(std::size_t n, const void * = 0) {
+    void *ptr = jmu_malloc(n*sizeof(T));
+
+    if (!ptr && n)
+      throw std::bad_alloc();
+    return static_cast<T *>(ptr);
+  }
+
+  void deallocate(T *ptr, std::size_t) { jmu_free(ptr); }
+
+  std::size_t max_size() const throw() { return std::size_t(-1) / sizeof(T); }
+  void construct(T *ptr, const T &value) { new (static_cast<void *>(ptr)) T(value); }
+  void destroy(T *ptr) { ptr->~T(); }
+};
+
+template <typename T, typename U>
+inline bool operator==(const local_allocator<T> &, const local_allocator<U> &) { return true; }
+template <typename T, typename U>
+inline bool operator!=(const local_allocator<T> &, const local_allocator<U> &) { return false; }
+
+
+/* Allocate memory that JumboMem pages to and from the slaves.  By
+ * default, allocations come from the global heap.  Given a region
+ * page size, each allocation instead gets a region of its own with
+ * that page size and a set of JMU_REGION_* flags (e.g., a prefetch
+ * depth).  Regions are a limited resource, so this suits a few large
+ * containers, not many small ones.  Any remote_allocator can free
+ * memory allocated by any other. */
+template <typename T>
+class remote_allocator {
+public:
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+  template <typename U> struct rebind { typedef remote_allocator<U> other; };
+
+  explicit remote_allocator(std::size_t region_pagesize = 0, int region_flags = 0) throw()
+    : pagesize_(region_pagesize), flags_(region_flags) {}
+  template <typename U> remote_allocator(const remote_allocator<U> &other) throw()
+    : pagesize_(other.region_pagesize()), flags_(other.region_flags()) {}
+
+  T *allocate(std::size_t n, const void * = 0) {
+    void *ptr = 0;
+
+    if (pagesize_ && n)
+      ptr = jmu_region_create(n*sizeof(T), pagesize_, flags_);
+    if (!ptr)
+      ptr = std::malloc(n*sizeof(T));
+    if (!ptr && n)
+      throw std::bad_alloc();
+    return static_cast<T *>(ptr);
+  }
+
+  void deallocate(T *ptr, std::size_t) {
+    if (ptr && jmu_region_destroy(ptr) != 0)
+      std::free(ptr);
+  }
+
+  std::size_t max_size() const throw() { return std::size_t(-1) / sizeof(T); }
+  void construct(T *ptr, const T &value) { new (static_cast<void *>(ptr)) T(value); }
+  void destroy(T *ptr) { ptr->~T(); }
+
+  std::size_t region_pagesize() const throw() { return pagesize_; }
+  int region_flags() const throw() { return flags_; }
+
+private:
+  std::size_t pagesize_;     // Region page size or 0 for the global heap
+  int flags_;                // JMU_REGION_* flags for new regions
+};
+
+template <typename T, typename U>
+inline bool operator==(const remote_allocator<T> &, const remote_allocator<U> &) { return true; }
+template <typename T, typename U>
+inline bool operator!=(const remote_allocator<T> &, const remote_allocator<U> &) { return false; }
+
+
+/* Present an array as a range whose iterators, upon entering each
+ * chunk, bring that chunk into local memory and ask JumboMem to start
+ * fetching the following chunk.  Computation on one chunk thereby
+ * overlaps communication for the next. */
+template <typename T>
+class stream_view {
+public:
+  class iterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T *pointer;
+    typedef T &reference;
+
+    iterator() : ptr_(0), chunk_end_(0), view_(0) {}
+
+    reference operator*() const { return *ptr_; }
+    pointer operator->() const { return ptr_; }
+    iterator &operator++() {
+      if (++ptr_ == chunk_end_)
+        enter_chunk();
+      return *this;
+    }
+    iterator operator++(int) { iterator prev(*this); ++*this; return prev; }
+    bool operator==(const iterator &other) const { return ptr_ == other.ptr_; }
+    bool operator!=(const iterator &other) const { return ptr_ != other.ptr_; }
+
+  private:
+    friend class stream_view;
+
+    iterator(T *ptr, const stream_view *view) : ptr_(ptr), chunk_end_(0), view_(view) {
+      if (ptr_ != view_->end_)
+        enter_chunk();
+    }
+
+    /* Acquire the chunk beginning at ptr_ and hint the one after it. */
+    void enter_chunk() {
+      if (ptr_ == view_->end_)
+        return;
+      chunk_end_ = ptr_ + view_->chunk_;
+      if (chunk_end_ > view_->end_)
+        chunk_end_ = view_->end_;
+      jmu_acquire(ptr_, (chunk_end_ - ptr_)*sizeof(T));
+      if (chunk_end_ != view_->end_) {
+        T *next_end = chunk_end_ + view_->chunk_;
+
+        if (next_end > view_->end_)
+          next_end = view_->end_;
+        jmu_prefetch_hint(chunk_end_, (next_end - chunk_end_)*sizeof(T));
+      }
+    }
+
+    T *ptr_;                   // Current element
+    T *chunk_end_;             // Element past the current chunk
+    const stream_view *view_;  // View being iterated over
+  };
+
+  /* View count elements starting at data in chunks of roughly
+   * chunk_bytes bytes. */
+  stream_view(T *data, std::size_t count, std::size_t chunk_bytes = 256*1024)
+    : begin_(data), end_(data + count),
+      chunk_(chunk_bytes/sizeof(T) > 0 ? chunk_bytes/sizeof(T) : 1) {}
+
+  iterator begin() const { return iterator(begin_, this); }
+  iterator end() const { return iterator(end_, this); }
+  std::size_t size() const { return end_ - begin_; }
+
+private:
+  T *begin_;                 // First element
+  T *end_;                   // Element past the last
+  std::size_t chunk_;        // Elements per chunk
+};
+
+}  // namespace jm
+
+#endif
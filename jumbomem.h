@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <signal.h>
@@ -53,18 +54,25 @@
 #endif
 
 /* Define macros for converting a global address to a page number,
- * slave number, and slave byte offset. */
-#define GET_PAGE_NUMBER(ADDR) ((uintptr_t)((ADDR)-jm_globals.memregion)/jm_globals.pagesize)
+ * slave number, and slave byte offset.  The divisors are fixed at
+ * initialization time (see jm_initialize_divisor()) so these reduce to
+ * shifts and masks or to multiplications in the common case. */
+#define GET_PAGE_NUMBER(ADDR) jm_divide((uintptr_t)((ADDR)-jm_globals.memregion), &jm_globals.pagediv)
+
+/* Say whether an address lies beyond the slaves' capacity, in the
+ * part of the address space that is backed by a file. */
+#define IN_FILE_TIER(ADDR) ((uintptr_t)((ADDR)-jm_globals.memregion) >= jm_globals.slave_extent)
 #ifdef JM_DIST_BLOCK
 /* Distribute pages among slaves in a block fashion (i.e., fill one
  * slave's memory before using any of the next slave's memory). */
-# define GET_SLAVE_NUM(ADDR) ((uintptr_t)((ADDR)-jm_globals.memregion)/jm_globals.slavebytes)
-# define GET_SLAVE_OFFSET(ADDR) ((uintptr_t)((ADDR)-jm_globals.memregion)%jm_globals.slavebytes)
+# define GET_SLAVE_NUM(ADDR) jm_divide((uintptr_t)((ADDR)-jm_globals.memregion), &jm_globals.slavediv)
+# define GET_SLAVE_OFFSET(ADDR) jm_modulo((uintptr_t)((ADDR)-jm_globals.memregion), &jm_globals.slavediv)
 #else
 /* Distribute pages among slaves in a round-robin fashion (i.e.,
  * adjacent pages go to adjacent slaves). */
-# define GET_SLAVE_NUM(ADDR) (GET_PAGE_NUMBER(ADDR)%jm_globals.numslaves)
-# define GET_SLAVE_OFFSET(ADDR) ((GET_PAGE_NUMBER(ADDR)/jm_globals.numslaves)*jm_globals.pagesize)
+# define GET_SLAVE_NUM(ADDR) jm_modulo(GET_PAGE_NUMBER(ADDR), &jm_globals.slavediv)
+# define GET_SLAVE_OFFSET(ADDR) (jm_divide(GET_PAGE_NUMBER(ADDR), &jm_globals.slavediv)*jm_globals.pagesize \
+                                + jm_modulo((uintptr_t)((ADDR)-jm_globals.memregion), &jm_globals.pagediv))
 #endif
 
 /* Define macros for normalizing a size_t's byte order in a
@@ -99,6 +107,17 @@
 # define FROM_NETWORK(x) (x)
 #endif
 
+/* Declare thread-local variables using the initial-exec TLS model,
+ * which reduces each access to a single load relative to the thread
+ * pointer and, unlike the general-dynamic model, never allocates
+ * memory (important within a signal handler).  Define JM_NO_TLS to
+ * fall back to pthread_getspecific(). */
+#if defined(__GNUC__) && !defined(JM_NO_TLS)
+# define JM_HAVE_TLS
+# define JM_THREAD_LOCAL __thread __attribute__ ((tls_model("initial-exec")))
+extern JM_THREAD_LOCAL unsigned int jm_internal_depth;   /* Calling thread's mega-lock depth */
+#endif
+
 /* Define macros for recording that we've entered or exited a JumboMem
  * function. */
 #define JM_ENTER() jm_enter_critical_section()
@@ -108,7 +127,11 @@
     return RETVAL;                              \
   }                                             \
   while (0)
-#define JM_INTERNAL_INVOCATION() (jm_globals.is_internal || jm_get_internal_depth() > 1)
+#ifdef JM_HAVE_TLS
+# define JM_INTERNAL_INVOCATION() (jm_globals.is_internal || jm_internal_depth > 1)
+#else
+# define JM_INTERNAL_INVOCATION() (jm_globals.is_internal || jm_get_internal_depth() > 1)
+#endif
 
 /* Define MAP_POPULATE if not defined in sys/mman.h. */
 #ifndef MAP_POPULATE
@@ -122,29 +145,107 @@ typedef struct {
   void *threadstack;                   /* Stack for the thread to use; NULL=user-allocated */
 } PTHREAD_CREATE_ARGS;
 
+/* Define the maximum number of pages that can be prefetched ahead of
+ * a fault. */
+#ifndef JM_MAX_PREFETCH_DEPTH
+# define JM_MAX_PREFETCH_DEPTH 8
+#endif
+
+/* Define the maximum number of transfers a JumboMem region (see
+ * region.c) keeps in flight while paging in or out. */
+#ifndef JM_MAX_REGION_TRANSFERS
+# define JM_MAX_REGION_TRANSFERS 4
+#endif
+
+/* Define the maximum number of hedged fetches (see replica.c) whose
+ * losing copy of a page may still be in flight. */
+#ifndef JM_MAX_STRAGGLERS
+# define JM_MAX_STRAGGLERS 4
+#endif
+
+/* Define the default maximum number of never-populated pages to map
+ * in response to a single fault (JM_FAULTAROUND). */
+#ifndef JM_DEFAULT_FAULT_AROUND
+# define JM_DEFAULT_FAULT_AROUND 16
+#endif
+
+/* Define the number of equally ranked pages a page-replacement module
+ * considers before evicting the one that's cheapest to evict. */
+#ifndef JM_VICTIM_CANDIDATES
+# define JM_VICTIM_CANDIDATES 4
+#endif
+
+/* Define the default number of consecutive sequential write faults
+ * after which JumboMem treats a run of pages as a write-once stream
+ * (JM_WRITESTREAM). */
+#ifndef JM_DEFAULT_WRITE_STREAM
+# define JM_DEFAULT_WRITE_STREAM 64
+#endif
+
 /* We can use one of the following techniques to determine the next
  * page to prefetch. */
 typedef enum {
   PREFETCH_NONE,           /* Don't prefetch any pages. */
   PREFETCH_NEXT,           /* Always prefetch the (static) next page. */
-  PREFETCH_DELTA           /* Prefetch the same page distance as previously. */
+  PREFETCH_DELTA,          /* Prefetch the same page distance as previously. */
+  PREFETCH_STREAM          /* Prefetch ahead of an ascending or descending run of pages. */
 } JUMBOMEM_PREFETCH;
 
+/* Define the ways we can back the local cache with huge pages. */
+typedef enum {
+  HUGEPAGES_NONE,          /* Use ordinary OS pages. */
+  HUGEPAGES_THP,           /* Ask for transparent huge pages with madvise(). */
+  HUGEPAGES_HUGETLB        /* Map pages from the hugetlb pool. */
+} JUMBOMEM_HUGEPAGES;
+
+/* Define the ways we can place the local cache on NUMA nodes. */
+typedef enum {
+  NUMA_NONE,               /* Let the operating system place pages. */
+  NUMA_INTERLEAVE,         /* Interleave pages across all NUMA nodes. */
+  NUMA_LOCAL               /* Place each page on the faulting thread's NUMA node. */
+} JUMBOMEM_NUMA;
+
+/* Represent a divisor that is fixed at initialization time.  Powers
+ * of two divide with a shift and a mask.  Other divisors divide by
+ * multiplying by a precomputed reciprocal, which is exact when both
+ * the divisor and every dividend fit in 32 bits. */
+typedef struct {
+  uint64_t divisor;        /* Number to divide by */
+  int      shift;          /* log2(divisor) if divisor is a power of two, else -1 */
+  uint64_t reciprocal;     /* ceil(2^64/divisor) or 0 to divide normally */
+} JUMBOMEM_DIVISOR;
+
 /* Put all of our global variables in a single structure to avoid
  * namespace pollution. */
 typedef struct {
   size_t  pagesize;        /* JumboMem logical page size */
   size_t  ospagesize;      /* Operating system page size */
+  JUMBOMEM_HUGEPAGES hugepages;  /* Type of huge pages backing the local cache */
+  size_t  hugepagesize;    /* Huge-page size (divides pagesize) */
+  JUMBOMEM_NUMA numa_policy;   /* Placement of the local cache on NUMA nodes */
+  int     numa_nodes;      /* Number of NUMA nodes (1 if not a NUMA system) */
   char   *memregion;       /* Entire memory region under our control */
   char   *endaddress;      /* Pointer past last word of memregion passed to dlmalloc */
   size_t  extent;          /* Total number of bytes in memregion */
+  size_t  max_extent;      /* Number of bytes of address space reserved for memregion to grow into */
+  size_t  slave_extent;    /* Number of bytes of memregion backed by slaves (the rest is backed by a file) */
   unsigned int numslaves;  /* Number of slave processes */
   size_t  slavebytes;      /* Number of bytes managed by each slave */
+  JUMBOMEM_DIVISOR pagediv;    /* pagesize as a divisor */
+  JUMBOMEM_DIVISOR slavediv;   /* numslaves (or slavebytes for JM_DIST_BLOCK) as a divisor */
   unsigned long local_pages;   /* Number of JumboMem pages we can cache at the master */
+  unsigned long local_page_target;  /* Number of JumboMem pages we currently want to cache (<= local_pages) */
   char   *progname;        /* Name of this program (argv[0]) */
   JUMBOMEM_PREFETCH prefetch_type;  /* Prefetching technique to utilize */
+  int     prefetch_auto;   /* 0=fixed prefetching technique; 1=select technique and depth at run time */
+  unsigned int prefetch_depth;      /* Number of pages currently prefetched ahead of a fault */
+  unsigned int prefetch_max_depth;  /* Upper bound on prefetch_depth */
   int     async_evict;     /* 0=evict pages synchronously; 1=asynchronously */
   int     extra_memcpy;    /* 0=send/receive directly; 1=copy data in and out of message buffers */
+  unsigned long park_window;   /* Maximum microseconds between faults that keep other threads parked (0=never park) */
+  unsigned long fault_around;  /* Maximum number of never-populated pages to map per fault */
+  unsigned long write_stream;  /* Sequential write faults that mark a write-once stream (0=never) */
+  unsigned int hedge_percentile;  /* Fetch-latency percentile past which to ask a page's replica (0=never) */
   int     debuglevel;      /* Debug level (larger = more verbose output) */
   int     is_internal;     /* 0=within either JumboMem or user code; >0=definitely within JumboMem */
   int     error_exit;      /* 0=normal termination; 1=jm_abort() was called */
@@ -157,6 +258,31 @@ typedef struct {
 } JUMBOMEM_GLOBALS;
 extern JUMBOMEM_GLOBALS jm_globals;
 
+/* Divide by or take the remainder modulo a JUMBOMEM_DIVISOR. */
+static inline uint64_t
+jm_divide (uint64_t dividend, const JUMBOMEM_DIVISOR *div)
+{
+  if (div->shift >= 0)
+    return dividend >> div->shift;
+#ifdef __SIZEOF_INT128__
+  if (div->reciprocal)
+    return (uint64_t) (((unsigned __int128)div->reciprocal * dividend) >> 64);
+#endif
+  return dividend / div->divisor;
+}
+
+static inline uint64_t
+jm_modulo (uint64_t dividend, const JUMBOMEM_DIVISOR *div)
+{
+  if (div->shift >= 0)
+    return dividend & (div->divisor - 1);
+#ifdef __SIZEOF_INT128__
+  if (div->reciprocal)
+    return (uint64_t) (((unsigned __int128)(div->reciprocal * dividend) * div->divisor) >> 64);
+#endif
+  return dividend % div->divisor;
+}
+
 /* Read the cycle counter and associate a textual description with it. */
 #if defined(JM_PROFILE_SIZE) && defined(__GNUC__)
   /* The following definition is x86-64 (and gcc) specific.  Do not
@@ -184,19 +310,66 @@ extern void jm_initialize_overrides(void);
 extern void jm_initialize_pagereplace(void);
 extern void jm_initialize_signal_handler(void);
 extern void jm_initialize_slaves(void);
+extern void jm_initialize_control_socket(void);
+extern void jm_initialize_page_copy(void);
+extern void jm_initialize_replicas(void);
 
 /* Finalize various JumboMem modules. */
 extern void jm_finalize_memory(void);
 extern void jm_finalize_pagereplace(void);
 extern void jm_finalize_signal_handler(void);
 extern void jm_finalize_slaves(void);
-
-/* Asynchronously fetch a page from a slave or evict a page to a slave. */
-extern void *jm_fetch_begin(char *fetch_addr, char *fetch_page);
+extern void jm_finalize_control_socket(void);
+extern void jm_finalize_file_tier(void);
+extern void jm_finalize_regions(void);
+extern void jm_finalize_quotas(void);
+extern void jm_finalize_replicas(void);
+
+/* Copy a page, bypassing the cache when possible. */
+extern void jm_copy_page(char *target, const char *source, size_t numbytes);
+
+/* Asynchronously fetch a page from a slave or evict a page to a
+ * slave.  numbytes is normally jm_globals.pagesize but may be smaller
+ * as long as the transfer lies within a single JumboMem page. */
+extern void *jm_fetch_begin(char *fetch_addr, char *fetch_page, size_t numbytes);
 extern void jm_fetch_end(void *opaque_state);
-extern void *jm_evict_begin(char *evict_addr, char *evict_page);
+extern void *jm_evict_begin(char *evict_addr, char *evict_page, size_t numbytes);
 extern void jm_evict_end(void *opaque_state);
 
+/* Finish a fetch or eviction if it has already completed.  Return 1
+ * if the transfer is complete (as after jm_fetch_end() or
+ * jm_evict_end()) or 0 if it's still in flight. */
+extern int jm_fetch_test(void *opaque_state);
+extern int jm_evict_test(void *opaque_state);
+
+/* Create a separately managed region (see region.c) or service a
+ * fault on one.  jm_region_fault() returns 0 if the address doesn't
+ * belong to a region. */
+extern void *jm_region_create(size_t numbytes, size_t pagesize, int policy);
+extern int jm_region_fault(char *fault_addr);
+
+/* Map part of a file into a region, write a file-backed region's
+ * modified pages to its file, or destroy a region.  The latter two
+ * return 0 on success or -1 on failure. */
+extern void *jm_map_file(const char *filename, off_t offset, size_t numbytes, int flags);
+extern int jm_region_sync(void *baseaddr);
+extern int jm_region_destroy(void *baseaddr);
+
+/* Grow the global address space to a given number of bytes, backing
+ * the growth with a file.  Return 1 on success, 0 on failure. */
+extern int jm_grow_address_space(size_t new_extent);
+
+/* Set aside slave storage from the top of the global address space
+ * for regions and replicas or give it back.  jm_return_slave_storage()
+ * returns 1 on success and 0 if the storage wasn't the most recently
+ * carved. */
+extern char *jm_carve_slave_storage(size_t numbytes);
+extern int jm_return_slave_storage(char *storage, size_t numbytes);
+
+/* Synchronously transfer a page to or from the file tier. */
+extern void jm_file_tier_fetch(char *fetch_addr, char *fetch_page);
+extern void jm_file_tier_evict(char *evict_addr, char *evict_page);
+
 /* Say whether a page is already resident and, if so, what protections
  * it should have (always read/write). */
 extern int jm_page_is_resident(char *rounded_addr, int *protflags);
@@ -205,6 +378,81 @@ extern int jm_page_is_resident(char *rounded_addr, int *protflags);
  * page to evict and the initial protection of the new page. */
 extern void jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_page, int *clean);
 
+/* If more pages are resident than jm_globals.local_page_target,
+ * select a page to evict without replacing it and return 1.
+ * Otherwise, return 0. */
+extern int jm_find_surplus_page (char **evictable_page, int *clean);
+
+/* Given candidate pages to evict, equally ranked by a page-replacement
+ * module, return the index of the one whose eviction should delay
+ * the fetch of faulted_page (which may be NULL) the least. */
+extern unsigned int jm_cheapest_victim (char **candidates, const int *clean, unsigned int numcandidates, char *faulted_page);
+
+/* Stop caching a given resident page so the caller can evict it and
+ * say whether the page is clean.  Return 1 on success or 0 if the
+ * page isn't resident or the page-replacement module can't tell. */
+extern int jm_release_page (char *rounded_addr, int *clean);
+
+/* Say whether the page-replacement module ever reports an evicted
+ * page as clean. */
+extern int jm_pagereplace_reports_clean (void);
+
+/* Bound the master's caching of a range of the global address space
+ * (see quota.c).  jm_set_cache_quota() returns 0 on success or -1 on
+ * failure.  The fault handler reports each page that enters or leaves
+ * the cache; before caching a page it evicts the pages that
+ * jm_quota_overflow_page() releases.  jm_quota_reserves() says whether
+ * evicting a page in favor of faulted_page (which may be NULL) would
+ * dip into a reservation. */
+extern int jm_set_cache_quota (const char *baseaddr, size_t numbytes, size_t min_bytes, size_t max_bytes);
+extern void jm_quota_page_cached (char *rounded_addr);
+extern void jm_quota_page_evicted (char *rounded_addr);
+extern int jm_quota_overflow_page (char *faulted_page, char **evictable_page, int *clean);
+extern int jm_quota_reserves (char *rounded_addr, char *faulted_page);
+
+/* Replicate read-mostly pages on a second slave and fetch a page
+ * from both when its slave is slow to respond (see replica.c).  The
+ * fault handler passes every clean page it evicts to
+ * jm_replicate_page() and every dirty page to jm_invalidate_replica()
+ * and routes demand fetches through the hedged-fetch functions. */
+extern void jm_replicate_page(char *rounded_addr);
+extern void jm_invalidate_replica(char *rounded_addr);
+extern void jm_hedged_fetch_begin(char *fetch_addr, char *fetch_page);
+extern void jm_hedged_fetch_end(void);
+
+/* Change a page-replacement parameter, named by its environment
+ * variable, while the program is running.  Return NULL on success or
+ * a textual reason on failure. */
+extern const char *jm_set_pagereplace_parameter (const char *envvar, unsigned long value);
+
+/* Map a JM_PREFETCH string to a prefetching technique and an
+ * indication of whether that technique is self-tuning.  Return 1 on
+ * success or 0 if the string is not recognized. */
+extern int jm_parse_prefetch_type (const char *prefetch_string, JUMBOMEM_PREFETCH *prefetch_type, int *prefetch_auto);
+
+/* Change the prefetching technique and depth while the program is
+ * running.  The caller must be in a critical section. */
+extern void jm_reconfigure_prefetching (JUMBOMEM_PREFETCH prefetch_type, int prefetch_auto, unsigned int max_depth);
+
+/* Start prefetching the pages spanned by a range of addresses at the
+ * program's request. */
+extern void jm_prefetch_hint (const char *baseaddr, size_t numbytes);
+
+/* Zero or copy a range of memory without touching pages known to
+ * contain only zeros. */
+extern void jm_zero_memory (void *baseaddr, size_t numbytes);
+extern void jm_copy_memory (void *target, const void *source, size_t numbytes);
+
+/* Declare that the contents of a range of memory are no longer needed. */
+extern void jm_discard_memory (void *baseaddr, size_t numbytes);
+
+/* Declare that the program will overwrite a range of memory from
+ * front to back without first reading it. */
+extern void jm_write_only_hint (const char *baseaddr, size_t numbytes);
+
+/* Output the fault handler's statistics at a given debug level. */
+extern void jm_report_fault_statistics (int level);
+
 /* Output an error message and abort the program. */
 extern void jm_abort(const char *format, ...);
 
@@ -273,10 +521,19 @@ extern const char *jm_strerror(int errnum);
  * function in fact cycles through a set of static strings. */
 extern char *jm_format_power_of_2(uint64_t number, int digits);
 
+/* Prepare a divisor for use with jm_divide() and jm_modulo(). */
+extern void jm_initialize_divisor(JUMBOMEM_DIVISOR *div, uint64_t divisor, uint64_t max_dividend);
+
 /* Assign or remove memory backing store. */
 extern void jm_assign_backing_store(char *baseaddr, size_t numbytes, int protflags);
 extern void jm_remove_backing_store(char *baseaddr, size_t numbytes);
 
+/* Place memory on NUMA nodes. */
+extern void jm_set_numa_policy(char *baseaddr, size_t numbytes, JUMBOMEM_NUMA policy, int node);
+
+/* Allocate a slave's memory buffer, placed and populated. */
+extern char *jm_allocate_slave_buffer(size_t numbytes);
+
 /* Touch a range of addresses to fault them into the local cache.
  * This function should not be called while the fault handler is
  * active. */
@@ -298,12 +555,16 @@ extern unsigned int jm_get_internal_depth(void);
 extern void jm_set_internal_depth(unsigned int newdepth);
 
 /* Return 1 if we should exit the signal handler immediately. */
-extern int jm_must_exit_signal_handler_now(void);
+extern int jm_must_exit_signal_handler_now(int);
 
 /* Instruct all other threads to freeze execution and wait until
  * they're all frozen before returning. */
 extern void jm_freeze_other_threads(void);
 
+/* Mark the calling thread as internal to JumboMem so that it is never
+ * frozen while another thread services a page fault. */
+extern void jm_mark_thread_internal(void);
+
 /* Initialize the current thread then invoke the user's initializer.
  * The caller is responsible for allocating memory for arg but we will
  * free it before we return. */
@@ -323,6 +584,9 @@ extern void jm_page_table_insert(void *pt_obj, char *address, void *extradata);
 /* Delete a page from the page table. */
 extern void jm_page_table_delete(void *pt_obj, char *address);
 
+/* Delete a page from the page table when no insertion will follow. */
+extern void jm_page_table_remove(void *pt_obj, char *address);
+
 /* Return a pointer to a page's payload data or NULL if the page isn't
  * resident. */
 extern void *jm_page_table_find(void *pt_obj, char *address);
@@ -358,6 +622,20 @@ extern size_t jm_get_minimum_jm_page_size(void);
 /* Return the physical page size. */
 extern size_t jm_get_page_size(void);
 
+/* Return the default huge-page size or zero if indeterminate. */
+extern size_t jm_get_huge_page_size(void);
+
+/* Return the number of NUMA nodes (1 if indeterminate). */
+extern int jm_get_numa_node_count(void);
+
+/* Return the NUMA node on which the calling thread is running or -1
+ * if indeterminate. */
+extern int jm_get_current_numa_node(void);
+
+/* Return the NUMA node to which a network interface is attached or -1
+ * if indeterminate. */
+extern int jm_get_nic_numa_node(const char *ifname);
+
 /* Redefine mmap() to prevent programs from mapping memory into the
  * middle of JumboMem's controlled region. */
 extern void *jm_mmap (void *start, size_t length, int prot, int flags, int fd, off_t offset);
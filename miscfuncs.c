@@ -30,6 +30,28 @@
 #include "jumbomem.h"
 #include <sys/time.h>
 #include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+/* Define the NUMA memory-policy modes if numaif.h isn't available. */
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_INTERLEAVE
+# define MPOL_INTERLEAVE 3
+#endif
+
+/* Define the largest number of NUMA nodes we can place memory on. */
+#ifndef JM_MAX_NUMA_NODES
+# define JM_MAX_NUMA_NODES 1024
+#endif
+
+/* Define the maximum number of threads that populate a slave buffer. */
+#ifndef JM_MAX_POPULATE_THREADS
+# define JM_MAX_POPULATE_THREADS 16
+#endif
 
 /* Define the maximum number of characters in a formatted number */
 #ifndef MAX_NUMBER_WIDTH
@@ -41,6 +63,15 @@
  * printf()). */
 #define MAX_NUMBER_BUFFERS 4
 
+/* Describe the portion of a slave buffer one thread should populate. */
+typedef struct {
+  char *baseaddr;          /* First address to populate */
+  size_t numbytes;         /* Number of bytes to populate */
+} POPULATE_ARGS;
+
+/* Point to the unwrapped pthread_create(). */
+extern int (*jm_original_pthread_create)(void *, void *, void *, void *);
+
 
 /* Output an error message and abort the program. */
 #ifdef __GNUC__
@@ -374,18 +405,276 @@ jm_format_power_of_2 (uint64_t number, int digits)
 }
 
 
+/* Apply a NUMA placement policy to a region of memory that hasn't yet
+ * been populated.  node is used only by NUMA_LOCAL; -1 means the
+ * calling thread's node. */
+void
+jm_set_numa_policy (char *baseaddr, size_t numbytes, JUMBOMEM_NUMA policy, int node)
+{
+#ifdef SYS_mbind
+  unsigned long nodemask[(JM_MAX_NUMA_NODES+8*sizeof(unsigned long)-1)/(8*sizeof(unsigned long))];
+  const int bits_per_long = 8*sizeof(unsigned long);
+  int mode;                /* MPOL_* value to pass to mbind() */
+  int i;
+
+  if (policy == NUMA_NONE || jm_globals.numa_nodes <= 1)
+    return;
+  memset(nodemask, 0, sizeof(nodemask));
+  if (policy == NUMA_INTERLEAVE) {
+    mode = MPOL_INTERLEAVE;
+    for (i=0; i<jm_globals.numa_nodes && i<JM_MAX_NUMA_NODES; i++)
+      nodemask[i/bits_per_long] |= 1UL << (i%bits_per_long);
+  }
+  else {
+    mode = MPOL_PREFERRED;
+    if (node < 0 && (node=jm_get_current_numa_node()) < 0)
+      return;
+    if (node >= JM_MAX_NUMA_NODES)
+      return;
+    nodemask[node/bits_per_long] |= 1UL << (node%bits_per_long);
+  }
+  if (syscall(SYS_mbind, baseaddr, numbytes, mode, nodemask, (unsigned long)JM_MAX_NUMA_NODES+1, 0) == -1)
+    jm_debug_printf(5, "mbind(%p, %lu) failed (%s)\n", baseaddr, numbytes, jm_strerror(errno));
+#endif
+}
+
+
+/* Bind a slave's buffer to the NUMA node of the network interface
+ * named by JM_NIC or, failing that, of the CPU on which we're running.
+ * The buffer must not yet have been populated. */
+static void
+place_slave_buffer (char *buffer, size_t numbytes)
+{
+  int node = -1;           /* NUMA node on which to place buffer */
+  size_t misalignment;     /* Bytes from buffer to the next OS page boundary */
+
+  if (jm_globals.numa_nodes <= 1)
+    return;
+  misalignment = (jm_globals.ospagesize - (uintptr_t)buffer%jm_globals.ospagesize) % jm_globals.ospagesize;
+  if (numbytes <= misalignment)
+    return;
+  buffer += misalignment;
+  numbytes -= misalignment;
+  if (getenv("JM_NIC") && (node=jm_get_nic_numa_node(getenv("JM_NIC"))) < 0)
+    jm_debug_printf(3, "Unable to determine the NUMA node of network interface %s.\n",
+                    getenv("JM_NIC"));
+  if (node < 0 && (node=jm_get_current_numa_node()) < 0)
+    return;
+  jm_debug_printf(4, "Placing %lu bytes of slave memory on NUMA node %d.\n", numbytes, node);
+  jm_set_numa_policy(buffer, numbytes, NUMA_LOCAL, node);
+}
+
+
+/* Populate one portion of a slave buffer. */
+static void *
+populate_slave_buffer (void *arg)
+{
+  POPULATE_ARGS *work = (POPULATE_ARGS *) arg;
+
+#ifdef MADV_POPULATE_WRITE
+  if (madvise((void *)work->baseaddr, work->numbytes, MADV_POPULATE_WRITE) == -1)
+#endif
+  {
+    size_t i;
+
+    for (i=0; i<work->numbytes; i+=jm_globals.ospagesize)
+      ((volatile char *)work->baseaddr)[i] = 0;
+  }
+  return NULL;
+}
+
+
+/* Allocate, place, and populate a slave's memory buffer, using huge
+ * pages if requested.  Population is divided among multiple threads
+ * so the kernel can zero pages concurrently.  Return NULL if the
+ * buffer can't be allocated. */
+char *
+jm_allocate_slave_buffer (size_t numbytes)
+{
+  char *buffer = MAP_FAILED;       /* Buffer to return */
+  size_t stride = jm_globals.ospagesize;   /* Bytes per OS (or huge) page */
+  POPULATE_ARGS work[JM_MAX_POPULATE_THREADS];       /* Each thread's portion of the buffer */
+  pthread_t threads[JM_MAX_POPULATE_THREADS];        /* Threads populating the buffer */
+  int started[JM_MAX_POPULATE_THREADS];              /* 1=threads[i] is running */
+  long numthreads;                 /* Number of threads to populate the buffer */
+  size_t chunkbytes;               /* Bytes per thread */
+  long i;
+
+  /* Try the hugetlb pool first.  Failing that, over-allocate so we
+   * can align the buffer to a huge-page boundary, which transparent
+   * huge pages require. */
+#ifdef MAP_HUGETLB
+  if (jm_globals.hugepages == HUGEPAGES_HUGETLB) {
+    size_t hugebytes = ((numbytes + jm_globals.hugepagesize - 1)/jm_globals.hugepagesize) * jm_globals.hugepagesize;
+
+    buffer = (char *) mmap(NULL, hugebytes, PROT_READ|PROT_WRITE,
+                           MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (buffer != MAP_FAILED)
+      stride = jm_globals.hugepagesize;
+    else
+      jm_debug_printf(3, "Failed to map %lu bytes of slave memory from the hugetlb pool (%s); using ordinary pages.\n",
+                      numbytes, jm_strerror(errno));
+  }
+#endif
+  if (buffer == MAP_FAILED) {
+    size_t alignment = jm_globals.hugepages == HUGEPAGES_NONE ? 0 : jm_globals.hugepagesize;
+    size_t slop;                   /* Bytes to trim from the front of the mapping */
+
+    buffer = (char *) mmap(NULL, numbytes+alignment, PROT_READ|PROT_WRITE,
+                           MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+      return NULL;
+    if (alignment > 0) {
+      slop = (alignment - (uintptr_t)buffer%alignment) % alignment;
+      if (slop > 0)
+        (void) munmap((void *)buffer, slop);
+      if (alignment > slop)
+        (void) munmap((void *)(buffer+slop+numbytes), alignment-slop);
+      buffer += slop;
+#ifdef MADV_HUGEPAGE
+      (void) madvise((void *)buffer, numbytes, MADV_HUGEPAGE);
+      stride = jm_globals.hugepagesize;
+#endif
+    }
+  }
+
+  /* Bind the buffer to a NUMA node before we populate it. */
+  place_slave_buffer(buffer, numbytes);
+
+  /* Divide the buffer among threads, giving each thread a whole
+   * number of pages. */
+  numthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (numthreads < 1 || !jm_original_pthread_create)
+    numthreads = 1;
+  if (numthreads > JM_MAX_POPULATE_THREADS)
+    numthreads = JM_MAX_POPULATE_THREADS;
+  if ((size_t)numthreads > numbytes/stride)
+    numthreads = numbytes/stride > 0 ? (long)(numbytes/stride) : 1;
+  chunkbytes = ((numbytes/stride + numthreads - 1)/numthreads) * stride;
+  jm_debug_printf(4, "Populating %lu bytes of slave memory using %ld thread(s).\n",
+                  numbytes, numthreads);
+  for (i=0; i<numthreads; i++) {
+    work[i].baseaddr = buffer + i*chunkbytes;
+    work[i].numbytes = (size_t)i*chunkbytes >= numbytes ? 0 : numbytes - i*chunkbytes;
+    if (work[i].numbytes > chunkbytes)
+      work[i].numbytes = chunkbytes;
+    started[i] = 0;
+  }
+
+  /* Bypass our pthread_create() wrapper, which would try to acquire
+   * the mega-lock that our caller holds.  Our helper threads neither
+   * fault on JumboMem memory nor call back into JumboMem. */
+  for (i=1; i<numthreads; i++)
+    if (work[i].numbytes > 0
+        && (*jm_original_pthread_create)((void *)&threads[i], NULL,
+                                         (void *)populate_slave_buffer, (void *)&work[i]) == 0)
+      started[i] = 1;
+  (void) populate_slave_buffer((void *)&work[0]);
+  for (i=1; i<numthreads; i++)
+    if (started[i])
+      (void) pthread_join(threads[i], NULL);
+    else if (work[i].numbytes > 0)
+      (void) populate_slave_buffer((void *)&work[i]);
+  return buffer;
+}
+
+
+/* Prepare a divisor for jm_divide() and jm_modulo().  max_dividend is
+ * the largest number that will ever be divided by divisor. */
+void
+jm_initialize_divisor (JUMBOMEM_DIVISOR *div, uint64_t divisor, uint64_t max_dividend)
+{
+  div->divisor = divisor;
+  div->reciprocal = 0;
+  for (div->shift=0; div->shift<64 && ((uint64_t)1<<div->shift) < divisor; div->shift++)
+    ;
+  if (div->shift == 64 || ((uint64_t)1<<div->shift) != divisor) {
+    div->shift = -1;
+    if (divisor <= UINT32_MAX && max_dividend <= UINT32_MAX)
+      div->reciprocal = UINT64_C(0xFFFFFFFFFFFFFFFF)/divisor + 1;
+  }
+}
+
+
 /* Assign backing store to a region of memory. */
 void
 jm_assign_backing_store (char *baseaddr, size_t numbytes, int protflags)
 {
-  /* Map the page using mmap(). */
+  int mapflags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED;   /* Flags to pass to mmap() */
+  int populate_later;      /* 1=populate after setting memory policy; 0=populate with mmap() */
+  size_t touchstride;      /* Number of bytes covered by one OS (or huge) page */
+
+  /* Transparent huge pages and NUMA placement both need to be
+   * requested before the region is populated. */
+  populate_later = jm_globals.hugepages == HUGEPAGES_THP
+    || (jm_globals.numa_policy != NUMA_NONE && jm_globals.numa_nodes > 1);
+  touchstride = jm_globals.hugepages == HUGEPAGES_NONE ? jm_globals.ospagesize : jm_globals.hugepagesize;
+  if (!populate_later)
+    mapflags |= MAP_POPULATE;
+
+  /* Map the page using mmap(), trying the hugetlb pool first if
+   * requested and the memory consists of whole huge pages (region
+   * pages may be smaller).  If the pool is exhausted, fall back to
+   * ordinary pages. */
   JM_RECORD_CYCLE("Calling mmap()");
-  if (mmap((void *)baseaddr, numbytes, protflags,
-           MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_POPULATE, 0, 0) == MAP_FAILED)
+#ifdef MAP_HUGETLB
+  if (jm_globals.hugepages == HUGEPAGES_HUGETLB
+      && (numbytes % jm_globals.hugepagesize != 0
+          || (uintptr_t)baseaddr % jm_globals.hugepagesize != 0))
+    touchstride = jm_globals.ospagesize;
+  else if (jm_globals.hugepages == HUGEPAGES_HUGETLB) {
+    static int warned = 0;   /* 1=we already reported a hugetlb failure */
+    int hugeflags = mapflags|MAP_HUGETLB;   /* mapflags plus huge-page flags */
+# ifdef MAP_HUGE_SHIFT
+    int log2size;            /* log2(jm_globals.hugepagesize) */
+
+    for (log2size=0; ((size_t)1<<log2size) < jm_globals.hugepagesize; log2size++)
+      ;
+    hugeflags |= log2size << MAP_HUGE_SHIFT;
+# endif
+    if (mmap((void *)baseaddr, numbytes, populate_later ? PROT_READ|PROT_WRITE : protflags,
+             hugeflags, 0, 0) != MAP_FAILED)
+      goto mapped;
+    if (!warned) {
+      jm_debug_printf(2, "Failed to map %lu bytes from the hugetlb pool (%s); using ordinary pages.\n",
+                      numbytes, jm_strerror(errno));
+      warned = 1;
+    }
+    touchstride = jm_globals.ospagesize;
+  }
+#endif
+  if (mmap((void *)baseaddr, numbytes, populate_later ? PROT_READ|PROT_WRITE : protflags,
+           mapflags, 0, 0) == MAP_FAILED)
     jm_abort("Failed to assign backing store to %lu bytes of address space (%s)",
              numbytes, jm_strerror(errno));
+#ifdef MAP_HUGETLB
+ mapped:
+#endif
   JM_RECORD_CYCLE("Called mmap()");
 
+  /* Apply our huge-page and NUMA policies then populate the region. */
+  if (populate_later) {
+#ifdef MADV_HUGEPAGE
+    if (jm_globals.hugepages == HUGEPAGES_THP)
+      (void) madvise((void *)baseaddr, numbytes, MADV_HUGEPAGE);
+#endif
+    jm_set_numa_policy(baseaddr, numbytes, jm_globals.numa_policy, -1);
+#ifdef MADV_POPULATE_WRITE
+    if (madvise((void *)baseaddr, numbytes, MADV_POPULATE_WRITE) == -1)
+#endif
+    {
+      size_t i;
+
+      for (i=0; i<numbytes; i+=touchstride)
+        ((volatile char *)baseaddr)[i] = 0;
+    }
+    if (protflags != (PROT_READ|PROT_WRITE)
+        && mprotect((void *)baseaddr, numbytes, protflags) == -1)
+      jm_abort("Failed to set the protection of %lu bytes of address space (%s)",
+               numbytes, jm_strerror(errno));
+    JM_RECORD_CYCLE("Populated the page");
+  }
+
   /* Attempt to lock the page in memory using mlock(), ignoring errors. */
   JM_RECORD_CYCLE("Calling mlock()");
   if (jm_mlock ((void *)baseaddr, numbytes) == -1)
@@ -0,0 +1,310 @@
+/*------------------------------------------------------------
+ * JumboMem memory server: Page-copy engine
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+/*
+ * Copying a JumboMem page with memcpy() drags the entire page through
+ * the cache, evicting the program's working set.  On x86 processors we
+ * instead copy large pages with non-temporal (streaming) stores, using
+ * the widest vector kernel the CPU supports.  Very large pages can
+ * additionally be split across helper threads.
+ */
+
+#include "jumbomem.h"
+#include <pthread.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define JM_HAVE_STREAMING_COPY
+#endif
+
+/* Define the smallest copy for which streaming stores are worthwhile.
+ * Smaller copies are likely to be read again while still cached. */
+#ifndef JM_STREAMING_THRESHOLD
+# define JM_STREAMING_THRESHOLD 65536
+#endif
+
+/* Define the smallest amount of data worth handing to a helper thread. */
+#ifndef JM_COPY_CHUNK_MIN
+# define JM_COPY_CHUNK_MIN 1048576
+#endif
+
+/* Define the maximum number of threads that can cooperate on a copy. */
+#ifndef JM_MAX_COPY_THREADS
+# define JM_MAX_COPY_THREADS 16
+#endif
+
+/* Describe one thread's share of a copy. */
+typedef struct {
+  char *target;            /* Destination address */
+  const char *source;      /* Source address */
+  size_t numbytes;         /* Number of bytes to copy */
+} COPY_WORK;
+
+extern JUMBOMEM_GLOBALS jm_globals;     /* All of our global variables */
+extern int (*jm_original_pthread_create)(void *, void *, void *, void *);
+static void (*copy_kernel)(char *, const char *, size_t);  /* Kernel selected at initialization time */
+static const char *kernel_name = "memcpy";   /* Name of the above */
+static int numthreads = 1;                   /* Number of threads (including ourself) that copy a page */
+static COPY_WORK work[JM_MAX_COPY_THREADS];  /* Each thread's share of the current copy */
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;   /* Protects the following */
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;    /* Signaled when new work is posted */
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;     /* Signaled when a helper finishes */
+static unsigned long generation = 0;         /* Number of copies posted to the helpers */
+static int helpers_busy = 0;                 /* Number of helpers still copying */
+
+
+/* Copy using the C library. */
+static void
+copy_with_memcpy (char *target, const char *source, size_t numbytes)
+{
+  memcpy((void *)target, (const void *)source, numbytes);
+}
+
+
+#ifdef JM_HAVE_STREAMING_COPY
+/* Copy using SSE2 streaming stores.  target must be 16-byte aligned. */
+__attribute__ ((target("sse2")))
+static void
+copy_with_sse2 (char *target, const char *source, size_t numbytes)
+{
+  size_t i;
+
+  for (i=0; i+64<=numbytes; i+=64) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *)(source+i));
+    __m128i v1 = _mm_loadu_si128((const __m128i *)(source+i+16));
+    __m128i v2 = _mm_loadu_si128((const __m128i *)(source+i+32));
+    __m128i v3 = _mm_loadu_si128((const __m128i *)(source+i+48));
+    _mm_stream_si128((__m128i *)(target+i), v0);
+    _mm_stream_si128((__m128i *)(target+i+16), v1);
+    _mm_stream_si128((__m128i *)(target+i+32), v2);
+    _mm_stream_si128((__m128i *)(target+i+48), v3);
+  }
+  _mm_sfence();
+  if (i < numbytes)
+    memcpy((void *)(target+i), (const void *)(source+i), numbytes-i);
+}
+
+
+/* Copy using AVX2 streaming stores.  target must be 32-byte aligned. */
+__attribute__ ((target("avx2")))
+static void
+copy_with_avx2 (char *target, const char *source, size_t numbytes)
+{
+  size_t i;
+
+  for (i=0; i+128<=numbytes; i+=128) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)(source+i));
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(source+i+32));
+    __m256i v2 = _mm256_loadu_si256((const __m256i *)(source+i+64));
+    __m256i v3 = _mm256_loadu_si256((const __m256i *)(source+i+96));
+    _mm256_stream_si256((__m256i *)(target+i), v0);
+    _mm256_stream_si256((__m256i *)(target+i+32), v1);
+    _mm256_stream_si256((__m256i *)(target+i+64), v2);
+    _mm256_stream_si256((__m256i *)(target+i+96), v3);
+  }
+  _mm_sfence();
+  if (i < numbytes)
+    memcpy((void *)(target+i), (const void *)(source+i), numbytes-i);
+}
+
+
+/* Copy using AVX-512 streaming stores.  target must be 64-byte aligned. */
+__attribute__ ((target("avx512f")))
+static void
+copy_with_avx512 (char *target, const char *source, size_t numbytes)
+{
+  size_t i;
+
+  for (i=0; i+256<=numbytes; i+=256) {
+    __m512i v0 = _mm512_loadu_si512((const void *)(source+i));
+    __m512i v1 = _mm512_loadu_si512((const void *)(source+i+64));
+    __m512i v2 = _mm512_loadu_si512((const void *)(source+i+128));
+    __m512i v3 = _mm512_loadu_si512((const void *)(source+i+192));
+    _mm512_stream_si512((void *)(target+i), v0);
+    _mm512_stream_si512((void *)(target+i+64), v1);
+    _mm512_stream_si512((void *)(target+i+128), v2);
+    _mm512_stream_si512((void *)(target+i+192), v3);
+  }
+  _mm_sfence();
+  if (i < numbytes)
+    memcpy((void *)(target+i), (const void *)(source+i), numbytes-i);
+}
+#endif
+
+
+/* Copy one share of a page. */
+static void
+copy_share (COPY_WORK *share)
+{
+  if (share->numbytes >= JM_STREAMING_THRESHOLD && ((uintptr_t)share->target & 63) == 0)
+    copy_kernel(share->target, share->source, share->numbytes);
+  else
+    memcpy((void *)share->target, (const void *)share->source, share->numbytes);
+}
+
+
+/* Repeatedly wait for a share of a copy then perform it.  Helpers
+ * never touch JumboMem-managed memory that isn't already mapped and
+ * never call back into JumboMem. */
+static void *
+copy_helper_main (void *arg)
+{
+  int me = (int)(intptr_t)arg;         /* Index into work[] */
+  unsigned long seen = 0;              /* Last generation we processed */
+
+  while (1) {
+    pthread_mutex_lock(&work_lock);
+    while (generation == seen)
+      pthread_cond_wait(&work_ready, &work_lock);
+    seen = generation;
+    pthread_mutex_unlock(&work_lock);
+    copy_share(&work[me]);
+    pthread_mutex_lock(&work_lock);
+    if (--helpers_busy == 0)
+      pthread_cond_signal(&work_done);
+    pthread_mutex_unlock(&work_lock);
+  }
+  return NULL;
+}
+
+
+/* Copy numbytes bytes from source to target, bypassing the cache
+ * when possible.  This is intended for copying entire JumboMem pages
+ * and is not reentrant. */
+void
+jm_copy_page (char *target, const char *source, size_t numbytes)
+{
+  int sharers;            /* Number of threads sharing the copy */
+  size_t sharebytes;      /* Bytes per thread (a multiple of 4KB) */
+  int i;
+
+  /* Determine how many threads should share the copy. */
+  sharers = numthreads;
+  if ((size_t)sharers > numbytes/JM_COPY_CHUNK_MIN)
+    sharers = (int)(numbytes/JM_COPY_CHUNK_MIN);
+  if (sharers <= 1) {
+    work[0].target = target;
+    work[0].source = source;
+    work[0].numbytes = numbytes;
+    copy_share(&work[0]);
+    return;
+  }
+
+  /* Divide the copy into 4KB-aligned shares and wake the helpers. */
+  sharebytes = ((numbytes/sharers + 4095)/4096) * 4096;
+  for (i=0; i<numthreads; i++) {
+    size_t offset = (size_t)i*sharebytes;
+
+    work[i].target = target + offset;
+    work[i].source = source + offset;
+    if (i >= sharers || offset >= numbytes)
+      work[i].numbytes = 0;
+    else
+      work[i].numbytes = numbytes-offset < sharebytes ? numbytes-offset : sharebytes;
+  }
+  pthread_mutex_lock(&work_lock);
+  helpers_busy = numthreads - 1;
+  generation++;
+  pthread_cond_broadcast(&work_ready);
+  pthread_mutex_unlock(&work_lock);
+
+  /* Copy our own share then wait for the helpers to finish theirs. */
+  copy_share(&work[0]);
+  pthread_mutex_lock(&work_lock);
+  while (helpers_busy > 0)
+    pthread_cond_wait(&work_done, &work_lock);
+  pthread_mutex_unlock(&work_lock);
+}
+
+
+/* Select a copy kernel and start any helper threads. */
+void
+jm_initialize_page_copy (void)
+{
+  const char *kernel_string = getenv("JM_PAGECOPY");   /* Requested kernel */
+  int i;
+
+  /* Select the kernel to use, either automatically or by name. */
+  if (!kernel_string)
+    kernel_string = "auto";
+  copy_kernel = copy_with_memcpy;
+  kernel_name = "memcpy";
+#ifdef JM_HAVE_STREAMING_COPY
+  __builtin_cpu_init();
+  if (!strcmp(kernel_string, "auto")) {
+    if (__builtin_cpu_supports("avx512f")) {
+      copy_kernel = copy_with_avx512;
+      kernel_name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2")) {
+      copy_kernel = copy_with_avx2;
+      kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+      copy_kernel = copy_with_sse2;
+      kernel_name = "sse2";
+    }
+  }
+  else if (!strcmp(kernel_string, "avx512") && __builtin_cpu_supports("avx512f")) {
+    copy_kernel = copy_with_avx512;
+    kernel_name = "avx512";
+  }
+  else if (!strcmp(kernel_string, "avx2") && __builtin_cpu_supports("avx2")) {
+    copy_kernel = copy_with_avx2;
+    kernel_name = "avx2";
+  }
+  else if (!strcmp(kernel_string, "sse2") && __builtin_cpu_supports("sse2")) {
+    copy_kernel = copy_with_sse2;
+    kernel_name = "sse2";
+  }
+  else
+#endif
+  if (strcmp(kernel_string, "memcpy") && strcmp(kernel_string, "auto"))
+    jm_debug_printf(1, "WARNING: Page-copy kernel \"%s\" is not available; using memcpy().\n",
+                    kernel_string);
+
+  /* Start the helper threads.  We bypass our pthread_create() wrapper
+   * because we may be called with the mega-lock held. */
+  if ((numthreads=jm_getenv_positive_int("JM_COPY_THREADS")) < 1)
+    numthreads = 1;
+  if (numthreads > JM_MAX_COPY_THREADS)
+    numthreads = JM_MAX_COPY_THREADS;
+  if (!jm_original_pthread_create)
+    numthreads = 1;
+  for (i=1; i<numthreads; i++) {
+    pthread_t helper;     /* Helper thread */
+
+    if ((*jm_original_pthread_create)((void *)&helper, NULL, (void *)copy_helper_main,
+                                      (void *)(intptr_t)i) != 0) {
+      jm_debug_printf(2, "WARNING: Started only %d of %d page-copy threads.\n", i, numthreads);
+      numthreads = i;
+      break;
+    }
+  }
+  jm_debug_printf(3, "Copying pages with %s using %d thread(s).\n", kernel_name, numthreads);
+}
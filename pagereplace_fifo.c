@@ -33,7 +33,7 @@ extern JUMBOMEM_GLOBALS jm_globals;     /* All of our global variables */
 static uint32_t *used_pages;            /* Set of page numbers in use */
 static unsigned long num_used;          /* Number of valid entries in the above */
 static unsigned long total_pages;       /* Size of the virtual address space in pages */
-static unsigned long next_evict;        /* Next page number to evict */
+static unsigned long next_evict;        /* Index into used_pages[] of the next page to evict */
 
 
 /* Initialize the FIFO algorithm. */
@@ -51,6 +51,8 @@ jm_initialize_pagereplace (void)
                   total_pages,
                   jm_format_power_of_2((uint64_t)total_pages*jm_globals.pagesize, 1));
   jm_globals.prefetch_type = PREFETCH_NONE;   /* Our jm_page_is_resident() does not currently return the values needed for prefetching. */
+  jm_globals.prefetch_auto = 0;
+  jm_globals.prefetch_depth = 0;
 }
 
 
@@ -82,12 +84,14 @@ jm_find_replacement_page(char *faulted_page, int *newprot, char **evictable_page
   *newprot = PROT_READ|PROT_WRITE;
   *clean = 0;
 
-  /* Early in the run we won't need to evict anything. */
-  if (num_used < total_pages) {
+  /* Early in the run we won't need to evict anything.  (used_pages[]
+   * is a circular queue with its head at next_evict.) */
+  if (num_used < jm_globals.local_page_target) {
     /* We haven't yet filled physical memory so we don't need to evict
      * anything. */
     *evictable_page = NULL;
-    used_pages[num_used++] = (uint32_t) GET_PAGE_NUMBER(faulted_page);
+    used_pages[(next_evict+num_used)%total_pages] = (uint32_t) GET_PAGE_NUMBER(faulted_page);
+    num_used++;
     jm_debug_printf(4, "%lu/%lu pages are now in use.\n", num_used, total_pages);
     return;
   }
@@ -97,11 +101,53 @@ jm_find_replacement_page(char *faulted_page, int *newprot, char **evictable_page
 
   /* Keep track of the page we're about to bring in and the page we're
    * about to kick out. */
-  used_pages[next_evict] = (uint32_t) GET_PAGE_NUMBER(faulted_page);
+  used_pages[(next_evict+num_used)%total_pages] = (uint32_t) GET_PAGE_NUMBER(faulted_page);
   next_evict = (next_evict+1) % total_pages;
 }
 
 
+/* Select the oldest page to evict without replacement if the local
+ * cache target was lowered below the number of pages in use. */
+int
+jm_find_surplus_page (char **evictable_page, int *clean)
+{
+  if (num_used <= jm_globals.local_page_target)
+    return 0;
+  *evictable_page = jm_globals.memregion + used_pages[next_evict]*jm_globals.pagesize;
+  *clean = 0;
+  next_evict = (next_evict+1) % total_pages;
+  num_used--;
+  jm_debug_printf(4, "Shrinking to %lu/%lu pages.\n", num_used, total_pages);
+  return 1;
+}
+
+
+
+/* Releasing a particular page would require a linear search through
+ * used_pages[] so we decline to do so. */
+int
+jm_release_page (char *rounded_addr JM_UNUSED, int *clean JM_UNUSED)
+{
+  return 0;
+}
+
+
+/* Every page is assumed to be dirty. */
+int
+jm_pagereplace_reports_clean (void)
+{
+  return 0;
+}
+
+
+/* FIFO page replacement has no run-time parameters. */
+const char *
+jm_set_pagereplace_parameter (const char *envvar JM_UNUSED, unsigned long value JM_UNUSED)
+{
+  return "FIFO page replacement has no adjustable parameters";
+}
+
+
 /* Finalize the FIFO algorithm. */
 void
 jm_finalize_pagereplace (void)
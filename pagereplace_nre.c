@@ -68,6 +68,8 @@ jm_initialize_pagereplace (void)
                   total_pages,
                   jm_format_power_of_2((uint64_t)total_pages*jm_globals.pagesize, 1));
   jm_globals.prefetch_type = PREFETCH_NONE;   /* Our jm_page_is_resident() does not currently return the values needed for prefetching. */
+  jm_globals.prefetch_auto = 0;
+  jm_globals.prefetch_depth = 0;
   if ((evict_len=jm_getenv_nonnegative_int("JM_NRE_ENTRIES")) == (unsigned long)(-1))
     evict_len = DEFAULT_EVICT_COUNT;
   if ((max_retries=jm_getenv_nonnegative_int("JM_NRE_RETRIES")) == (unsigned long)(-1))
@@ -101,6 +103,10 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
 {
   size_t randnum;         /* A random offset into used_pages[] */
   unsigned long retries;  /* Number of attempts so far to find a good replacement */
+  size_t candidates[JM_VICTIM_CANDIDATES];    /* Good offsets to choose among */
+  char *candidate_addrs[JM_VICTIM_CANDIDATES];  /* Addresses of the above */
+  int candidate_clean[JM_VICTIM_CANDIDATES];    /* Cleanliness of the above (always dirty) */
+  unsigned int numcandidates;   /* Number of valid entries in the above */
 
   /* New pages are always marked read/write and old pages are always
    * considered dirty. */
@@ -108,7 +114,7 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
   *clean = 0;
 
   /* Early in the run we won't need to evict anything. */
-  if (num_used < total_pages) {
+  if (num_used < jm_globals.local_page_target) {
     /* We haven't yet filled physical memory so we don't need to evict
      * anything. */
     *evictable_page = NULL;
@@ -119,9 +125,12 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
   }
 
   /* Later in the run we need to find a replacement page.  We choose a
-   * page at random but try again if we hit a page we've recently evicted. */
+   * page at random but try again if we hit a page we've recently
+   * evicted.  Of the first few good choices, we take whichever is
+   * cheapest to evict. */
   retries = 0;
-  while (retries <= max_retries) {
+  numcandidates = 0;
+  while (retries <= max_retries && numcandidates < JM_VICTIM_CANDIDATES) {
     uint32_t pagenum;      /* Page number to evict */
     unsigned long i;
 
@@ -136,13 +145,22 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
         retries++;
 	break;
       }
-    if (evicted_pages[i] != randnum)
+    if (evicted_pages[i] != randnum) {
       /* The current selection is a good one. */
-      break;
-    if (retries <= max_retries)
+      candidate_addrs[numcandidates] = *evictable_page;
+      candidate_clean[numcandidates] = 0;
+      candidates[numcandidates++] = randnum;
+    }
+    else if (retries <= max_retries)
       jm_debug_printf(5, "The page at address %p was recently evicted.  Selecting alternate #%lu.\n",
 		      *evictable_page, retries);
   }
+  if (numcandidates > 0) {
+    unsigned int best = numcandidates == 1 ? 0 : jm_cheapest_victim(candidate_addrs, candidate_clean, numcandidates, faulted_page);
+
+    randnum = candidates[best];
+    *evictable_page = candidate_addrs[best];
+  }
   evicted_pages[evict_tail] = randnum;
   evict_tail = (evict_tail+1) % evict_len;
   if (evict_tail == evict_head)
@@ -157,6 +175,73 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
 }
 
 
+/* Select a page to evict without replacement if the local cache
+ * target was lowered below the number of pages in use. */
+int
+jm_find_surplus_page (char **evictable_page, int *clean)
+{
+  size_t randnum;         /* A random offset into the page table */
+  uint32_t pagenum;       /* Page number to evict */
+
+  if (num_used <= jm_globals.local_page_target)
+    return 0;
+  randnum = ((random() + BIGPRIME1) * BIGPRIME2) % num_used;
+  jm_page_table_offset(page_table, randnum, &pagenum, NULL);
+  *evictable_page = jm_globals.memregion + pagenum*jm_globals.pagesize;
+  *clean = 0;
+  jm_page_table_remove(page_table, *evictable_page);
+  num_used--;
+  jm_debug_printf(4, "Shrinking to %lu/%lu pages (address %p).\n",
+                  num_used, total_pages, *evictable_page);
+  return 1;
+}
+
+
+
+/* Stop caching a given page so the caller can evict it. */
+int
+jm_release_page (char *rounded_addr, int *clean)
+{
+  if (!jm_page_table_find(page_table, rounded_addr))
+    return 0;
+  *clean = 0;
+  jm_page_table_remove(page_table, rounded_addr);
+  num_used--;
+  jm_debug_printf(4, "Releasing page %p (%lu/%lu pages remain in use).\n",
+                  rounded_addr, num_used, total_pages);
+  return 1;
+}
+
+/* Every page is assumed to be dirty. */
+int
+jm_pagereplace_reports_clean (void)
+{
+  return 0;
+}
+
+
+/* Change JM_NRE_ENTRIES or JM_NRE_RETRIES while the program is running. */
+const char *
+jm_set_pagereplace_parameter (const char *envvar, unsigned long value)
+{
+  if (!strcmp(envvar, "JM_NRE_RETRIES")) {
+    max_retries = value;
+    return NULL;
+  }
+  if (!strcmp(envvar, "JM_NRE_ENTRIES")) {
+    if (value < 1)
+      return "JM_NRE_ENTRIES must be a positive integer";
+    evicted_pages = (uint32_t *) jm_realloc(evicted_pages, value*sizeof(uint32_t));
+    evict_len = value;
+    evict_head = 0;
+    evict_tail = 0;
+    evicted_pages[0] = (uint32_t)(-1);
+    return NULL;
+  }
+  return "Not a parameter of NRE page replacement";
+}
+
+
 /* Finalize the random algorithm. */
 void
 jm_finalize_pagereplace (void)
@@ -211,6 +211,62 @@ maybe_clear_reference_bits (void)
 }
 
 
+/* Randomly select a few pages from the smallest-numbered nonempty NRU
+ * class and return whichever is cheapest to evict while faulted_page
+ * (which may be NULL) is fetched.  Also return the page's class. */
+static PAGE_TABLE_ENTRY *
+select_victim (int *victim_class, char *faulted_page)
+{
+  int class;                   /* NRU class from which to select a page */
+  long int random_offset;      /* Random offset into pages_by_class */
+  PAGE_TABLE_ENTRY *pframe;    /* Selected page frame */
+  PAGE_TABLE_ENTRY *candidates[JM_VICTIM_CANDIDATES];   /* Page frames to choose among */
+  char *candidate_addrs[JM_VICTIM_CANDIDATES];  /* Addresses of the above */
+  int candidate_clean[JM_VICTIM_CANDIDATES];    /* 1=the corresponding page is clean */
+  unsigned int numcandidates;  /* Number of valid entries in the above */
+  unsigned int i;
+
+  /* Find the smallest-numbered nonempty class.  Class sizes are
+   * computed only when sorting so sort if we haven't done so yet. */
+  for (class=0; class<4 && class_size[class]==0; class++)
+    ;
+  if (class == 4) {
+    sort_pages_by_class();
+    for (class=0; class<4 && class_size[class]==0; class++)
+      ;
+  }
+
+  /* Because pages_by_class is probably nearly sorted, for speed we
+   * simply select a random page from what should be the desired
+   * class.  Only if the page has the wrong class do we sort the
+   * array and try again. */
+  random_offset = ((random() + BIGPRIME1) * BIGPRIME2) % class_size[class];
+  pframe = pages_by_class[random_offset];
+  if (NRU_CLASS(pframe) != class) {
+    sort_pages_by_class();
+    pframe = pages_by_class[random_offset];
+  }
+  *victim_class = class;
+
+  /* Pages within a class are equally good victims, but some are
+   * cheaper to evict than others. */
+  candidates[0] = pframe;
+  numcandidates = 1;
+  for (i=1; i<JM_VICTIM_CANDIDATES && i<class_size[class]; i++) {
+    random_offset = ((random() + BIGPRIME1) * BIGPRIME2) % class_size[class];
+    if (NRU_CLASS(pages_by_class[random_offset]) == class)
+      candidates[numcandidates++] = pages_by_class[random_offset];
+  }
+  if (numcandidates == 1)
+    return pframe;
+  for (i=0; i<numcandidates; i++) {
+    candidate_addrs[i] = jm_globals.memregion + jm_globals.pagesize*candidates[i]->pagenum;
+    candidate_clean[i] = !candidates[i]->modified;
+  }
+  return candidates[jm_cheapest_victim(candidate_addrs, candidate_clean, numcandidates, faulted_page)];
+}
+
+
 /* Initialize the NRU algorithm. */
 void
 jm_initialize_pagereplace (void)
@@ -305,7 +361,7 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
   maybe_clear_reference_bits();
 
   /* If the page table isn't full we don't need to evict anything. */
-  if (num_used < total_pages) {
+  if (num_used < jm_globals.local_page_target) {
     pframe = &used_pages[num_used];
     pages_by_class[num_used] = pframe;
     num_used++;
@@ -315,22 +371,7 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
   else {
     /* Randomly select a page to evict from the smallest-numbered
      * nonempty NRU class. */
-    long int random_offset;      /* Random offset into pages_by_class */
-
-    /* Find the smallest-numbered nonempty class. */
-    for (class=0; class<4 && class_size[class]==0; class++)
-      ;
-
-    /* Because pages_by_class is probably nearly sorted, for speed we
-     * simply select a random page from what should be the desired
-     * class.  Only if the page has the wrong class do we sort the
-     * array and try again. */
-    random_offset = ((random() + BIGPRIME1) * BIGPRIME2) % class_size[class];
-    pframe = pages_by_class[random_offset];
-    if (NRU_CLASS(pframe) != class) {
-      sort_pages_by_class();
-      pframe = pages_by_class[random_offset];
-    }
+    pframe = select_victim(&class, faulted_page);
 
     /* Map the page frame number to a byte offset into the memory region. */
     *evictable_page = jm_globals.memregion + jm_globals.pagesize*pframe->pagenum;
@@ -359,6 +400,128 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
 }
 
 
+/* Stop tracking a resident page frame.  Its page must be the
+ * caller's to evict. */
+static void
+remove_page_frame (PAGE_TABLE_ENTRY *pframe)
+{
+  PAGE_TABLE_ENTRY *last;      /* Final page frame in use */
+  unsigned long pframe_slot = 0;  /* Index into pages_by_class of pframe */
+  unsigned long last_slot = 0;    /* Index into pages_by_class of last */
+  unsigned long i;
+
+  delete_page_by_number(pframe->pagenum);
+  jm_free(dead_bucket);
+  dead_bucket = NULL;
+
+  /* Find the page frame's entry in pages_by_class and that of the
+   * final page frame, which is about to move. */
+  last = &used_pages[num_used - 1];
+  for (i=0; i<num_used; i++) {
+    if (pages_by_class[i] == pframe)
+      pframe_slot = i;
+    if (pages_by_class[i] == last)
+      last_slot = i;
+  }
+  if (class_size[NRU_CLASS(pframe)] > 0)
+    class_size[NRU_CLASS(pframe)]--;
+
+  /* Move the final page frame into the vacated slot so used_pages[]
+   * remains contiguous. */
+  if (pframe != last) {
+    struct page_bucket *bucket;  /* Bucket pointing to the final page frame */
+
+    for (bucket=page_table[hash_page_number(last->pagenum)];
+         bucket->pte != last;
+         bucket=bucket->next)
+      ;
+    *pframe = *last;
+    bucket->pte = pframe;
+    pages_by_class[last_slot] = pframe;
+  }
+
+  /* Drop the page frame's entry from pages_by_class.  select_victim()
+   * re-sorts the list when it needs to. */
+  pages_by_class[pframe_slot] = pages_by_class[num_used - 1];
+  num_used--;
+  sorted_by_class = 0;
+
+  /* The page may have changed class since the last sort.  If the
+   * class sizes now overstate the number of pages, zero them so
+   * select_victim() can't index past the final entry. */
+  if (class_size[0] + class_size[1] + class_size[2] + class_size[3] > num_used)
+    class_size[0] = class_size[1] = class_size[2] = class_size[3] = 0;
+}
+
+
+/* Select a page to evict without replacement if the local cache
+ * target was lowered below the number of pages in use. */
+int
+jm_find_surplus_page (char **evictable_page, int *clean)
+{
+  int class;                   /* NRU class of the selected page */
+  PAGE_TABLE_ENTRY *pframe;    /* Page frame to evict */
+
+  if (num_used <= jm_globals.local_page_target)
+    return 0;
+  maybe_clear_reference_bits();
+  pframe = select_victim(&class, NULL);
+  *evictable_page = jm_globals.memregion + jm_globals.pagesize*pframe->pagenum;
+  *clean = !pframe->modified;
+#ifdef JM_DEBUG
+  replacement_classes[class]++;
+#endif
+  remove_page_frame(pframe);
+  jm_debug_printf(4, "Shrinking to %lu/%lu pages (a class %d page).\n",
+                  num_used, total_pages, class);
+  return 1;
+}
+
+
+/* Stop caching a given page so the caller can evict it. */
+int
+jm_release_page (char *rounded_addr, int *clean)
+{
+  PAGE_TABLE_ENTRY *pframe;    /* Page frame to release */
+
+  if (!(pframe=find_page_by_number((uint32_t) GET_PAGE_NUMBER(rounded_addr))))
+    return 0;
+  *clean = !pframe->modified;
+  remove_page_frame(pframe);
+  jm_debug_printf(4, "Releasing page %p (%lu/%lu pages remain in use).\n",
+                  rounded_addr, num_used, total_pages);
+  return 1;
+}
+
+
+/* Only pages loaded read-only can be known to be clean. */
+int
+jm_pagereplace_reports_clean (void)
+{
+  return !nru_readwrite;
+}
+
+
+/* Change JM_NRU_INTERVAL or JM_NRU_RW while the program is running. */
+const char *
+jm_set_pagereplace_parameter (const char *envvar, unsigned long value)
+{
+  if (!strcmp(envvar, "JM_NRU_INTERVAL")) {
+    if (value < 1)
+      return "JM_NRU_INTERVAL must be a positive integer";
+    nru_interval_ms = value;
+    return NULL;
+  }
+  if (!strcmp(envvar, "JM_NRU_RW")) {
+    if (value > 1)
+      return "JM_NRU_RW must be a boolean value";
+    nru_readwrite = (int) value;
+    return NULL;
+  }
+  return "Not a parameter of NRU page replacement";
+}
+
+
 /* Finalize the NRU algorithm. */
 void
 jm_finalize_pagereplace (void)
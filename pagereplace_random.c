@@ -58,6 +58,8 @@ jm_initialize_pagereplace (void)
                   total_pages,
                   jm_format_power_of_2((uint64_t)total_pages*jm_globals.pagesize, 1));
   jm_globals.prefetch_type = PREFETCH_NONE;   /* Our jm_page_is_resident() does not currently return the values needed for prefetching. */
+  jm_globals.prefetch_auto = 0;
+  jm_globals.prefetch_depth = 0;
 }
 
 
@@ -92,7 +94,7 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
   *clean = 0;
 
   /* Early in the run we won't need to evict anything. */
-  if (num_used < total_pages) {
+  if (num_used < jm_globals.local_page_target) {
     /* We haven't yet filled physical memory so we don't need to evict
      * anything. */
     *evictable_page = NULL;
@@ -117,6 +119,50 @@ jm_find_replacement_page (char *faulted_page, int *newprot, char **evictable_pag
 }
 
 
+/* Select a page to evict without replacement if the local cache
+ * target was lowered below the number of pages in use. */
+int
+jm_find_surplus_page (char **evictable_page, int *clean)
+{
+  size_t randnum;      /* A random offset into used_pages[] */
+
+  if (num_used <= jm_globals.local_page_target)
+    return 0;
+  randnum = ((random() + BIGPRIME1) * BIGPRIME2) % num_used;
+  *evictable_page = jm_globals.memregion + used_pages[randnum]*jm_globals.pagesize;
+  *clean = 0;
+  used_pages[randnum] = used_pages[--num_used];
+  jm_debug_printf(4, "Shrinking to %lu/%lu pages.\n", num_used, total_pages);
+  return 1;
+}
+
+
+
+/* Releasing a particular page would require a linear search through
+ * used_pages[] so we decline to do so. */
+int
+jm_release_page (char *rounded_addr JM_UNUSED, int *clean JM_UNUSED)
+{
+  return 0;
+}
+
+
+/* Every page is assumed to be dirty. */
+int
+jm_pagereplace_reports_clean (void)
+{
+  return 0;
+}
+
+
+/* Random page replacement has no run-time parameters. */
+const char *
+jm_set_pagereplace_parameter (const char *envvar JM_UNUSED, unsigned long value JM_UNUSED)
+{
+  return "Random page replacement has no adjustable parameters";
+}
+
+
 /* Finalize the random algorithm. */
 void
 jm_finalize_pagereplace (void)
@@ -225,6 +225,34 @@ jm_page_table_delete (void *pt_obj, char *address)
 }
 
 
+/* Delete a page from the page table when no insertion will follow.
+ * To keep the used PTEs contiguous, we move the last PTE into the
+ * vacated slot and discard the detached bucket. */
+void
+jm_page_table_remove (void *pt_obj, char *address)
+{
+  PAGE_TABLE *pt = (PAGE_TABLE *)pt_obj;  /* The page table proper */
+  PAGE_TABLE_ENTRY *vacated;              /* PTE that was just deleted */
+  PAGE_TABLE_ENTRY *last;                 /* Final PTE in use */
+  struct page_bucket *bucket;             /* Bucket pointing to the final PTE */
+
+  delete_page_by_number(pt, GET_PAGE_NUMBER(address));
+  vacated = pt->dead_bucket->pte;
+  jm_free(pt->dead_bucket);
+  pt->dead_bucket = NULL;
+  pt->num_used--;
+  last = &USED_PAGES(pt->num_used);
+  if (vacated == last)
+    return;
+  for (bucket=pt->page_hash[hash_page_number(last->pagenum)];
+       bucket->pte != last;
+       bucket=bucket->next)
+    ;
+  memcpy((void *)vacated, (void *)last, sizeof(PAGE_TABLE_ENTRY)+pt->payload_bytes);
+  bucket->pte = vacated;
+}
+
+
 /* Given a page's address, return a pointer to that page's payload
  * data or NULL if the page isn't resident. */
 void *
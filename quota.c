@@ -0,0 +1,343 @@
+/*------------------------------------------------------------
+ * JumboMem memory server: Per-range cache quotas
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+/*
+ * A cache quota bounds the number of pages of a range of the global
+ * address space that the master caches.  Its maximum keeps a large,
+ * streamed array from flushing everything else out of the cache: once
+ * the range holds its maximum, each new page of the range replaces
+ * the range's own oldest page instead of a page from elsewhere.  Its
+ * minimum reserves a share of the cache for a hot index: the
+ * page-replacement module passes over the range's pages while the
+ * range holds no more than its minimum.
+ *
+ * Quotas are set with jmu_cache_quota(), typically on the memory
+ * returned by a particular allocation.  The maximum requires a
+ * page-replacement module that can release a given page (NRE or NRU),
+ * and the minimum requires one that chooses among several candidate
+ * victims (likewise NRE or NRU).
+ */
+
+#include "jumbomem.h"
+
+/* Define the maximum number of ranges that can have a quota. */
+#ifndef JM_MAX_QUOTAS
+# define JM_MAX_QUOTAS 16
+#endif
+
+/* Describe a single range's quota. */
+typedef struct {
+  char *start;               /* First page in the range */
+  char *end;                 /* Address past the last page in the range */
+  unsigned long min_pages;   /* Number of pages reserved for the range */
+  unsigned long max_pages;   /* Maximum number of pages to cache (0=unlimited) */
+  unsigned long resident;    /* Number of the range's pages currently cached */
+  char **recent;             /* Ring buffer of the range's cached pages, oldest first */
+  unsigned long ringsize;    /* Number of entries allocated for the above */
+  unsigned long head;        /* Index into recent[] of the oldest page */
+  unsigned long count;       /* Number of valid entries in recent[] */
+  unsigned long overflows;   /* Number of pages evicted to stay within max_pages */
+  unsigned long intrusions;  /* Number of pages evicted while at or below min_pages */
+  unsigned long misses;      /* Number of times recent[] held none of the range's cached pages */
+} JUMBOMEM_QUOTA;
+
+static JUMBOMEM_QUOTA quotas[JM_MAX_QUOTAS];
+static unsigned int numquotas = 0;     /* Number of entries used in quotas[] */
+
+/* ---------------------------------------------------------------------- */
+
+/* Return the quota that covers a given page or NULL if none does. */
+static inline JUMBOMEM_QUOTA *
+find_quota (char *rounded_addr)
+{
+  unsigned int i;
+
+  for (i=0; i<numquotas; i++)
+    if (rounded_addr >= quotas[i].start && rounded_addr < quotas[i].end)
+      return &quotas[i];
+  return NULL;
+}
+
+
+/* Discard the entries of a quota's ring buffer that refer to pages
+ * no longer cached, which global page replacement leaves behind. */
+static void
+compact_ring (JUMBOMEM_QUOTA *quota)
+{
+  unsigned long kept = 0;    /* Number of entries retained */
+  unsigned long i;
+
+  for (i=0; i<quota->count; i++) {
+    char *pageaddr = quota->recent[(quota->head + i) % quota->ringsize];
+
+    if (jm_page_is_resident(pageaddr, NULL) == 1)
+      quota->recent[(quota->head + kept++) % quota->ringsize] = pageaddr;
+  }
+  quota->count = kept;
+}
+
+
+/* Append a page to a quota's ring buffer.  If the buffer is full,
+ * first discard stale entries and, only if none are stale, overwrite
+ * the oldest entry. */
+static inline void
+remember_page (JUMBOMEM_QUOTA *quota, char *rounded_addr)
+{
+  if (!quota->recent)
+    return;
+  if (quota->count == quota->ringsize)
+    compact_ring(quota);
+  if (quota->count == quota->ringsize) {
+    quota->head = (quota->head + 1) % quota->ringsize;
+    quota->count--;
+  }
+  quota->recent[(quota->head + quota->count) % quota->ringsize] = rounded_addr;
+  quota->count++;
+}
+
+
+/* Output what a quota did. */
+static void
+report_quota (JUMBOMEM_QUOTA *quota JM_UNUSED)
+{
+#ifdef JM_DEBUG
+  jm_debug_printf(2, "Cache quota %u (%p-%p): min %lu pages, max %lu pages, %lu resident, %lu evictions to stay within the max (%lu found by scanning the range), %lu evictions at or below the min.\n",
+                  (unsigned int)(quota - quotas), quota->start, quota->end - 1,
+                  quota->min_pages, quota->max_pages, quota->resident,
+                  quota->overflows, quota->misses, quota->intrusions);
+#endif
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* Reserve at least min_bytes and at most max_bytes (0=unlimited) of
+ * the master's cache for the pages spanned by a range of the global
+ * address space.  Setting a range's quota again replaces it; setting
+ * both bounds to 0 removes it.  Return 0 on success or -1 on
+ * failure. */
+int
+jm_set_cache_quota (const char *baseaddr, size_t numbytes, size_t min_bytes, size_t max_bytes)
+{
+  size_t pagesize = jm_globals.pagesize;   /* Cache of the JumboMem page size */
+  JUMBOMEM_QUOTA *quota = NULL;  /* Quota to set */
+  char *start;                   /* First page of the range */
+  char *end;                     /* Address past the last page of the range */
+  char *pageaddr;                /* Current page */
+  unsigned int i;
+
+  JM_ENTER();
+  if (numbytes == 0
+      || (char *)baseaddr < jm_globals.memregion
+      || (char *)baseaddr + numbytes > jm_globals.memregion + jm_globals.max_extent) {
+    jm_debug_printf(2, "Cache quotas apply only to the global address space.\n");
+    JM_RETURN(-1);
+  }
+  start = jm_globals.memregion + GET_PAGE_NUMBER((char *)baseaddr)*pagesize;
+  end = jm_globals.memregion + GET_PAGE_NUMBER((char *)baseaddr + numbytes - 1)*pagesize + pagesize;
+  if (max_bytes && max_bytes < min_bytes) {
+    jm_debug_printf(2, "A cache quota's maximum can't be less than its minimum.\n");
+    JM_RETURN(-1);
+  }
+  if (max_bytes && max_bytes < pagesize)
+    max_bytes = pagesize;
+
+  /* Adjacent allocations often share a page.  A page at either end of
+   * the range that another quota already covers stays with that
+   * quota. */
+  for (i=0; i<numquotas; i++) {
+    if (start == quotas[i].end - pagesize && end > start + pagesize)
+      start += pagesize;
+    if (end == quotas[i].start + pagesize && end > start + pagesize)
+      end -= pagesize;
+  }
+
+  /* Find the range's existing quota, if any.  A new range may not
+   * overlap an existing one. */
+  for (i=0; i<numquotas; i++) {
+    if (quotas[i].start == start && quotas[i].end == end) {
+      quota = &quotas[i];
+      break;
+    }
+    if (start < quotas[i].end && end > quotas[i].start) {
+      jm_debug_printf(2, "Cache quota %p-%p overlaps quota %u.\n", start, end - 1, i);
+      JM_RETURN(-1);
+    }
+  }
+  jm_freeze_other_threads();
+
+  /* Remove the quota if both bounds are 0. */
+  if (!min_bytes && !max_bytes) {
+    if (!quota)
+      JM_RETURN(-1);
+    report_quota(quota);
+    jm_free(quota->recent);
+    *quota = quotas[--numquotas];
+    JM_RETURN(0);
+  }
+
+  /* Initialize the quota and account for the range's pages that are
+   * already cached. */
+  if (!quota) {
+    if (numquotas == JM_MAX_QUOTAS) {
+      jm_debug_printf(2, "No more than %d ranges may have cache quotas.\n", JM_MAX_QUOTAS);
+      JM_RETURN(-1);
+    }
+    quota = &quotas[numquotas++];
+    memset(quota, 0, sizeof(JUMBOMEM_QUOTA));
+    quota->start = start;
+    quota->end = end;
+  }
+  jm_free(quota->recent);
+  quota->recent = NULL;
+  quota->min_pages = (min_bytes + pagesize - 1) / pagesize;
+  quota->max_pages = max_bytes / pagesize;
+  if (quota->max_pages) {
+    /* Leave room for stale entries, which we skip lazily. */
+    quota->ringsize = 2*quota->max_pages;
+    quota->recent = (char **) jm_malloc(quota->ringsize*sizeof(char *));
+  }
+  quota->head = 0;
+  quota->count = 0;
+  quota->resident = 0;
+  for (pageaddr=start; pageaddr<end; pageaddr+=pagesize)
+    if (jm_page_is_resident(pageaddr, NULL) == 1) {
+      quota->resident++;
+      remember_page(quota, pageaddr);
+    }
+  jm_debug_printf(3, "Set cache quota %u (%p-%p) to %lu-%lu pages (%lu resident).\n",
+                  (unsigned int)(quota - quotas), start, end - 1,
+                  quota->min_pages, quota->max_pages, quota->resident);
+  JM_RETURN(0);
+}
+
+
+/* Account for a page's entering the master's cache. */
+void
+jm_quota_page_cached (char *rounded_addr)
+{
+  JUMBOMEM_QUOTA *quota;
+
+  if (numquotas == 0 || !(quota=find_quota(rounded_addr)))
+    return;
+  quota->resident++;
+  remember_page(quota, rounded_addr);
+}
+
+
+/* Account for a page's leaving the master's cache. */
+void
+jm_quota_page_evicted (char *rounded_addr)
+{
+  JUMBOMEM_QUOTA *quota;
+
+  if (numquotas == 0 || !(quota=find_quota(rounded_addr)))
+    return;
+#ifdef JM_DEBUG
+  if (quota->resident <= quota->min_pages)
+    quota->intrusions++;
+#endif
+  if (quota->resident > 0)
+    quota->resident--;
+}
+
+
+/* If the range containing a page that is about to be cached already
+ * holds its maximum number of pages, stop caching the range's oldest
+ * page and return it and whether it is clean so the caller can evict
+ * it.  Return 1 if a page was released, 0 otherwise. */
+int
+jm_quota_overflow_page (char *faulted_page, char **evictable_page, int *clean)
+{
+  JUMBOMEM_QUOTA *quota;
+  char *pageaddr;            /* Oldest page in the ring or a page of the range */
+
+  if (numquotas == 0
+      || !(quota=find_quota(faulted_page))
+      || !quota->max_pages
+      || quota->resident < quota->max_pages)
+    return 0;
+  while (quota->count > 0) {
+    pageaddr = quota->recent[quota->head];
+    quota->head = (quota->head + 1) % quota->ringsize;
+    quota->count--;
+    if (jm_release_page(pageaddr, clean)) {
+      *evictable_page = pageaddr;
+#ifdef JM_DEBUG
+      quota->overflows++;
+#endif
+      return 1;
+    }
+  }
+
+  /* The ring lost track of the range's cached pages.  Scan the range
+   * for one instead. */
+  for (pageaddr=quota->start; pageaddr<quota->end; pageaddr+=jm_globals.pagesize)
+    if (pageaddr != faulted_page
+        && jm_page_is_resident(pageaddr, NULL) == 1
+        && jm_release_page(pageaddr, clean)) {
+      *evictable_page = pageaddr;
+#ifdef JM_DEBUG
+      quota->overflows++;
+      quota->misses++;
+#endif
+      return 1;
+    }
+  return 0;
+}
+
+
+/* Return 1 if evicting a given page would take the range containing
+ * it below its reserved number of pages to make room for a page from
+ * elsewhere (faulted_page, which may be NULL), 0 otherwise. */
+int
+jm_quota_reserves (char *rounded_addr, char *faulted_page)
+{
+  JUMBOMEM_QUOTA *quota;
+
+  if (numquotas == 0
+      || !(quota=find_quota(rounded_addr))
+      || quota->resident > quota->min_pages)
+    return 0;
+  return !faulted_page || faulted_page < quota->start || faulted_page >= quota->end;
+}
+
+
+/* Report what each quota did and release its memory. */
+void
+jm_finalize_quotas (void)
+{
+  unsigned int i;
+
+  for (i=0; i<numquotas; i++) {
+    report_quota(&quotas[i]);
+    jm_free(quotas[i].recent);
+    quotas[i].recent = NULL;
+  }
+  numquotas = 0;
+}
@@ -0,0 +1,1020 @@
+/*------------------------------------------------------------
+ * JumboMem memory server: Separately managed memory regions
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+/*
+ * A region is a range of addresses, separate from the global address
+ * space, that a program creates with jmu_region_create() when one
+ * data structure calls for a different page size or policy than the
+ * rest of the heap (e.g., small pages for a randomly accessed hash
+ * table and large, prefetched pages for a streamed array).  Each
+ * region has its own page size, its own replacement policy, and its
+ * own share of the master's cache.  The slave memory backing a region
+ * is carved from the top of the global address space, which shrinks
+ * accordingly.
+ *
+ * A region may also map a file (jmu_map_file()).  Pages are then read
+ * from the file on first use, the slaves' memory serves as a cache
+ * of the file, and modified pages are written back to the file only
+ * when the program syncs or unmaps the region.
+ *
+ * Large pages suit streaming but waste bandwidth on pointer chasing,
+ * so a region adapts its transfer granularity.  Each page is divided
+ * into up to 64 sub-blocks of at least one OS page.  Every so often a
+ * fault fetches only the sub-block that faulted and leaves the rest
+ * of the page inaccessible, fetching further sub-blocks as the
+ * program touches them.  The fraction of such a page's sub-blocks
+ * touched by the time it is evicted measures the region's spatial
+ * locality.  When locality is low, every fault fetches, and every
+ * eviction writes back, only touched sub-blocks; when it rises again
+ * the region returns to whole-page transfers.  Pages of file-backed
+ * regions are always transferred whole.
+ */
+
+#include "jumbomem.h"
+#include "jmuser.h"
+#include <sys/stat.h>
+
+/* Define the maximum number of regions a program can create. */
+#ifndef JM_MAX_REGIONS
+# define JM_MAX_REGIONS 16
+#endif
+
+/* Define the maximum number of sub-blocks per region page.  A page's
+ * sub-blocks are tracked with one bit apiece in a uint64_t. */
+#define MAX_SUBBLOCKS 64
+
+/* Define the number of whole-page faults between faults that fetch a
+ * single sub-block to measure a region's spatial locality (0=always
+ * transfer whole pages) and the percentages of sub-blocks touched
+ * below which a region switches to sub-block transfers and above
+ * which it switches back. */
+#ifndef REGION_PROBE_INTERVAL
+# define REGION_PROBE_INTERVAL 16
+#endif
+#ifndef REGION_SPARSE_BELOW
+# define REGION_SPARSE_BELOW 25
+#endif
+#ifndef REGION_DENSE_ABOVE
+# define REGION_DENSE_ABOVE 50
+#endif
+
+/* Mark a region page that is not cached at the master. */
+#define NOT_CACHED ((uint32_t)~0)
+
+/* Define the state of each page of a file-backed region. */
+#define PAGE_ON_SLAVES 0x01     /* The slaves hold the page's current contents */
+#define PAGE_UNSYNCED  0x02     /* The page was modified since last written to the file */
+
+/* Describe a single region. */
+typedef struct {
+  char    *base;             /* First address in the region */
+  size_t   extent;           /* Number of bytes in the region */
+  size_t   pagesize;         /* Region page size */
+  JUMBOMEM_DIVISOR pagediv;  /* pagesize as a divisor */
+  uint32_t numpages;         /* Number of region pages */
+  char    *backing;          /* Global address at which the slaves store the region */
+  int      fifo;             /* 0=evict a random page; 1=evict the oldest page */
+  int      whole;            /* 0=stripe each page across slaves; 1=keep each page on one slave */
+  int      track_dirty;      /* 1=write back only pages that were written */
+  unsigned int prefetch_depth;  /* Number of pages to fetch ahead of a sequential fault */
+  uint32_t capacity;         /* Number of region pages we can cache at the master */
+  uint32_t *cached;          /* Ring buffer of cached page numbers, oldest first */
+  unsigned char *dirty;      /* Dirty flag for each entry in the above */
+  unsigned char *unused;     /* 1=the entry was prefetched and not yet referenced */
+  uint32_t num_unused;       /* Number of nonzero entries in the above */
+  uint64_t *present;         /* Sub-blocks held locally for each entry in cached[] */
+  unsigned char *partial;    /* 1=the entry was fetched one sub-block at a time */
+  size_t   subsize;          /* Number of bytes per sub-block */
+  unsigned int numsubs;      /* Number of sub-blocks per page (1=whole pages only) */
+  uint64_t fullmask;         /* Sub-block mask of a fully present page */
+  int      sparse;           /* 1=fetch only the sub-blocks the program touches */
+  long     density;          /* Mean fraction of sub-blocks touched, in 1024ths */
+  unsigned int until_probe;  /* Whole-page faults remaining before a sub-block fetch */
+  uint32_t head;             /* Index into cached[] of the oldest page */
+  uint32_t count;            /* Number of valid entries in cached[] */
+  uint32_t *slot;            /* Index into cached[] of each page or NOT_CACHED */
+  uint32_t next_fault;       /* Page number at which a sequential fault would occur */
+  size_t   globalpages;      /* Number of global cache pages given to this region */
+  char    *reserved;         /* Address range reserved for the region */
+  size_t   reservedbytes;    /* Number of bytes in the above */
+  size_t   backingbytes;     /* Number of bytes of slave storage backing the region */
+  int      writable;         /* 1=the program may write to the region */
+  int      fd;               /* File backing the region or -1 */
+  off_t    fileoffset;       /* File offset of the region's first byte */
+  size_t   filebytes;        /* Number of bytes of the file the region maps */
+  unsigned char *state;      /* PAGE_* flags for each page of a file-backed region */
+#ifdef JM_DEBUG
+  unsigned long major_faults;   /* Faults that fetched a page */
+  unsigned long minor_faults;   /* Faults that only upgraded a page's protection */
+  unsigned long prefetches;     /* Pages fetched ahead of a fault */
+  unsigned long prefetch_hits;  /* Prefetched pages the program went on to reference */
+  unsigned long prefetch_evictions;  /* Prefetched pages evicted without being referenced */
+  unsigned long evictions;      /* Pages sent back to the slaves */
+  unsigned long clean_drops;    /* Pages discarded without being sent */
+  unsigned long file_reads;     /* Pages read from the file */
+  unsigned long file_writes;    /* Pages written to the file */
+  unsigned long subblock_fetches;  /* Sub-blocks fetched individually */
+  unsigned long granularity_switches;  /* Changes between whole-page and sub-block transfers */
+#endif
+} JUMBOMEM_REGION;
+
+extern JUMBOMEM_GLOBALS jm_globals;     /* All of our global variables */
+static JUMBOMEM_REGION regions[JM_MAX_REGIONS];   /* All regions created so far */
+static unsigned int numregions = 0;     /* Number of valid entries in the above */
+
+
+/* Return the global address whose slave storage backs a given byte
+ * offset into a region. */
+static char *
+backing_address (JUMBOMEM_REGION *region, size_t offset)
+{
+#ifndef JM_DIST_BLOCK
+  if (region->whole && region->pagesize > jm_globals.pagesize) {
+    /* Under round-robin distribution, consecutive global pages live
+     * on consecutive slaves.  To keep an entire region page on one
+     * slave we instead use every numslaves-th global page. */
+    size_t numslaves = jm_globals.numslaves;
+    size_t chunks = region->pagesize / jm_globals.pagesize;   /* Global pages per region page */
+    size_t rpage = offset / region->pagesize;
+    size_t chunk = (offset % region->pagesize) / jm_globals.pagesize;
+    size_t gpage = numslaves*(chunks*(rpage/numslaves) + chunk) + rpage%numslaves;
+
+    return region->backing + gpage*jm_globals.pagesize + offset%jm_globals.pagesize;
+  }
+#endif
+  return region->backing + offset;
+}
+
+
+/* Transfer a range of a region's bytes between the slaves and a local
+ * buffer, keeping up to JM_MAX_REGION_TRANSFERS transfers in flight.
+ * Each transfer lies within a single global page. */
+static void
+transfer_region_bytes (JUMBOMEM_REGION *region, size_t offset, char *buffer, size_t numbytes, int fetch)
+{
+  void *pending[JM_MAX_REGION_TRANSFERS];   /* Transfers in flight */
+  size_t chunksize;        /* Number of bytes in the current transfer */
+  size_t numchunks;        /* Number of transfers begun */
+  size_t i;
+
+  for (numchunks=0; numbytes>0; numchunks++) {
+    chunksize = jm_globals.pagesize - offset%jm_globals.pagesize;
+    if (chunksize > numbytes)
+      chunksize = numbytes;
+    if (numchunks >= JM_MAX_REGION_TRANSFERS) {
+      if (fetch)
+        jm_fetch_end(pending[numchunks % JM_MAX_REGION_TRANSFERS]);
+      else
+        jm_evict_end(pending[numchunks % JM_MAX_REGION_TRANSFERS]);
+    }
+    if (fetch)
+      pending[numchunks % JM_MAX_REGION_TRANSFERS] =
+        jm_fetch_begin(backing_address(region, offset), buffer, chunksize);
+    else
+      pending[numchunks % JM_MAX_REGION_TRANSFERS] =
+        jm_evict_begin(backing_address(region, offset), buffer, chunksize);
+    offset += chunksize;
+    buffer += chunksize;
+    numbytes -= chunksize;
+  }
+  for (i = numchunks > JM_MAX_REGION_TRANSFERS ? numchunks - JM_MAX_REGION_TRANSFERS : 0;
+       i < numchunks;
+       i++) {
+    if (fetch)
+      jm_fetch_end(pending[i % JM_MAX_REGION_TRANSFERS]);
+    else
+      jm_evict_end(pending[i % JM_MAX_REGION_TRANSFERS]);
+  }
+}
+
+
+/* Transfer one region page between the slaves and a local buffer. */
+static void
+transfer_region_page (JUMBOMEM_REGION *region, uint32_t pagenum, char *buffer, int fetch)
+{
+  transfer_region_bytes(region, (size_t)pagenum*region->pagesize, buffer, region->pagesize, fetch);
+}
+
+
+/* Find the first run of sub-blocks in a mask that begins at or after
+ * sub-block *first.  Return 1 and store the run's bounds in *first
+ * and *last (exclusive) or return 0 if there is no such run. */
+static inline int
+next_subblock_run (JUMBOMEM_REGION *region, uint64_t mask, unsigned int *first, unsigned int *last)
+{
+  unsigned int i = *first;
+
+  while (i < region->numsubs && !(mask & ((uint64_t)1 << i)))
+    i++;
+  if (i >= region->numsubs)
+    return 0;
+  *first = i;
+  for (i++; i < region->numsubs && mask & ((uint64_t)1 << i); i++)
+    ;
+  *last = i;
+  return 1;
+}
+
+
+/* Set the protection of the sub-blocks of a page that are held
+ * locally, leaving the rest of the page inaccessible. */
+static void
+protect_subblocks (JUMBOMEM_REGION *region, char *page_addr, uint64_t present, int protflags)
+{
+  unsigned int first, last;
+
+  for (first=0; next_subblock_run(region, present, &first, &last); first=last)
+    if (mprotect(page_addr + first*region->subsize, (last-first)*region->subsize, protflags) == -1)
+      jm_abort("Failed to protect region page %p (%s)", page_addr, jm_strerror(errno));
+}
+
+
+/* Fetch a single sub-block of a page into place with the given final
+ * protection. */
+static void
+fetch_region_subblock (JUMBOMEM_REGION *region, uint32_t pagenum, unsigned int sub, int protflags)
+{
+  size_t offset = (size_t)pagenum*region->pagesize + sub*region->subsize;
+  char *block_addr = region->base + offset;
+
+  if (mprotect(block_addr, region->subsize, PROT_READ|PROT_WRITE) == -1)
+    jm_abort("Failed to unprotect region page %p (%s)", block_addr, jm_strerror(errno));
+  transfer_region_bytes(region, offset, block_addr, region->subsize, 1);
+  if (protflags != (PROT_READ|PROT_WRITE)
+      && mprotect(block_addr, region->subsize, protflags) == -1)
+    jm_abort("Failed to protect region page %p (%s)", block_addr, jm_strerror(errno));
+#ifdef JM_DEBUG
+  region->subblock_fetches++;
+#endif
+}
+
+
+/* Fold the fraction of an evicted page's sub-blocks that the program
+ * touched into a region's measure of spatial locality, and switch
+ * between whole-page and sub-block transfers as that measure
+ * dictates. */
+static void
+note_subblock_density (JUMBOMEM_REGION *region, uint64_t present)
+{
+  long touched = 0;        /* Number of sub-blocks touched */
+  unsigned int i;
+
+  for (i=0; i<region->numsubs; i++)
+    if (present & ((uint64_t)1 << i))
+      touched++;
+  region->density += (touched*1024/region->numsubs - region->density) / 8;
+  if (!region->sparse && region->density < REGION_SPARSE_BELOW*1024/100)
+    region->sparse = 1;
+  else if (region->sparse && region->density > REGION_DENSE_ABOVE*1024/100) {
+    region->sparse = 0;
+    region->until_probe = REGION_PROBE_INTERVAL;
+  }
+  else
+    return;
+  jm_debug_printf(3, "Region %u now transfers %s (%ld%% of sub-blocks touched).\n",
+                  (unsigned int)(region - regions),
+                  region->sparse ? "only touched sub-blocks" : "whole pages",
+                  region->density*100/1024);
+#ifdef JM_DEBUG
+  region->granularity_switches++;
+#endif
+}
+
+
+/* Read a run of consecutive pages of a file-backed region from the
+ * file with a single system call.  Pages past the end of the file
+ * are left zero-filled. */
+static void
+read_file_pages (JUMBOMEM_REGION *region, uint32_t firstpage, uint32_t numpages)
+{
+  size_t fileofs = (size_t)firstpage * region->pagesize;   /* Offset into the mapped part of the file */
+  char *buffer = region->base + fileofs;                   /* Where to store the data */
+  size_t toread;           /* Number of bytes to read */
+  size_t numread;          /* Number of bytes read so far */
+
+  if (fileofs >= region->filebytes)
+    return;
+  toread = (size_t)numpages * region->pagesize;
+  if (toread > region->filebytes - fileofs)
+    toread = region->filebytes - fileofs;
+  for (numread=0; numread<toread; ) {
+    ssize_t numbytes = pread(region->fd, buffer+numread, toread-numread,
+                             region->fileoffset + (off_t)(fileofs+numread));
+
+    if (numbytes == -1 && errno == EINTR)
+      continue;
+    if (numbytes == 0)
+      break;     /* The file shrank after we mapped it. */
+    if (numbytes == -1)
+      jm_abort("Failed to read %lu bytes of a mapped file into address %p (%s)",
+               toread, buffer, jm_strerror(errno));
+    numread += numbytes;
+  }
+
+  /* The data now live in JumboMem so there's no need for the kernel
+   * to keep them in its page cache as well. */
+#ifdef POSIX_FADV_DONTNEED
+  (void) posix_fadvise(region->fd, region->fileoffset + (off_t)fileofs, (off_t)toread, POSIX_FADV_DONTNEED);
+#endif
+#ifdef JM_DEBUG
+  region->file_reads += numpages;
+#endif
+}
+
+
+/* Write one page of a file-backed region to the file.  Return 1 on
+ * success or 0 on failure. */
+static int
+write_file_page (JUMBOMEM_REGION *region, uint32_t pagenum, const char *buffer)
+{
+  size_t fileofs = (size_t)pagenum * region->pagesize;   /* Offset into the mapped part of the file */
+  size_t towrite;          /* Number of bytes to write */
+  size_t numwritten;       /* Number of bytes written so far */
+
+  if (fileofs >= region->filebytes)
+    return 1;
+  towrite = region->pagesize;
+  if (towrite > region->filebytes - fileofs)
+    towrite = region->filebytes - fileofs;
+  for (numwritten=0; numwritten<towrite; ) {
+    ssize_t numbytes = pwrite(region->fd, buffer+numwritten, towrite-numwritten,
+                              region->fileoffset + (off_t)(fileofs+numwritten));
+
+    if (numbytes == -1 && errno == EINTR)
+      continue;
+    if (numbytes <= 0) {
+      jm_debug_printf(1, "Failed to write %lu bytes from address %p to a mapped file (%s).\n",
+                      towrite, region->base + fileofs,
+                      numbytes==0 ? "no data written" : jm_strerror(errno));
+      return 0;
+    }
+    numwritten += numbytes;
+  }
+#ifdef JM_DEBUG
+  region->file_writes++;
+#endif
+  return 1;
+}
+
+
+/* Evict one page from a region's cache to make room for another. */
+static void
+evict_region_page (JUMBOMEM_REGION *region)
+{
+  uint32_t victim_slot;    /* Index into cached[] of the page to evict */
+  uint32_t victim;         /* Page number to evict */
+  int victim_dirty;        /* 1=victim must be written back */
+  uint64_t victim_present; /* Sub-blocks of the victim held locally */
+  char *victim_addr;       /* Address of the victim page */
+  unsigned int first, last;   /* Bounds of a run of present sub-blocks */
+
+  /* Select a victim and fill its slot with the oldest page so the
+   * cached pages remain contiguous in the ring buffer.  Prefetched
+   * pages that were never referenced go first, oldest first, so a
+   * wrong guess can't displace a page the program is using. */
+  if (region->num_unused > 0) {
+    for (victim_slot=region->head;
+         !region->unused[victim_slot];
+         victim_slot=(victim_slot+1)%region->capacity)
+      ;
+    region->num_unused--;
+#ifdef JM_DEBUG
+    region->prefetch_evictions++;
+#endif
+  }
+  else if (region->fifo)
+    victim_slot = region->head;
+  else
+    victim_slot = (region->head + (uint32_t)(random() % region->count)) % region->capacity;
+  victim = region->cached[victim_slot];
+  victim_dirty = region->dirty[victim_slot];
+  victim_present = region->present[victim_slot];
+  if (region->partial[victim_slot])
+    note_subblock_density(region, victim_present);
+  if (victim_slot != region->head) {
+    region->cached[victim_slot] = region->cached[region->head];
+    region->dirty[victim_slot] = region->dirty[region->head];
+    region->unused[victim_slot] = region->unused[region->head];
+    region->present[victim_slot] = region->present[region->head];
+    region->partial[victim_slot] = region->partial[region->head];
+    region->slot[region->cached[victim_slot]] = victim_slot;
+  }
+  region->head = (region->head + 1) % region->capacity;
+  region->count--;
+  region->slot[victim] = NOT_CACHED;
+
+  /* Write back the victim's present sub-blocks if necessary then
+   * release its memory.  A page read from a file goes to the slaves
+   * even if clean so the next fault on it needn't touch the file. */
+  victim_addr = region->base + (size_t)victim*region->pagesize;
+  if (region->state && !(region->state[victim] & PAGE_ON_SLAVES))
+    victim_dirty = 1;
+  if (victim_dirty) {
+    for (first=0; next_subblock_run(region, victim_present, &first, &last); first=last)
+      transfer_region_bytes(region,
+                            (size_t)victim*region->pagesize + first*region->subsize,
+                            victim_addr + first*region->subsize,
+                            (last-first)*region->subsize, 0);
+    if (region->state)
+      region->state[victim] |= PAGE_ON_SLAVES;
+#ifdef JM_DEBUG
+    region->evictions++;
+#endif
+  }
+#ifdef JM_DEBUG
+  else
+    region->clean_drops++;
+#endif
+  if (mmap(victim_addr, region->pagesize, PROT_NONE,
+           MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0) == MAP_FAILED)
+    jm_abort("Failed to release region page %p (%s)", victim_addr, jm_strerror(errno));
+}
+
+
+/* Add a freshly filled page, of which the given sub-blocks are
+ * present, to a region's cache, which must have room for it.  A
+ * prefetched page is left inaccessible so that we notice when the
+ * program first references it. */
+static void
+insert_region_page (JUMBOMEM_REGION *region, uint32_t pagenum, int prefetched, uint64_t present)
+{
+  char *page_addr = region->base + (size_t)pagenum*region->pagesize;
+  uint32_t newslot = (region->head + region->count) % region->capacity;
+
+  if (prefetched) {
+    if (mprotect(page_addr, region->pagesize, PROT_NONE) == -1)
+      jm_abort("Failed to protect region page %p (%s)", page_addr, jm_strerror(errno));
+    region->num_unused++;
+  }
+  else if (region->track_dirty)
+    protect_subblocks(region, page_addr, present, PROT_READ);
+  region->cached[newslot] = pagenum;
+  region->dirty[newslot] = !region->track_dirty && !prefetched;
+  region->unused[newslot] = (unsigned char) prefetched;
+  region->present[newslot] = present;
+  region->partial[newslot] = present != region->fullmask;
+  region->slot[pagenum] = newslot;
+  region->count++;
+}
+
+
+/* Fetch a list of pages into a region's cache, which must have room
+ * for them.  The first page is the one that faulted; the rest are
+ * prefetched.  Pages not yet on the slaves are read from the region's
+ * file, one system call per run of consecutive pages. */
+static void
+fetch_region_pages (JUMBOMEM_REGION *region, uint32_t *pagelist, unsigned int numpages)
+{
+  unsigned int i, j;
+
+  for (i=0; i<numpages; i=j) {
+    char *page_addr = region->base + (size_t)pagelist[i]*region->pagesize;
+
+    /* Fetch pages held by the slaves individually. */
+    j = i + 1;
+    if (!region->state || region->state[pagelist[i]] & PAGE_ON_SLAVES) {
+      jm_assign_backing_store(page_addr, region->pagesize, PROT_READ|PROT_WRITE);
+      transfer_region_page(region, pagelist[i], page_addr, 1);
+      insert_region_page(region, pagelist[i], i > 0, region->fullmask);
+      continue;
+    }
+
+    /* Read pages held only by the file in batches. */
+    while (j < numpages
+           && pagelist[j] == pagelist[j-1] + 1
+           && !(region->state[pagelist[j]] & PAGE_ON_SLAVES))
+      j++;
+    jm_assign_backing_store(page_addr, (size_t)(j-i)*region->pagesize, PROT_READ|PROT_WRITE);
+    read_file_pages(region, pagelist[i], j - i);
+    for (; i<j; i++)
+      insert_region_page(region, pagelist[i], i > 0, region->fullmask);
+  }
+}
+
+
+/* Write all modified pages of a file-backed region to the file.
+ * Return 1 on success or 0 on failure.  The caller must have frozen
+ * all other threads. */
+static int
+sync_region (JUMBOMEM_REGION *region)
+{
+  char *buffer = NULL;     /* Buffer for pages that reside only on the slaves */
+  int success = 1;         /* 1=all writes succeeded */
+  uint32_t pagenum;
+
+  for (pagenum=0; pagenum<region->numpages; pagenum++) {
+    char *page_addr = region->base + (size_t)pagenum*region->pagesize;
+
+    if (!(region->state[pagenum] & PAGE_UNSYNCED))
+      continue;
+    if (region->slot[pagenum] != NOT_CACHED) {
+      /* Write the page from the cache and write-protect it so we
+       * notice if it's modified again. */
+      if (!write_file_page(region, pagenum, page_addr)) {
+        success = 0;
+        continue;
+      }
+      if (mprotect(page_addr, region->pagesize, PROT_READ) == -1)
+        jm_abort("Failed to protect region page %p (%s)", page_addr, jm_strerror(errno));
+    }
+    else {
+      /* Retrieve the page from the slaves then write it. */
+      if (!buffer)
+        buffer = (char *) jm_malloc(region->pagesize);
+      transfer_region_page(region, pagenum, buffer, 1);
+      if (!write_file_page(region, pagenum, buffer)) {
+        success = 0;
+        continue;
+      }
+    }
+    region->state[pagenum] &= ~PAGE_UNSYNCED;
+  }
+  if (buffer)
+    jm_free(buffer);
+  if (fdatasync(region->fd) == -1 && errno != EINVAL && errno != EROFS)
+    success = 0;
+  return success;
+}
+
+
+/* Create a region without giving it any contents.  Return the region
+ * or NULL on failure.  The caller must hold the mega-lock. */
+static JUMBOMEM_REGION *
+create_region (size_t numbytes, size_t pagesize, int policy)
+{
+  JUMBOMEM_REGION *region;     /* The region to create */
+  unsigned int regionnum;      /* Index of the region in regions[] */
+  size_t unit;                 /* Granularity of the slave storage we carve out */
+  size_t backingbytes;         /* Number of bytes of slave storage to carve out */
+  size_t cachepages;           /* Number of region pages to cache at the master */
+  size_t globalpages;          /* Number of global pages those displace */
+  char *hint;                  /* Preferred address for the region */
+  char *reserved;              /* Address range reserved for the region */
+
+  /* Find an unused region descriptor. */
+  if (jm_globals.numslaves < 1 || numbytes == 0)
+    return NULL;
+  for (regionnum=0; regionnum<numregions; regionnum++)
+    if (!regions[regionnum].base)
+      break;
+  if (regionnum == JM_MAX_REGIONS) {
+    jm_debug_printf(2, "Failed to create a region; all %d are in use.\n", JM_MAX_REGIONS);
+    return NULL;
+  }
+
+  /* Validate the page size. */
+  if (pagesize == 0
+      || pagesize % jm_globals.ospagesize != 0
+      || (pagesize > jm_globals.pagesize
+          ? pagesize % jm_globals.pagesize
+          : jm_globals.pagesize % pagesize) != 0) {
+    jm_debug_printf(2, "Rejecting region page size %lu; it must be a multiple of %lu and either a multiple or a divisor of %lu.\n",
+                    pagesize, jm_globals.ospagesize, jm_globals.pagesize);
+    return NULL;
+  }
+  numbytes = ((numbytes + pagesize - 1) / pagesize) * pagesize;
+  if (numbytes / pagesize >= NOT_CACHED)
+    return NULL;
+
+  /* Carve the region's slave storage from the top of the slaves'
+   * capacity.  This is possible only if the heap hasn't yet grown
+   * that far. */
+  unit = jm_globals.pagesize * jm_globals.numslaves;
+  if (policy & JMU_REGION_WHOLE && pagesize > jm_globals.pagesize)
+    unit *= pagesize / jm_globals.pagesize;
+  backingbytes = ((numbytes + unit - 1) / unit) * unit;
+  if (jm_globals.extent != jm_globals.slave_extent
+      || backingbytes > jm_globals.slave_extent
+      || jm_globals.endaddress > jm_globals.memregion + jm_globals.slave_extent - backingbytes) {
+    jm_debug_printf(2, "Insufficient slave memory for a %lu-byte region.\n", numbytes);
+    return NULL;
+  }
+
+  /* Give the region a share of the master's cache proportional to
+   * its share of the slaves' memory but at least two pages. */
+  cachepages = (size_t) ((double)jm_globals.local_pages * jm_globals.pagesize
+                         * ((double)numbytes / (double)jm_globals.slave_extent)
+                         / pagesize);
+  if (cachepages < 2)
+    cachepages = 2;
+  if (cachepages > numbytes / pagesize)
+    cachepages = numbytes / pagesize;
+  globalpages = (cachepages*pagesize + jm_globals.pagesize - 1) / jm_globals.pagesize;
+  if (globalpages + 2 > jm_globals.local_pages) {
+    jm_debug_printf(2, "Insufficient local memory to cache a %lu-byte region.\n", numbytes);
+    return NULL;
+  }
+
+  /* Reserve the region's addresses, aligned to its page size, above
+   * the global address space. */
+  hint = jm_globals.memregion + jm_globals.max_extent;
+  reserved = (char *) mmap(hint, numbytes + pagesize, PROT_NONE,
+                           MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (reserved == (char *) MAP_FAILED) {
+    jm_debug_printf(2, "Failed to reserve %lu bytes of address space for a region (%s).\n",
+                    numbytes + pagesize, jm_strerror(errno));
+    return NULL;
+  }
+  if (reserved < hint && reserved + numbytes + pagesize > jm_globals.memregion) {
+    (void) munmap(reserved, numbytes + pagesize);
+    jm_debug_printf(2, "Failed to reserve address space for a region outside the global address space.\n");
+    return NULL;
+  }
+
+  /* Initialize the region. */
+  region = &regions[regionnum];
+  memset(region, 0, sizeof(JUMBOMEM_REGION));
+  region->reserved = reserved;
+  region->reservedbytes = numbytes + pagesize;
+  region->base = reserved;
+  if ((uintptr_t)region->base % pagesize != 0)
+    region->base += pagesize - (uintptr_t)region->base % pagesize;
+  region->extent = numbytes;
+  region->pagesize = pagesize;
+  jm_initialize_divisor(&region->pagediv, pagesize, numbytes);
+  region->numpages = (uint32_t) (numbytes / pagesize);
+  region->fifo = (policy & JMU_REGION_FIFO) != 0;
+  region->whole = (policy & JMU_REGION_WHOLE) != 0;
+  region->track_dirty = (policy & JMU_REGION_TRACK_DIRTY) != 0;
+  region->prefetch_depth = (unsigned int) ((policy >> 16) & 0xff);
+  region->capacity = (uint32_t) cachepages;
+  if (region->prefetch_depth >= region->capacity)
+    region->prefetch_depth = region->capacity - 1;
+  region->cached = (uint32_t *) jm_malloc(cachepages*sizeof(uint32_t));
+  region->dirty = (unsigned char *) jm_malloc(cachepages);
+  region->unused = (unsigned char *) jm_malloc(cachepages);
+  region->present = (uint64_t *) jm_malloc(cachepages*sizeof(uint64_t));
+  region->partial = (unsigned char *) jm_malloc(cachepages);
+  region->slot = (uint32_t *) jm_malloc(region->numpages*sizeof(uint32_t));
+  memset(region->slot, 0xff, region->numpages*sizeof(uint32_t));
+  region->next_fault = NOT_CACHED;
+
+  /* Divide each page into sub-blocks of whole OS pages so that the
+   * region can adapt its transfer granularity. */
+  region->subsize = pagesize;
+  region->numsubs = 1;
+  if (REGION_PROBE_INTERVAL > 0 && pagesize >= 2*jm_globals.ospagesize) {
+    size_t subsize = jm_globals.ospagesize
+      * ((pagesize/jm_globals.ospagesize + MAX_SUBBLOCKS - 1) / MAX_SUBBLOCKS);
+
+    if (pagesize % subsize == 0) {
+      region->subsize = subsize;
+      region->numsubs = (unsigned int) (pagesize / subsize);
+    }
+  }
+  region->fullmask = region->numsubs == MAX_SUBBLOCKS
+    ? ~(uint64_t)0 : ((uint64_t)1 << region->numsubs) - 1;
+  region->density = 1024;
+  region->until_probe = REGION_PROBE_INTERVAL;
+  region->globalpages = globalpages;
+  region->backingbytes = backingbytes;
+  region->writable = 1;
+  region->fd = -1;
+
+  /* Take the region's storage away from the global address space. */
+  region->backing = jm_carve_slave_storage(backingbytes);
+  jm_globals.local_pages -= globalpages;
+  if (jm_globals.local_page_target > jm_globals.local_pages)
+    jm_globals.local_page_target = jm_globals.local_pages;
+  if (regionnum == numregions)
+    numregions++;
+
+  jm_debug_printf(2, "Created region %u at [%p, %p) with %sB %s pages (%s, %sdirty tracking, prefetch depth %u), caching %lu pages.\n",
+                  regionnum, region->base, region->base + region->extent,
+                  jm_format_power_of_2((uint64_t)pagesize, 0),
+                  region->whole ? "whole" : "striped",
+                  region->fifo ? "FIFO" : "random",
+                  region->track_dirty ? "" : "no ",
+                  region->prefetch_depth, cachepages);
+  return region;
+}
+
+
+/* Report what a region did. */
+static void
+report_region (JUMBOMEM_REGION *region)
+{
+#ifdef JM_DEBUG
+  jm_debug_printf(2, "Region %u: %lu major faults, %lu minor faults, %lu prefetches, %lu evictions, %lu clean drops, %lu file reads, %lu file writes.\n",
+                  (unsigned int)(region - regions),
+                  region->major_faults, region->minor_faults, region->prefetches,
+                  region->evictions, region->clean_drops,
+                  region->file_reads, region->file_writes);
+  if (region->prefetches > 0)
+    jm_debug_printf(2, "Region %u: %lu prefetched pages referenced, %lu evicted unreferenced (pollution).\n",
+                    (unsigned int)(region - regions),
+                    region->prefetch_hits, region->prefetch_evictions);
+  if (region->numsubs > 1)
+    jm_debug_printf(2, "Region %u: %lu sub-blocks of %sB fetched individually, %lu granularity changes, %ld%% of sub-blocks touched.\n",
+                    (unsigned int)(region - regions),
+                    region->subblock_fetches,
+                    jm_format_power_of_2((uint64_t)region->subsize, 0),
+                    region->granularity_switches, region->density*100/1024);
+#endif
+}
+
+
+/* Return the region whose base address is given or NULL if there is
+ * no such region. */
+static JUMBOMEM_REGION *
+find_region (void *baseaddr)
+{
+  unsigned int i;
+
+  for (i=0; i<numregions; i++)
+    if (regions[i].base && regions[i].base == (char *)baseaddr)
+      return &regions[i];
+  return NULL;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* Create a region of a given size whose pages are pagesize bytes
+ * long and managed according to a set of JMU_REGION_* flags.  Return
+ * the region's base address or NULL on failure. */
+void *
+jm_region_create (size_t numbytes, size_t pagesize, int policy)
+{
+  JUMBOMEM_REGION *region;
+
+  JM_ENTER();
+  region = create_region(numbytes, pagesize, policy);
+  JM_RETURN(region ? region->base : NULL);
+}
+
+
+/* Map numbytes bytes of a file, starting at a given offset, into a
+ * region whose pages are read from the file on first use.  If
+ * numbytes is 0, map the rest of the file.  flags is a set of
+ * JMU_MAP_* and JMU_REGION_* flags.  Return the region's base address
+ * or NULL on failure. */
+void *
+jm_map_file (const char *filename, off_t offset, size_t numbytes, int flags)
+{
+  JUMBOMEM_REGION *region;     /* Region to map the file into */
+  struct stat filestat;        /* File size */
+  int fd;                      /* File descriptor */
+
+  JM_ENTER();
+  if ((fd=open(filename, flags & JMU_MAP_WRITE ? O_RDWR : O_RDONLY)) == -1) {
+    jm_debug_printf(2, "Failed to open %s (%s).\n", filename, jm_strerror(errno));
+    JM_RETURN(NULL);
+  }
+  if (fstat(fd, &filestat) == -1 || offset < 0 || offset > filestat.st_size) {
+    close(fd);
+    JM_RETURN(NULL);
+  }
+  if (numbytes == 0)
+    numbytes = (size_t) (filestat.st_size - offset);
+
+  /* Pages must be write-protected until modified so we know which to
+   * write back to the file. */
+  if (!(region=create_region(numbytes, jm_globals.pagesize, flags|JMU_REGION_TRACK_DIRTY))) {
+    close(fd);
+    JM_RETURN(NULL);
+  }
+  region->writable = (flags & JMU_MAP_WRITE) != 0;
+  region->fd = fd;
+  region->fileoffset = offset;
+  region->filebytes = numbytes;
+  region->state = (unsigned char *) jm_malloc(region->numpages);
+  memset(region->state, 0, region->numpages);
+
+  /* Pages are read from and written to the file whole. */
+  region->subsize = region->pagesize;
+  region->numsubs = 1;
+  region->fullmask = 1;
+  jm_debug_printf(2, "Mapped %lu bytes of %s at offset %ld %s into [%p, %p).\n",
+                  numbytes, filename, (long)offset,
+                  region->writable ? "read/write" : "read-only",
+                  region->base, region->base + region->extent);
+  JM_RETURN(region->base);
+}
+
+
+/* Write a file-backed region's modified pages to its file.  Return 0
+ * on success or -1 on failure. */
+int
+jm_region_sync (void *baseaddr)
+{
+  JUMBOMEM_REGION *region;
+  int retval;
+
+  JM_ENTER();
+  if (!(region=find_region(baseaddr)) || region->fd == -1)
+    JM_RETURN(-1);
+  jm_freeze_other_threads();
+  retval = sync_region(region) ? 0 : -1;
+  JM_RETURN(retval);
+}
+
+
+/* Destroy a region, first writing modified pages back to the file if
+ * the region is file-backed.  Return 0 on success or -1 on failure. */
+int
+jm_region_destroy (void *baseaddr)
+{
+  JUMBOMEM_REGION *region;
+  int retval = 0;
+
+  JM_ENTER();
+  if (!(region=find_region(baseaddr)))
+    JM_RETURN(-1);
+  jm_freeze_other_threads();
+  if (region->fd != -1) {
+    if (!sync_region(region))
+      retval = -1;
+    close(region->fd);
+    jm_free(region->state);
+  }
+  (void) munmap(region->reserved, region->reservedbytes);
+  jm_free(region->cached);
+  jm_free(region->dirty);
+  jm_free(region->unused);
+  jm_free(region->present);
+  jm_free(region->partial);
+  jm_free(region->slot);
+
+  /* Return the region's cache share to the global address space and,
+   * if it was the most recently carved, its slave storage as well. */
+  if (jm_globals.local_page_target == jm_globals.local_pages)
+    jm_globals.local_page_target += region->globalpages;
+  jm_globals.local_pages += region->globalpages;
+  (void) jm_return_slave_storage(region->backing, region->backingbytes);
+  jm_debug_printf(2, "Destroyed region %u.\n", (unsigned int)(region - regions));
+  report_region(region);
+  memset(region, 0, sizeof(JUMBOMEM_REGION));
+  JM_RETURN(retval);
+}
+
+
+/* Service a fault on a region address.  Return 1 if the fault was
+ * handled or 0 if the address doesn't belong to a region or the
+ * access isn't permitted.  The caller must hold the mega-lock. */
+int
+jm_region_fault (char *fault_addr)
+{
+  JUMBOMEM_REGION *region = NULL;  /* Region containing fault_addr */
+  uint32_t pagenum;        /* Region page that faulted */
+  uint32_t fetchlist[JM_MAX_PREFETCH_DEPTH + 1];   /* Pages to fetch */
+  unsigned int numfetches; /* Number of valid entries in the above */
+  unsigned int depth;      /* Number of pages to prefetch */
+  unsigned int sub;        /* Sub-block that faulted */
+  int partial;             /* 1=fetch only the sub-block that faulted */
+  unsigned int i;
+
+  for (i=0; i<numregions; i++)
+    if (fault_addr >= regions[i].base && fault_addr < regions[i].base + regions[i].extent) {
+      region = &regions[i];
+      break;
+    }
+  if (!region)
+    return 0;
+  pagenum = (uint32_t) jm_divide((uint64_t)(fault_addr - region->base), &region->pagediv);
+  sub = (unsigned int) ((size_t)(fault_addr - region->base - (size_t)pagenum*region->pagesize) / region->subsize);
+
+  /* A fault on a cached page is the first touch of a sub-block of a
+   * partially fetched page, the first reference to a prefetched page,
+   * or the first write to a clean page.  Only the first of these
+   * moves data, so in the other cases the other threads can keep
+   * running. */
+  if (region->slot[pagenum] != NOT_CACHED) {
+    char *page_addr = region->base + (size_t)pagenum*region->pagesize;
+    uint32_t pageslot = region->slot[pagenum];
+
+    if (!(region->present[pageslot] & ((uint64_t)1 << sub))) {
+      jm_freeze_other_threads();
+      fetch_region_subblock(region, pagenum, sub,
+                            region->track_dirty && !region->dirty[pageslot]
+                            ? PROT_READ : PROT_READ|PROT_WRITE);
+      region->present[pageslot] |= (uint64_t)1 << sub;
+#ifdef JM_DEBUG
+      region->major_faults++;
+#endif
+      return 1;
+    }
+    if (region->unused[pageslot]) {
+      /* The prefetch paid off.  Give the page the standing of a
+       * demand-fetched page. */
+      if (mprotect(page_addr, region->pagesize,
+                   region->track_dirty ? PROT_READ : PROT_READ|PROT_WRITE) == -1)
+        jm_abort("Failed to unprotect region page %p (%s)", page_addr, jm_strerror(errno));
+      region->unused[pageslot] = 0;
+      region->num_unused--;
+      region->dirty[pageslot] = !region->track_dirty;
+#ifdef JM_DEBUG
+      region->prefetch_hits++;
+      region->minor_faults++;
+#endif
+      return 1;
+    }
+    if (!region->writable)
+      return 0;
+    protect_subblocks(region, page_addr, region->present[pageslot], PROT_READ|PROT_WRITE);
+    region->dirty[pageslot] = 1;
+    if (region->state)
+      region->state[pagenum] = PAGE_UNSYNCED;   /* The slaves' copy is now stale. */
+#ifdef JM_DEBUG
+    region->minor_faults++;
+#endif
+    return 1;
+  }
+  jm_freeze_other_threads();
+
+  /* If the region's spatial locality is low, or if it's time to
+   * measure it, fetch only the sub-block that faulted. */
+  partial = 0;
+  if (region->numsubs > 1) {
+    if (region->sparse)
+      partial = 1;
+    else if (--region->until_probe == 0) {
+      partial = 1;
+      region->until_probe = REGION_PROBE_INTERVAL;
+    }
+  }
+  if (partial) {
+    region->next_fault = pagenum + 1;
+    if (region->count == region->capacity)
+      evict_region_page(region);
+    fetch_region_subblock(region, pagenum, sub, PROT_READ|PROT_WRITE);
+    insert_region_page(region, pagenum, 0, (uint64_t)1 << sub);
+#ifdef JM_DEBUG
+    region->major_faults++;
+#endif
+    return 1;
+  }
+
+  /* Fetch the page that faulted and, if faults appear to be
+   * sequential, the pages that follow it. */
+  fetchlist[0] = pagenum;
+  numfetches = 1;
+  depth = region->prefetch_depth;
+  if (depth > JM_MAX_PREFETCH_DEPTH)
+    depth = JM_MAX_PREFETCH_DEPTH;
+  if (pagenum == region->next_fault)
+    for (i=1; i<=depth && pagenum+i < region->numpages; i++)
+      if (region->slot[pagenum+i] == NOT_CACHED)
+        fetchlist[numfetches++] = pagenum + i;
+  region->next_fault = fetchlist[numfetches-1] + 1;
+  while (region->capacity - region->count < numfetches)
+    evict_region_page(region);
+  fetch_region_pages(region, fetchlist, numfetches);
+
+  /* Let the kernel start reading the part of the file we expect to
+   * need next while the program works on what we just fetched. */
+#ifdef POSIX_FADV_WILLNEED
+  if (region->fd != -1 && region->next_fault < region->numpages) {
+    size_t fileofs = (size_t)region->next_fault * region->pagesize;
+
+    if (fileofs < region->filebytes)
+      (void) posix_fadvise(region->fd, region->fileoffset + (off_t)fileofs,
+                           (off_t)((depth + 1) * region->pagesize), POSIX_FADV_WILLNEED);
+  }
+#endif
+#ifdef JM_DEBUG
+  region->major_faults++;
+  region->prefetches += numfetches - 1;
+#endif
+  return 1;
+}
+
+
+/* Write back file-backed regions and report what each region did. */
+void
+jm_finalize_regions (void)
+{
+  unsigned int i;
+
+  for (i=0; i<numregions; i++)
+    if (regions[i].base) {
+      if (regions[i].fd != -1 && !jm_globals.error_exit && !sync_region(&regions[i]))
+        jm_debug_printf(1, "Failed to write back region %u to its file.\n", i);
+      report_region(&regions[i]);
+    }
+}
@@ -0,0 +1,474 @@
+/*------------------------------------------------------------
+ * JumboMem memory server: Read replicas and hedged fetches
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+/*
+ * Every page lives on exactly one slave, so a slave that is swapping
+ * or congested stalls every fault on its pages.  With JM_HEDGE set,
+ * JumboMem sets aside a share of the slaves' memory to hold second
+ * copies of read-mostly pages, each on a different slave from the
+ * page's own.  A page is replicated the second time it is evicted
+ * clean (and so still matches its slave's copy) without having been
+ * evicted dirty in between; this keeps data that is streamed through
+ * once from doubling the traffic to the slaves.  A page loses its
+ * replica when it is evicted dirty.  The replica area is
+ * direct-mapped, so a page's replica may also be displaced by another
+ * page's.
+ *
+ * A demand fetch of a page that has a replica is first sent only to
+ * the page's own slave.  If the page hasn't arrived once the fetch
+ * has taken longer than the given percentile of recent fetches, the
+ * page is requested from the replica as well, and whichever copy
+ * arrives first is used.  Both copies land in staging buffers
+ * because neither request can be withdrawn; the losing copy becomes
+ * a straggler whose buffer is reused once it arrives.  Until a slave
+ * delivers its stragglers, pages it holds that have replicas are
+ * fetched from the replica alone.
+ *
+ * Only a page-replacement module that reports clean pages (NRU) ever
+ * replicates anything.
+ */
+
+#include "jumbomem.h"
+
+/* Define the fraction (1/REPLICA_SHARE) of the slaves' memory that
+ * holds replicas. */
+#ifndef REPLICA_SHARE
+# define REPLICA_SHARE 8
+#endif
+
+/* Define the number of recent fetch latencies from which to compute
+ * the hedging threshold and how often to recompute it. */
+#ifndef LATENCY_SAMPLES
+# define LATENCY_SAMPLES 1024
+#endif
+#ifndef LATENCY_RECOMPUTE
+# define LATENCY_RECOMPUTE 256
+#endif
+
+/* Represent a staging buffer and the fetch, if any, filling it. */
+typedef struct {
+  char *buffer;              /* Page-sized buffer */
+  void *state;               /* Fetch in flight into the buffer (NULL=none) */
+  size_t slave;              /* Slave from which the fetch is fetching */
+} STAGED_FETCH;
+
+/* Describe the demand fetch currently in progress. */
+typedef struct {
+  char *address;             /* Page being fetched */
+  char *target;              /* Where the page should end up */
+  uint64_t start;            /* Time in microseconds at which the fetch began */
+  size_t slot;               /* Replica slot being read or NO_SLOT if none */
+  void *direct;              /* Fetch directly into target if unstaged */
+  STAGED_FETCH *primary;     /* Fetch from the page's own slave if staged */
+  STAGED_FETCH *replica;     /* Fetch from the replica once hedged (else NULL) */
+} HEDGED_FETCH;
+
+#define NO_SLOT ((size_t)(~0))
+#define NUM_STAGED (JM_MAX_STRAGGLERS+2)
+
+static char *replicas = NULL;        /* First address of the replica area */
+static size_t numslots = 0;          /* Number of page-sized slots in the replica area */
+static size_t numsets = 0;           /* numslots/numslaves */
+static uint32_t *tags = NULL;        /* Page number + 1 replicated in each slot (0=none) */
+static unsigned char *evicted_clean = NULL;   /* Bitmap of pages evicted clean since last dirty */
+static char *send_buffer = NULL;     /* Copy of the page being replicated */
+static void *send_state = NULL;      /* Replication in flight from send_buffer (NULL=none) */
+static STAGED_FETCH staged[NUM_STAGED];   /* Staging buffers for hedged fetches */
+static HEDGED_FETCH current;         /* Demand fetch in progress */
+static uint64_t latency[LATENCY_SAMPLES];    /* Recent fetch latencies in microseconds */
+static uint64_t scratch[LATENCY_SAMPLES];    /* Scratch space for selecting a percentile */
+static unsigned long numsamples = 0; /* Number of latencies ever recorded */
+static uint64_t threshold = 0;       /* Latency past which to hedge (0=not yet known) */
+
+#ifdef JM_DEBUG
+static unsigned long pages_replicated = 0;     /* Number of pages copied to a replica */
+static unsigned long replicas_invalidated = 0; /* Number of replicas made stale by a dirty eviction */
+static unsigned long replicas_skipped = 0;     /* Number of pages not replicated because a slave was slow */
+static unsigned long hedged_fetches = 0;       /* Number of fetches also sent to a replica */
+static unsigned long replica_wins = 0;         /* Number of hedged fetches the replica won */
+static unsigned long diverted_fetches = 0;     /* Number of fetches sent only to a replica */
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+/* Return the replica slot for a given page.  Round-robin distribution
+ * puts slot s on slave s mod numslaves, so shifting by one keeps a
+ * page and its replica on different slaves. */
+static inline size_t
+replica_slot (size_t pagenum)
+{
+  unsigned int numslaves = jm_globals.numslaves;   /* Cache of the slave count */
+
+  return ((pagenum/numslaves) % numsets)*numslaves + (pagenum+1)%numslaves;
+}
+
+
+/* Return the address at which a replica slot is stored. */
+static inline char *
+slot_address (size_t slot)
+{
+  return replicas + slot*jm_globals.pagesize;
+}
+
+
+/* Return the kth smallest of n values, reordering them in the
+ * process.  Latencies are often equal, so values equal to the pivot
+ * are gathered in the middle. */
+static uint64_t
+select_kth (uint64_t *values, size_t n, size_t k)
+{
+  size_t lo = 0, hi = n - 1;   /* Range of values that contains the kth smallest */
+
+  while (lo < hi) {
+    uint64_t pivot = values[(lo + hi) / 2];
+    size_t lt = lo;          /* values[lo..lt) are less than pivot */
+    size_t gt = hi;          /* values(gt..hi] are greater than pivot */
+    size_t i = lo;           /* values[lt..i) equal pivot */
+
+    while (i <= gt) {
+      uint64_t value = values[i];
+
+      if (value < pivot) {
+        values[i++] = values[lt];
+        values[lt++] = value;
+      }
+      else if (value > pivot) {
+        values[i] = values[gt];
+        values[gt--] = value;
+      }
+      else
+        i++;
+    }
+    if (k < lt)
+      hi = lt - 1;
+    else if (k > gt)
+      lo = gt + 1;
+    else
+      return pivot;
+  }
+  return values[k];
+}
+
+
+/* Record how long a demand fetch took and periodically recompute the
+ * latency past which fetches are hedged. */
+static void
+record_latency (uint64_t elapsed)
+{
+  size_t n;                  /* Number of valid entries in latency[] */
+
+  latency[numsamples % LATENCY_SAMPLES] = elapsed;
+  numsamples++;
+  if (numsamples % LATENCY_RECOMPUTE != 0)
+    return;
+  n = numsamples < LATENCY_SAMPLES ? numsamples : LATENCY_SAMPLES;
+  memcpy(scratch, latency, n*sizeof(uint64_t));
+  threshold = select_kth(scratch, n, (n - 1)*jm_globals.hedge_percentile/100);
+  if (threshold == 0)
+    threshold = 1;
+  jm_debug_printf(4, "Hedging fetches that take longer than %" PRIu64 " microseconds.\n",
+                  threshold);
+}
+
+
+/* Release the buffers of stragglers whose pages have arrived and
+ * return the number of staging buffers available. */
+static unsigned int
+reap_stragglers (void)
+{
+  unsigned int numfree = 0;
+  unsigned int i;
+
+  for (i=0; i<NUM_STAGED; i++) {
+    if (staged[i].state && jm_fetch_test(staged[i].state))
+      staged[i].state = NULL;
+    if (!staged[i].state)
+      numfree++;
+  }
+  return numfree;
+}
+
+
+/* Return 1 if a given slave has yet to deliver a page that was also
+ * fetched from a replica, 0 otherwise. */
+static int
+slave_is_lagging (size_t slave)
+{
+  unsigned int i;
+
+  for (i=0; i<NUM_STAGED; i++)
+    if (staged[i].state && staged[i].slave == slave)
+      return 1;
+  return 0;
+}
+
+
+/* Start fetching a page into an available staging buffer. */
+static STAGED_FETCH *
+stage_fetch (char *fetch_addr)
+{
+  unsigned int i;
+
+  for (i=0; i<NUM_STAGED; i++)
+    if (!staged[i].state) {
+      if (!staged[i].buffer)
+        staged[i].buffer = (char *) jm_valloc(jm_globals.pagesize);
+      staged[i].state = jm_fetch_begin(fetch_addr, staged[i].buffer, jm_globals.pagesize);
+      staged[i].slave = GET_SLAVE_NUM(fetch_addr);
+      return &staged[i];
+    }
+  jm_abort("Internal error: No staging buffer is available for a hedged fetch");
+  return NULL;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* Copy a clean page to its replica slot unless it's already there or
+ * this is the first time the page has been evicted clean. */
+void
+jm_replicate_page (char *rounded_addr)
+{
+  size_t pagenum;            /* Page number of rounded_addr */
+  size_t slot;               /* Slot to which to replicate the page */
+
+  if (!replicas)
+    return;
+  pagenum = GET_PAGE_NUMBER(rounded_addr);
+  if (!(evicted_clean[pagenum/8] & (1 << (pagenum%8)))) {
+    evicted_clean[pagenum/8] |= 1 << (pagenum%8);
+    return;
+  }
+  slot = replica_slot(pagenum);
+  if (pagenum >= UINT32_MAX
+      || tags[slot] == (uint32_t)(pagenum + 1)
+      || slot == current.slot
+      || GET_SLAVE_NUM(slot_address(slot)) == GET_SLAVE_NUM(rounded_addr))
+    return;
+
+  /* Send a copy of the page unless the previous copy is still in
+   * flight or the replica's slave still owes us a page, either of
+   * which suggests that the slave is slow to respond. */
+  if ((send_state && !jm_evict_test(send_state))
+      || slave_is_lagging(GET_SLAVE_NUM(slot_address(slot)))) {
+#ifdef JM_DEBUG
+    replicas_skipped++;
+#endif
+    return;
+  }
+  send_state = NULL;
+  jm_copy_page(send_buffer, rounded_addr, jm_globals.pagesize);
+  send_state = jm_evict_begin(slot_address(slot), send_buffer, jm_globals.pagesize);
+  tags[slot] = (uint32_t)(pagenum + 1);
+#ifdef JM_DEBUG
+  pages_replicated++;
+#endif
+}
+
+
+/* Forget a page's replica, which no longer matches the page, and
+ * start counting the page's clean evictions afresh. */
+void
+jm_invalidate_replica (char *rounded_addr)
+{
+  size_t pagenum;            /* Page number of rounded_addr */
+  size_t slot;               /* Slot that may hold the page's replica */
+
+  if (!replicas)
+    return;
+  pagenum = GET_PAGE_NUMBER(rounded_addr);
+  evicted_clean[pagenum/8] &= ~(1 << (pagenum%8));
+  slot = replica_slot(pagenum);
+  if (pagenum < UINT32_MAX && tags[slot] == (uint32_t)(pagenum + 1)) {
+    tags[slot] = 0;
+#ifdef JM_DEBUG
+    replicas_invalidated++;
+#endif
+  }
+}
+
+
+/* Begin a demand fetch of a page into fetch_page.  Once the hedging
+ * threshold is known, a page that has a replica is fetched from the
+ * replica alone if its own slave still owes us an earlier page and
+ * otherwise is staged so the fetch can be hedged. */
+void
+jm_hedged_fetch_begin (char *fetch_addr, char *fetch_page)
+{
+  size_t pagenum = GET_PAGE_NUMBER(fetch_addr);   /* Page number of fetch_addr */
+
+  current.address = fetch_addr;
+  current.target = fetch_page;
+  current.slot = NO_SLOT;
+  current.direct = NULL;
+  current.primary = NULL;
+  current.replica = NULL;
+  current.start = jm_current_time();
+  if (replicas && threshold && pagenum < UINT32_MAX
+      && tags[replica_slot(pagenum)] == (uint32_t)(pagenum + 1)) {
+    unsigned int numfree = reap_stragglers();   /* Number of available staging buffers */
+
+    current.slot = replica_slot(pagenum);
+    if (slave_is_lagging(GET_SLAVE_NUM(fetch_addr))
+        && !slave_is_lagging(GET_SLAVE_NUM(slot_address(current.slot)))) {
+      jm_debug_printf(4, "Fetching page %p only from its replica in slot %lu.\n",
+                      fetch_addr, current.slot);
+      current.direct = jm_fetch_begin(slot_address(current.slot), fetch_page, jm_globals.pagesize);
+#ifdef JM_DEBUG
+      diverted_fetches++;
+#endif
+      return;
+    }
+    if (numfree >= 2) {
+      current.primary = stage_fetch(fetch_addr);
+      return;
+    }
+    current.slot = NO_SLOT;
+  }
+  current.direct = jm_fetch_begin(fetch_addr, fetch_page, jm_globals.pagesize);
+}
+
+
+/* Complete the demand fetch begun by jm_hedged_fetch_begin(). */
+void
+jm_hedged_fetch_end (void)
+{
+  STAGED_FETCH *winner = NULL;   /* Staged fetch that completed first */
+
+  /* Wait normally for an unstaged fetch. */
+  if (!current.primary) {
+    jm_fetch_end(current.direct);
+    record_latency(jm_current_time() - current.start);
+    current.slot = NO_SLOT;
+    current.address = NULL;
+    return;
+  }
+
+  /* Poll the page's slave and, once the fetch is running late, the
+   * replica's slave until one of them delivers the page. */
+  while (!winner) {
+    if (jm_fetch_test(current.primary->state))
+      winner = current.primary;
+    else if (current.replica) {
+      if (jm_fetch_test(current.replica->state)) {
+        winner = current.replica;
+#ifdef JM_DEBUG
+        replica_wins++;
+#endif
+      }
+    }
+    else if (jm_current_time() - current.start >= threshold) {
+      jm_debug_printf(4, "Fetching the replica of page %p from slot %lu.\n",
+                      current.address, current.slot);
+      current.replica = stage_fetch(slot_address(current.slot));
+#ifdef JM_DEBUG
+      hedged_fetches++;
+#endif
+    }
+  }
+  record_latency(jm_current_time() - current.start);
+  jm_copy_page(current.target, winner->buffer, jm_globals.pagesize);
+  winner->state = NULL;
+  current.slot = NO_SLOT;
+  current.address = NULL;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* Take the replica area from the top of the slaves' memory. */
+void
+jm_initialize_replicas (void)
+{
+  size_t unit;               /* Granularity of the replica area */
+  size_t numbytes;           /* Number of bytes in the replica area */
+
+  current.slot = NO_SLOT;
+  if (!jm_globals.hedge_percentile)
+    return;
+  if (jm_globals.numslaves < 2) {
+    jm_debug_printf(1, "WARNING: Hedged fetches require at least two slaves; not replicating pages.\n");
+    jm_globals.hedge_percentile = 0;
+    return;
+  }
+  if (!jm_pagereplace_reports_clean()) {
+    jm_debug_printf(1, "WARNING: Hedged fetches require a page-replacement algorithm that reports clean pages (NRU with JM_NRU_RW=0); not replicating pages.\n");
+    jm_globals.hedge_percentile = 0;
+    return;
+  }
+  unit = jm_globals.pagesize * jm_globals.numslaves;
+  numbytes = (jm_globals.slave_extent/REPLICA_SHARE/unit) * unit;
+  if (numbytes == 0) {
+    jm_debug_printf(1, "WARNING: Too little slave memory to hold replicas; not replicating pages.\n");
+    jm_globals.hedge_percentile = 0;
+    return;
+  }
+  numslots = numbytes / jm_globals.pagesize;
+  numsets = numslots / jm_globals.numslaves;
+  tags = (uint32_t *) jm_malloc(numslots*sizeof(uint32_t));
+  memset(tags, 0, numslots*sizeof(uint32_t));
+  evicted_clean = (unsigned char *) jm_malloc(jm_globals.slave_extent/jm_globals.pagesize/8 + 1);
+  memset(evicted_clean, 0, jm_globals.slave_extent/jm_globals.pagesize/8 + 1);
+  send_buffer = (char *) jm_valloc(jm_globals.pagesize);
+  replicas = jm_carve_slave_storage(numbytes);
+  jm_debug_printf(2, "Setting aside %sB of slave memory for replicas of up to %lu pages.\n",
+                  jm_format_power_of_2((uint64_t)numbytes, 1), numslots);
+}
+
+
+/* Wait for every outstanding transfer and report what we did. */
+void
+jm_finalize_replicas (void)
+{
+  unsigned int i;
+
+  if (!replicas)
+    return;
+  for (i=0; i<NUM_STAGED; i++) {
+    if (staged[i].state)
+      jm_fetch_end(staged[i].state);
+    staged[i].state = NULL;
+    jm_free(staged[i].buffer);
+    staged[i].buffer = NULL;
+  }
+  if (send_state)
+    jm_evict_end(send_state);
+  send_state = NULL;
+#ifdef JM_DEBUG
+  jm_debug_printf(2, "Replicated %lu pages (skipping %lu because a slave was slow) and invalidated %lu replicas.\n",
+                  pages_replicated, replicas_skipped, replicas_invalidated);
+  jm_debug_printf(2, "Hedged %lu fetches (threshold %" PRIu64 " microseconds), %lu of which the replica won; sent %lu fetches only to a replica.\n",
+                  hedged_fetches, threshold, replica_wins, diverted_fetches);
+#endif
+  jm_free(send_buffer);
+  send_buffer = NULL;
+  jm_free(tags);
+  tags = NULL;
+  jm_free(evicted_clean);
+  evicted_clean = NULL;
+  replicas = NULL;
+}
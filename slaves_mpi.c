@@ -31,14 +31,17 @@
 #include <mpi.h>
 
 #ifndef MAX_PENDING_FETCHES
-# define MAX_PENDING_FETCHES 2
+# define MAX_PENDING_FETCHES (JM_MAX_PREFETCH_DEPTH+2+JM_MAX_REGION_TRANSFERS+JM_MAX_STRAGGLERS)
 #endif
 #ifndef MAX_PENDING_EVICTIONS
-# define MAX_PENDING_EVICTIONS 2
+# define MAX_PENDING_EVICTIONS (3+JM_MAX_REGION_TRANSFERS)
 #endif
 
-/* Convert a pointer to a buffer offset to a valid memory address. */
-#define OFSP2ADDR(OFS) (buffer + FROM_NETWORK(*(size_t *)(OFS)))
+/* Convert a pointer to a buffer offset within a given master's slice
+ * of our buffer to a valid memory address.  The offset is followed by
+ * the number of bytes to transfer. */
+#define OFSP2ADDR(MASTER, OFS) (buffer + (MASTER)*slicebytes + FROM_NETWORK(((size_t *)(OFS))[0]))
+#define OFSP2BYTES(OFS) ((int) FROM_NETWORK(((size_t *)(OFS))[1]))
 
 
 /* Define the internal state needed for a split-phase fetch. */
@@ -52,6 +55,7 @@ typedef struct {
 typedef struct {
   int          valid;       /* 0=available; 1=in use */
   char        *address;     /* Virtual address to evict */
+  size_t       header[2];   /* Slave buffer offset and byte count to put */
   MPI_Request  requests[2]; /* MPI state for a nonblocking send of address + data */
 } EVICT_STATE;
 
@@ -70,6 +74,10 @@ static char *buffer = NULL;           /* One slave's memory buffer */
 static FETCH_STATE fetch_state[MAX_PENDING_FETCHES];   /* Set of split-phase fetch state */
 static EVICT_STATE evict_state[MAX_PENDING_EVICTIONS]; /* Set of split-phase eviction state */
 static int rank;                      /* Our rank in the computation */
+static int nummasters = 1;            /* Number of masters (ranks 0 to nummasters-1) */
+static size_t slicebytes;             /* Bytes of each slave's buffer devoted to each master */
+static MPI_Comm jm_comm;              /* Private communicator for master-slave traffic */
+static MPI_Comm master_comm = MPI_COMM_NULL;   /* Communicator spanning only the masters */
 #ifdef JM_DEBUG
 static struct rusage initial_usage;   /* Memory usage when entering the main loop */
 #endif
@@ -84,6 +92,10 @@ slave_event_loop (void)
   MPI_Status status;          /* A message's MPI receive status */
   MPI_Request request;        /* Handle to an MPI asynchronous-receive */
   char *next_touch = buffer;  /* Next word of memory to touch */
+  int live_masters = nummasters;  /* Number of masters that haven't yet told us to terminate */
+  int master;                 /* Rank of the master that sent the current command */
+  char *put_addr;             /* Address within our buffer to which to write a page */
+  int put_bytes;              /* Number of bytes to write to the above */
 
   /* Receive and process messages until we're told to stop. */
   recvbuf = (char *) jm_valloc(pagesize);
@@ -91,7 +103,7 @@ slave_event_loop (void)
     /* While we wait for a mesasge to arrive we touch each page in
      * turn in hopes of discouraging the operating system from
      * reclaiming some of the pages we haven't accessed recently. */
-    MPI_Irecv((void *)recvbuf, pagesize, MPI_BYTE, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &request);
+    MPI_Irecv((void *)recvbuf, pagesize, MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, jm_comm, &request);
     while (1) {
       int recv_complete;      /* 1=a mesasge arrived; 0=still waiting */
 
@@ -105,19 +117,23 @@ slave_event_loop (void)
     }
 
     /* Decide based on the message tag what to do next. */
+    master = status.MPI_SOURCE;
     switch (status.MPI_TAG) {
       case JM_MPI_PUT_OFFSET:
-        /* The master is telling us where it'll next write to. */
-        MPI_Recv(jm_globals.extra_memcpy ? (void *)recvbuf : OFSP2ADDR(recvbuf),
-                 pagesize, MPI_BYTE, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        /* The master is telling us where it'll next write to.  We
+         * must compute the address before receiving the data into
+         * recvbuf, which overwrites the offset. */
+        put_addr = OFSP2ADDR(master, recvbuf);
+        put_bytes = OFSP2BYTES(recvbuf);
+        MPI_Recv(jm_globals.extra_memcpy ? (void *)recvbuf : put_addr,
+                 put_bytes, MPI_BYTE, master, MPI_ANY_TAG, jm_comm, &status);
         if (status.MPI_TAG != JM_MPI_PUT_DATA
             && status.MPI_TAG != JM_MPI_TERMINATE)
           jm_abort("Expected MPI tag %d but received MPI tag %d",
                    JM_MPI_PUT_DATA, status.MPI_TAG);
         if (jm_globals.extra_memcpy)
-          memcpy((void *)(OFSP2ADDR(recvbuf)), (void *)recvbuf, pagesize);
-	jm_debug_printf(5, "Processed a JM_MPI_PUT_OFFSET of address %p.\n",
-			jm_globals.extra_memcpy ? (void *)recvbuf : OFSP2ADDR(recvbuf));
+          jm_copy_page(put_addr, recvbuf, put_bytes);
+	jm_debug_printf(5, "Processed a JM_MPI_PUT_OFFSET of address %p.\n", put_addr);
         break;
 
       case JM_MPI_PUT_DATA:
@@ -130,17 +146,20 @@ slave_event_loop (void)
       case JM_MPI_GET:
         /* The master wants a page from us. */
 	jm_debug_printf(5, "Processing a JM_MPI_GET of address %p.\n",
-			jm_globals.extra_memcpy ? (void *)recvbuf : OFSP2ADDR(recvbuf));
+			jm_globals.extra_memcpy ? (void *)recvbuf : OFSP2ADDR(master, recvbuf));
         if (jm_globals.extra_memcpy) {
-          memcpy((void *)recvbuf, (void *)(OFSP2ADDR(recvbuf)), pagesize);
-          MPI_Rsend(recvbuf, pagesize, MPI_BYTE, 0, JM_MPI_RESPONSE, MPI_COMM_WORLD);
+          int get_bytes = OFSP2BYTES(recvbuf);   /* Number of bytes to send */
+
+          jm_copy_page(recvbuf, OFSP2ADDR(master, recvbuf), get_bytes);
+          MPI_Rsend(recvbuf, get_bytes, MPI_BYTE, master, JM_MPI_RESPONSE, jm_comm);
         }
         else
-          MPI_Rsend(OFSP2ADDR(recvbuf), pagesize, MPI_BYTE, 0, JM_MPI_RESPONSE, MPI_COMM_WORLD);
+          MPI_Rsend(OFSP2ADDR(master, recvbuf), OFSP2BYTES(recvbuf), MPI_BYTE, master, JM_MPI_RESPONSE, jm_comm);
         break;
 
       case JM_MPI_TERMINATE:
-        /* Break out of the loop. */
+        /* Break out of the loop once every master has terminated. */
+        live_masters--;
         break;
 
       default:
@@ -149,9 +168,9 @@ slave_event_loop (void)
         break;
     }
   }
-  while (status.MPI_TAG != JM_MPI_TERMINATE);
+  while (live_masters > 0);
 
-  /* The master instructed us to terminate.*/
+  /* The masters instructed us to terminate.*/
 #ifdef JM_DEBUG
   if (jm_globals.debuglevel >= 3) {
     struct rusage usage;   /* Information to report about our memory usage */
@@ -164,12 +183,13 @@ slave_event_loop (void)
                     usage.ru_nswap  - initial_usage.ru_nswap);
   }
 #endif
-  MPI_Finalize();
+  PMPI_Finalize();
   _exit(0);
 }
 
 
-/* Initialize MPI.  Only rank 0 returns to the caller. */
+/* Initialize MPI.  Only the masters (ranks 0 to JM_MASTERS-1) return
+ * to the caller. */
 void
 jm_initialize_slaves (void)
 {
@@ -177,6 +197,8 @@ jm_initialize_slaves (void)
   char **dummy_argv;                   /* Fake argv for MPI_Init() */
   char *dummy_argv_data[] = {"jumbomem", NULL};   /* Contents of the above */
   unsigned long min_memory;            /* Minimum free memory on any rank */
+  int numranks;                        /* Number of ranks in the computation */
+  int is_master;                       /* 1=we're a master; 0=we're a slave */
 
   /* Common initialization */
   if (jm_globals.debuglevel >= 3) {
@@ -188,24 +210,39 @@ jm_initialize_slaves (void)
   dummy_argv = dummy_argv_data;
   jm_exit_critical_section();         /* Enable MPI_Init() to spawn threads. */
   jm_globals.is_internal = 1;         /* MPI_Init() threads should use internal malloc() and friends. */
-  MPI_Init(&dummy_argc, &dummy_argv);
+  PMPI_Init(&dummy_argc, &dummy_argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  if (rank == 0)
+  MPI_Comm_size(MPI_COMM_WORLD, &numranks);
+
+  /* Divide the ranks into masters and slaves.  The masters get a
+   * communicator of their own to use in place of MPI_COMM_WORLD, and
+   * all master-slave traffic uses a private communicator so it can't
+   * be confused with the application's messages. */
+  if ((nummasters=(int)jm_getenv_positive_int("JM_MASTERS")) == 0)
+    nummasters = 1;
+  if (nummasters > numranks)
+    jm_abort("JM_MASTERS (%d) exceeds the number of ranks (%d)", nummasters, numranks);
+  is_master = rank < nummasters;
+  MPI_Comm_dup(MPI_COMM_WORLD, &jm_comm);
+  MPI_Comm_split(MPI_COMM_WORLD, is_master ? 0 : MPI_UNDEFINED, rank, &master_comm);
+  if (rank == 0 && nummasters == 1)
     jm_debug_printf(2, "The master task is running on %s.\n", jm_hostname());
+  else if (is_master)
+    jm_debug_printf(2, "Master #%d is running on %s.\n", rank, jm_hostname());
   else
     jm_debug_printf(3, "Slave #%d is running on %s.\n", rank, jm_hostname());
 
   /* Ensure that the master and slaves agree upon the logical page
    * size to use. */
-  MPI_Bcast((void *)&jm_globals.pagesize, 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+  MPI_Bcast((void *)&jm_globals.pagesize, 1, MPI_UNSIGNED_LONG, 0, jm_comm);
 
   /* Determine the minimum amount of memory that any slave can manage. */
-  if (rank == 0)
+  if (is_master)
     jm_globals.slavebytes = (size_t)(-1);    /* The master's memory is independent of the slaves'. */
   else {
     /* Allocate as much memory as we can. */
     do {
-      buffer = (char *) valloc(jm_globals.slavebytes);
+      buffer = jm_allocate_slave_buffer(jm_globals.slavebytes);
       if (!buffer) {
         jm_debug_printf(4, "Failed to allocate %ld bytes of memory (%s).\n",
                         jm_globals.slavebytes, jm_strerror(errno));
@@ -219,7 +256,7 @@ jm_initialize_slaves (void)
     jm_debug_printf(3, "Slave #%d can use at most %lu bytes of memory.\n",
                     rank, jm_globals.slavebytes);
   }
-  MPI_Allreduce((void *)&jm_globals.slavebytes, (void *)&min_memory, 1, MPI_UNSIGNED_LONG, MPI_MIN, MPI_COMM_WORLD);
+  MPI_Allreduce((void *)&jm_globals.slavebytes, (void *)&min_memory, 1, MPI_UNSIGNED_LONG, MPI_MIN, jm_comm);
   jm_globals.slavebytes = min_memory;
   if (jm_globals.slavebytes == (size_t)(-1)) {
     /* There must not be any slaves. */
@@ -231,7 +268,7 @@ jm_initialize_slaves (void)
   /* Reduce jm_globals.slavebytes by the number of bytes that fault
    * when touching each page. */
   if (jm_getenv_boolean("JM_REDUCEMEM") == 1) {
-    if (rank == 0)
+    if (is_master)
       jm_debug_printf(3, "Determining if using %lu bytes/slave leads to major page faults...\n",
                       jm_globals.slavebytes);
     else {
@@ -239,12 +276,9 @@ jm_initialize_slaves (void)
       long int newfaults;             /* Newly observed major page faults */
       size_t i;
 
-      /* Touch every page once to load every page into memory. */
-      for (i=0; i<jm_globals.slavebytes; i+=jm_globals.ospagesize)
-        buffer[i] = 0;
-
-      /* Touch every page again to determine how many pages actually
-       * fit into memory. */
+      /* jm_allocate_slave_buffer() already loaded every page into
+       * memory.  Touch every page again to determine how many pages
+       * actually fit into memory. */
       getrusage(RUSAGE_SELF, &usage0);
       for (i=0; i<jm_globals.slavebytes; i+=jm_globals.ospagesize)
         buffer[i] = 0;
@@ -258,7 +292,7 @@ jm_initialize_slaves (void)
         jm_globals.slavebytes -= newfaults*jm_globals.ospagesize;
       }
     }
-    MPI_Allreduce((void *)&jm_globals.slavebytes, (void *)&min_memory, 1, MPI_UNSIGNED_LONG, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce((void *)&jm_globals.slavebytes, (void *)&min_memory, 1, MPI_UNSIGNED_LONG, MPI_MIN, jm_comm);
     if (rank == 0) {
       if (jm_globals.slavebytes != min_memory)
         jm_debug_printf(2, "Reducing per-slave memory from %lu bytes to %lu bytes.\n",
@@ -269,13 +303,23 @@ jm_initialize_slaves (void)
     jm_globals.slavebytes = min_memory;
   }
 
+  /* Give each master an equal, page-aligned slice of each slave's
+   * memory. */
+  slicebytes = ((jm_globals.slavebytes/nummasters)/jm_globals.pagesize) * jm_globals.pagesize;
+  if (slicebytes == 0)
+    jm_abort("%lu bytes/slave is too little memory to divide among %d masters",
+             jm_globals.slavebytes, nummasters);
+  if (nummasters > 1 && rank == 0)
+    jm_debug_printf(3, "Each of %d masters can use %lu bytes of each slave's memory.\n",
+                    nummasters, slicebytes);
+
   /* Perform more initialization specific to either the master or slaves. */
-  if (rank == 0) {
+  if (is_master) {
     int i;
 
-    /* We're the master -- determine the number of slaves we're managing. */
-    MPI_Comm_size(MPI_COMM_WORLD, (int *)&jm_globals.numslaves);
-    jm_globals.numslaves--;              /* Rank 0 isn't a slave. */
+    /* We're a master -- determine the number of slaves we're managing. */
+    jm_globals.slavebytes = slicebytes;
+    jm_globals.numslaves = numranks - nummasters;
     for (i=0; i<MAX_PENDING_FETCHES; i++)
       fetch_state[i].valid = 0;
     jm_globals.is_internal = 0;
@@ -300,9 +344,8 @@ jm_initialize_slaves (void)
 
 /* Start evicting a given page. */
 void *
-jm_evict_begin (char *evict_addr, char *evict_buffer)
+jm_evict_begin (char *evict_addr, char *evict_buffer, size_t numbytes)
 {
-  static size_t put_offset;  /* Slave buffer offset to which to put a page */
   int put_slave;             /* Slave to which to put a page */
   EVICT_STATE *state;        /* Current state for the asynchronous operation */
   int i;
@@ -324,11 +367,12 @@ jm_evict_begin (char *evict_addr, char *evict_buffer)
 
   /* Begin the page eviction. */
   put_slave = (int)GET_SLAVE_NUM(evict_addr);
-  put_offset = TO_NETWORK(GET_SLAVE_OFFSET(evict_addr));
-  MPI_Isend((void *)&put_offset, sizeof(size_t), MPI_BYTE, put_slave+1,
-            JM_MPI_PUT_OFFSET, MPI_COMM_WORLD, &state->requests[0]);
-  MPI_Isend((void *)evict_buffer, (int)jm_globals.pagesize, MPI_BYTE, put_slave+1,
-            JM_MPI_PUT_DATA, MPI_COMM_WORLD, &state->requests[1]);
+  state->header[0] = TO_NETWORK(GET_SLAVE_OFFSET(evict_addr));
+  state->header[1] = TO_NETWORK(numbytes);
+  MPI_Isend((void *)state->header, 2*sizeof(size_t), MPI_BYTE, put_slave+nummasters,
+            JM_MPI_PUT_OFFSET, jm_comm, &state->requests[0]);
+  MPI_Isend((void *)evict_buffer, (int)numbytes, MPI_BYTE, put_slave+nummasters,
+            JM_MPI_PUT_DATA, jm_comm, &state->requests[1]);
 
   /* Return a pointer to our fetch state. */
   return (void *) state;
@@ -353,11 +397,27 @@ jm_evict_end (void *stateobj)
 }
 
 
+/* Finish evicting a given page if it has already been sent. */
+int
+jm_evict_test (void *stateobj)
+{
+  EVICT_STATE *state = (EVICT_STATE *) stateobj;
+  int complete;              /* 1=page has been sent; 0=still in flight */
+
+  MPI_Testall(2, state->requests, &complete, MPI_STATUSES_IGNORE);
+  if (!complete)
+    return 0;
+  state->valid = 0;
+  jm_debug_printf(4, "Found that the page at address %p has been evicted.\n", state->address);
+  return 1;
+}
+
+
 /* Start fetching a given page. */
 void *
-jm_fetch_begin (char *fetch_addr, char *fetch_buffer)
+jm_fetch_begin (char *fetch_addr, char *fetch_buffer, size_t numbytes)
 {
-  static size_t get_offset;  /* Slave buffer offset from which to get a page */
+  size_t header[2];          /* Slave buffer offset and byte count to get */
   int get_slave;             /* Slave from which to get a page */
   FETCH_STATE *state;        /* Current state for the asynchronous operation */
   int i;
@@ -379,11 +439,12 @@ jm_fetch_begin (char *fetch_addr, char *fetch_buffer)
 
   /* Fetch the given page from a slave. */
   get_slave = (int)GET_SLAVE_NUM(fetch_addr);
-  MPI_Irecv((void *)fetch_buffer, (int)jm_globals.pagesize, MPI_BYTE, get_slave+1,
-            JM_MPI_RESPONSE, MPI_COMM_WORLD, &state->request);
-  get_offset = TO_NETWORK(GET_SLAVE_OFFSET(fetch_addr));
-  MPI_Send((void *)&get_offset, sizeof(size_t), MPI_BYTE, get_slave+1,
-           JM_MPI_GET, MPI_COMM_WORLD);
+  MPI_Irecv((void *)fetch_buffer, (int)numbytes, MPI_BYTE, get_slave+nummasters,
+            JM_MPI_RESPONSE, jm_comm, &state->request);
+  header[0] = TO_NETWORK(GET_SLAVE_OFFSET(fetch_addr));
+  header[1] = TO_NETWORK(numbytes);
+  MPI_Send((void *)header, 2*sizeof(size_t), MPI_BYTE, get_slave+nummasters,
+           JM_MPI_GET, jm_comm);
 
   /* Return a pointer to our fetch state. */
   return (void *) state;
@@ -408,6 +469,22 @@ jm_fetch_end (void *stateobj)
 }
 
 
+/* Finish fetching a given page if it has already arrived. */
+int
+jm_fetch_test (void *stateobj)
+{
+  FETCH_STATE *state = (FETCH_STATE *) stateobj;
+  int complete;              /* 1=page has arrived; 0=still in flight */
+
+  MPI_Test(&state->request, &complete, MPI_STATUS_IGNORE);
+  if (!complete)
+    return 0;
+  state->valid = 0;
+  jm_debug_printf(4, "Found that the page at address %p has arrived.\n", state->address);
+  return 1;
+}
+
+
 /* Shut down cleanly. */
 void
 jm_finalize_slaves (void)
@@ -416,12 +493,51 @@ jm_finalize_slaves (void)
 
   /* Send each slave a shutdown message. */
   for (i=0; i<jm_globals.numslaves; i++)
-    MPI_Send("", 0, MPI_BYTE, i+1, JM_MPI_TERMINATE, MPI_COMM_WORLD);
+    MPI_Send("", 0, MPI_BYTE, i+nummasters, JM_MPI_TERMINATE, jm_comm);
 
   /* Shut down MPI. */
   jm_globals.is_internal = 1;   /* All MPI_Finalize() memory allocation should use internal routines. */
   jm_exit_critical_section();
-  MPI_Finalize();
+  PMPI_Finalize();
   jm_enter_critical_section();
   jm_globals.is_internal = 0;
 }
+
+/* ---------------------------------------------------------------------- */
+
+/* Store the communicator that spans all of the masters into a
+ * caller-provided MPI_Comm.  MPI applications should use this in
+ * place of MPI_COMM_WORLD, which also includes the slaves. */
+int
+jm_get_master_comm (void *comm)
+{
+  *(MPI_Comm *)comm = master_comm;
+  return 1;
+}
+
+
+/* JumboMem has already initialized MPI by the time the application
+ * calls MPI_Init(). */
+int
+MPI_Init (int *argc, char ***argv)
+{
+  return MPI_SUCCESS;
+}
+
+
+/* JumboMem has already initialized MPI by the time the application
+ * calls MPI_Init_thread().  Report the thread level we actually got. */
+int
+MPI_Init_thread (int *argc, char ***argv, int required, int *provided)
+{
+  return MPI_Query_thread(provided);
+}
+
+
+/* Defer shutting down MPI until JumboMem itself exits because the
+ * slaves are still serving our pages. */
+int
+MPI_Finalize (void)
+{
+  return MPI_SUCCESS;
+}
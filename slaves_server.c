@@ -0,0 +1,424 @@
+/*----------------------------------------------------------------
+ * JumboMem memory server: Slaves provided by standalone jmserver
+ * daemons
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ *----------------------------------------------------------------*/
+
+/*
+ * Copyright (C) 2010 Los Alamos National Security, LLC
+ *
+ * This material was produced under U.S. Government contract
+ * DE-AC52-06NA25396 for Los Alamos National Laboratory (LANL), which
+ * is operated by Los Alamos National Security, LLC for the
+ * U.S. Department of Energy.  The U.S. Government has rights to use,
+ * reproduce, and distribute this software.  NEITHER THE GOVERNMENT
+ * NOR LOS ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS
+ * OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.
+ * If software is modified to produce derivative works, such modified
+ * software should be clearly marked so as not to confuse it with the
+ * version available from LANL.
+ *
+ * Additionally, this program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; version 2.0
+ * of the License.  Accordingly, this program is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ */
+
+
+/*
+ * Each entry in JM_SERVERS names a jmserver daemon, either as
+ * host[:port] (TCP) or as the filename of a Unix-domain socket.  Each
+ * daemon acts as one slave.  The master leases the same number of
+ * bytes from every daemon and releases its leases when it exits.
+ */
+
+#include "jumbomem.h"
+#include "jmserver.h"
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifndef MAX_PENDING_FETCHES
+# define MAX_PENDING_FETCHES (JM_MAX_PREFETCH_DEPTH+2+JM_MAX_REGION_TRANSFERS+JM_MAX_STRAGGLERS)
+#endif
+#ifndef MAX_PENDING_EVICTIONS
+# define MAX_PENDING_EVICTIONS (3+JM_MAX_REGION_TRANSFERS)
+#endif
+
+/* Define the internal state needed for a split-phase fetch. */
+typedef struct {
+  int           valid;     /* 0=available; 1=in use */
+  int           complete;  /* 1=page has arrived; 0=still in flight */
+  char         *address;   /* Virtual address to fetch */
+  char         *buffer;    /* Buffer into which to fetch */
+  size_t        numbytes;  /* Number of bytes to fetch */
+  int           server;    /* Server from which we're fetching */
+  unsigned long sequence;  /* Position of the reply in the server's reply stream */
+} FETCH_STATE;
+
+/* Define our connection to a single server. */
+typedef struct {
+  int           sockfd;    /* Socket connected to the server */
+  unsigned long sent;      /* Number of JMS_GET commands sent */
+  unsigned long received;  /* Number of JMS_GET replies received */
+} SERVER;
+
+extern JUMBOMEM_GLOBALS jm_globals;   /* All of our other global variables */
+static SERVER *servers = NULL;        /* Connections to every server */
+static FETCH_STATE fetch_state[MAX_PENDING_FETCHES];   /* Set of split-phase fetch state */
+static int evict_state[MAX_PENDING_EVICTIONS];         /* Set of eviction state (1=in use) */
+
+
+/* Read exactly numbytes bytes from a server.  Abort on failure.  We
+ * use recv() because our read() wrapper prefaults its buffer, which
+ * would fault on a page of the global address space that we're in
+ * the middle of fetching. */
+static void
+read_fully (int server, void *buffer, size_t numbytes)
+{
+  char *bufptr = (char *) buffer;
+
+  while (numbytes > 0) {
+    ssize_t numread = recv(servers[server].sockfd, bufptr, numbytes, 0);
+
+    if (numread == -1 && errno == EINTR)
+      continue;
+    if (numread <= 0)
+      jm_abort("Failed to read from memory server %d (%s)",
+               server, numread == 0 ? "connection closed" : jm_strerror(errno));
+    bufptr += numread;
+    numbytes -= numread;
+  }
+}
+
+
+/* Write a header and optional page to a server.  A page is arg2
+ * bytes long.  Abort on failure. */
+static void
+send_command (int server, JMS_COMMAND command, uint64_t arg1, uint64_t arg2, char *page)
+{
+  JMS_HEADER header;       /* Command header */
+  struct iovec iov[2];     /* Header plus optional page */
+  struct iovec *iovp = iov;    /* First iov[] entry not yet fully written */
+  int iovcnt = page ? 2 : 1;   /* Number of iov[] entries not yet fully written */
+
+  header.command = htonl((uint32_t)command);
+  header.unused = 0;
+  header.arg1 = jms_hton64(arg1);
+  header.arg2 = jms_hton64(arg2);
+  iov[0].iov_base = (void *) &header;
+  iov[0].iov_len = sizeof(JMS_HEADER);
+  iov[1].iov_base = (void *) page;
+  iov[1].iov_len = (size_t) arg2;
+  while (iovcnt > 0) {
+    ssize_t numwritten = writev(servers[server].sockfd, iovp, iovcnt);
+
+    if (numwritten == -1 && errno == EINTR)
+      continue;
+    if (numwritten <= 0)
+      jm_abort("Failed to write to memory server %d (%s)", server, jm_strerror(errno));
+    while (iovcnt > 0 && (size_t)numwritten >= iovp->iov_len) {
+      numwritten -= iovp->iov_len;
+      iovp++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iovp->iov_base = (char *)iovp->iov_base + numwritten;
+      iovp->iov_len -= numwritten;
+    }
+  }
+}
+
+
+/* Receive the next page a server sends us and store it in the buffer
+ * of whichever fetch is waiting for it. */
+static void
+receive_next_page (int server)
+{
+  unsigned long sequence = servers[server].received;   /* Reply we expect next */
+  int i;
+
+  for (i=0; i<MAX_PENDING_FETCHES; i++) {
+    FETCH_STATE *state = &fetch_state[i];
+
+    if (state->valid && !state->complete
+        && state->server == server && state->sequence == sequence) {
+      read_fully(server, state->buffer, state->numbytes);
+      state->complete = 1;
+      servers[server].received++;
+      return;
+    }
+  }
+  jm_abort("Received an unexpected page from memory server %d", server);
+}
+
+
+/* Connect to a single server and return the socket. */
+static int
+connect_to_server (char *serverspec)
+{
+  int sockfd;              /* Socket connected to the server */
+
+  if (strchr(serverspec, '/')) {
+    /* Unix-domain socket */
+    struct sockaddr_un addr;   /* Socket address */
+
+    if (strlen(serverspec) >= sizeof(addr.sun_path))
+      jm_abort("Memory-server socket name %s is too long", serverspec);
+    if ((sockfd=socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+      jm_abort("Failed to create a socket (%s)", jm_strerror(errno));
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, serverspec);
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+      jm_abort("Failed to connect to memory server %s (%s)", serverspec, jm_strerror(errno));
+  }
+  else {
+    /* TCP socket */
+    char *hostname;        /* Server's host name */
+    char portname[25];     /* Server's port number as a string */
+    char *colon;           /* Colon separating the host name from the port */
+    struct addrinfo hints; /* Constraints on the addresses getaddrinfo() returns */
+    struct addrinfo *addrs;   /* List of addresses returned by getaddrinfo() */
+    struct addrinfo *ai;   /* One address in the above */
+    int one = 1;           /* Value to pass to setsockopt() */
+    int retval;            /* Return value from getaddrinfo() */
+
+    hostname = (char *) jm_malloc(strlen(serverspec) + 1);
+    strcpy(hostname, serverspec);
+    if ((colon=strrchr(hostname, ':'))) {
+      *colon = '\0';
+      strncpy(portname, colon+1, sizeof(portname)-1);
+      portname[sizeof(portname)-1] = '\0';
+    }
+    else
+      sprintf(portname, "%d", JMS_DEFAULT_PORT);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((retval=getaddrinfo(hostname, portname, &hints, &addrs)) != 0)
+      jm_abort("Failed to look up memory server %s (%s)", serverspec, gai_strerror(retval));
+    sockfd = -1;
+    for (ai=addrs; ai; ai=ai->ai_next) {
+      if ((sockfd=socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1)
+        continue;
+      if (connect(sockfd, ai->ai_addr, ai->ai_addrlen) == 0)
+        break;
+      close(sockfd);
+      sockfd = -1;
+    }
+    freeaddrinfo(addrs);
+    jm_free(hostname);
+    if (sockfd == -1)
+      jm_abort("Failed to connect to memory server %s (%s)", serverspec, jm_strerror(errno));
+    (void) setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return sockfd;
+}
+
+
+/* Connect to every server listed in JM_SERVERS and lease the same
+ * amount of memory from each. */
+void
+jm_initialize_slaves (void)
+{
+  char *serverlist;        /* Copy of JM_SERVERS */
+  char *serverspec;        /* One server in the above */
+  char *saveptr;           /* State for strtok_r() */
+  size_t request;          /* Number of bytes to request from each server */
+  size_t min_lease = (size_t)(-1);   /* Smallest lease any server granted */
+  JMS_HEADER reply;        /* Reply to a command */
+  unsigned int i;
+
+  /* Parse the list of servers. */
+  jm_debug_printf(3, "slaves_server is initializing.\n");
+  if (jm_getenv_positive_int("JM_MASTERS") > 1)
+    jm_abort("slaves_server supports only a single master (JM_MASTERS=%s)", getenv("JM_MASTERS"));
+  if (!getenv("JM_SERVERS"))
+    jm_abort("JM_SERVERS must list at least one memory server");
+  serverlist = (char *) jm_malloc(strlen(getenv("JM_SERVERS")) + 1);
+  strcpy(serverlist, getenv("JM_SERVERS"));
+  jm_globals.numslaves = 0;
+  for (serverspec=strtok_r(serverlist, ", ", &saveptr);
+       serverspec;
+       serverspec=strtok_r(NULL, ", ", &saveptr)) {
+    servers = (SERVER *) jm_realloc(servers, (jm_globals.numslaves+1)*sizeof(SERVER));
+    servers[jm_globals.numslaves].sockfd = connect_to_server(serverspec);
+    servers[jm_globals.numslaves].sent = 0;
+    servers[jm_globals.numslaves].received = 0;
+    jm_debug_printf(3, "Memory server %u is %s.\n", jm_globals.numslaves, serverspec);
+    jm_globals.numslaves++;
+  }
+  jm_free(serverlist);
+  if (jm_globals.numslaves == 0)
+    jm_abort("JM_SERVERS must list at least one memory server");
+
+  /* Lease memory from each server.  The servers have already
+   * allocated and locked their memory so there's nothing to probe.
+   * Request JM_SLAVEMEM bytes if specified or else as much as each
+   * server's quota allows. */
+  request = getenv("JM_SLAVEMEM") ? jm_globals.slavebytes : 0;
+  for (i=0; i<jm_globals.numslaves; i++) {
+    send_command(i, JMS_HELLO, jm_globals.pagesize, request, NULL);
+    read_fully(i, &reply, sizeof(JMS_HEADER));
+    reply.arg1 = jms_ntoh64(reply.arg1);
+    jm_debug_printf(3, "Memory server %u leased us %lu bytes (%lu bytes remain unleased).\n",
+                    i, (unsigned long)reply.arg1, (unsigned long)jms_ntoh64(reply.arg2));
+    if (reply.arg1 == 0)
+      jm_abort("Memory server %u has no memory available to lease", i);
+    if ((size_t)reply.arg1 < min_lease)
+      min_lease = (size_t)reply.arg1;
+  }
+
+  /* Address arithmetic requires every slave to manage the same amount
+   * of memory so return any excess. */
+  for (i=0; i<jm_globals.numslaves; i++) {
+    send_command(i, JMS_TRIM, min_lease, 0, NULL);
+    read_fully(i, &reply, sizeof(JMS_HEADER));
+    if ((size_t)jms_ntoh64(reply.arg1) != min_lease)
+      jm_abort("Memory server %u failed to trim our lease to %lu bytes", i, min_lease);
+  }
+  jm_globals.slavebytes = min_lease;
+  for (i=0; i<MAX_PENDING_FETCHES; i++)
+    fetch_state[i].valid = 0;
+}
+
+
+/* Start evicting a given page.  Servers don't acknowledge evictions
+ * so the eviction completes once the page is written to the socket. */
+void *
+jm_evict_begin (char *evict_addr, char *evict_buffer, size_t numbytes)
+{
+  int put_server;          /* Server to which to put a page */
+  int i;
+
+  /* Announce what we're about to do. */
+  jm_debug_printf(4, "Evicting the page at address %p.\n", evict_addr);
+
+  /* Acquire new internal state. */
+  for (i=0; i<MAX_PENDING_EVICTIONS; i++)
+    if (!evict_state[i]) {
+      evict_state[i] = 1;
+      break;
+    }
+  if (i == MAX_PENDING_EVICTIONS)
+    jm_abort("Too many evictions (%ld) are concurrently outstanding", MAX_PENDING_EVICTIONS+1);
+
+  /* Drain any replies the server is waiting to send us so it isn't
+   * blocked writing while we're blocked writing a full page. */
+  put_server = (int)GET_SLAVE_NUM(evict_addr);
+  while (servers[put_server].received < servers[put_server].sent)
+    receive_next_page(put_server);
+  send_command(put_server, JMS_PUT, GET_SLAVE_OFFSET(evict_addr), numbytes, evict_buffer);
+  return (void *) &evict_state[i];
+}
+
+
+/* Finish evicting a given page. */
+void
+jm_evict_end (void *stateobj)
+{
+  jm_debug_printf(4, "Completing a page eviction.\n");
+  *(int *)stateobj = 0;
+}
+
+
+/* Evictions complete as soon as they begin. */
+int
+jm_evict_test (void *stateobj)
+{
+  jm_evict_end(stateobj);
+  return 1;
+}
+
+
+/* Start fetching a given page. */
+void *
+jm_fetch_begin (char *fetch_addr, char *fetch_buffer, size_t numbytes)
+{
+  FETCH_STATE *state;      /* Current state for the asynchronous operation */
+  int get_server;          /* Server from which to get a page */
+  int i;
+
+  /* Announce what we're about to do. */
+  jm_debug_printf(4, "Fetching the page at address %p.\n", fetch_addr);
+
+  /* Acquire new internal state. */
+  for (i=0; i<MAX_PENDING_FETCHES; i++) {
+    state = &fetch_state[i];
+    if (!state->valid)
+      break;
+  }
+  if (i == MAX_PENDING_FETCHES)
+    jm_abort("Too many fetches (%ld) are concurrently outstanding", MAX_PENDING_FETCHES+1);
+
+  /* Ask the server for the page.  Replies arrive in request order. */
+  get_server = (int)GET_SLAVE_NUM(fetch_addr);
+  state->valid = 1;
+  state->complete = 0;
+  state->address = fetch_addr;
+  state->buffer = fetch_buffer;
+  state->numbytes = numbytes;
+  state->server = get_server;
+  state->sequence = servers[get_server].sent++;
+  send_command(get_server, JMS_GET, GET_SLAVE_OFFSET(fetch_addr), numbytes, NULL);
+  return (void *) state;
+}
+
+
+/* Finish fetching a given page. */
+void
+jm_fetch_end (void *stateobj)
+{
+  FETCH_STATE *state = (FETCH_STATE *) stateobj;
+
+  /* Receive pages from the server until ours arrives. */
+  jm_debug_printf(4, "Waiting for the page at address %p.\n", state->address);
+  while (!state->complete)
+    receive_next_page(state->server);
+  state->valid = 0;
+  jm_debug_printf(4, "Finished waiting for the page at address %p.\n", state->address);
+}
+
+
+/* Finish fetching a given page if it has already arrived.  Pages
+ * that the server has begun sending are received in full. */
+int
+jm_fetch_test (void *stateobj)
+{
+  FETCH_STATE *state = (FETCH_STATE *) stateobj;
+  struct pollfd pfd;       /* Server's socket */
+
+  pfd.fd = servers[state->server].sockfd;
+  pfd.events = POLLIN;
+  while (!state->complete) {
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLIN|POLLHUP|POLLERR)))
+      return 0;
+    receive_next_page(state->server);
+  }
+  state->valid = 0;
+  jm_debug_printf(4, "Found that the page at address %p has arrived.\n", state->address);
+  return 1;
+}
+
+
+/* Release our leases and disconnect from every server. */
+void
+jm_finalize_slaves (void)
+{
+  unsigned int i;
+
+  for (i=0; i<jm_globals.numslaves; i++) {
+    send_command(i, JMS_BYE, 0, 0, NULL);
+    close(servers[i].sockfd);
+  }
+}
@@ -51,6 +51,8 @@ jm_initialize_slaves (void)
 
   /* Common initialization */
   jm_debug_printf(3, "slaves_shmem is initializing.\n");
+  if (jm_getenv_positive_int("JM_MASTERS") > 1)
+    jm_abort("slaves_shmem supports only a single master (JM_MASTERS=%s)", getenv("JM_MASTERS"));
   shmem_init();
   rank = shmem_my_pe();
   numranks = shmem_n_pes();
@@ -66,8 +68,11 @@ jm_initialize_slaves (void)
   shmem_long_min_to_all(&min_memory, (long *)&jm_globals.slavebytes, 1, 0, 0,
                         numranks, workarray, syncarray);
   jm_globals.slavebytes = min_memory;
-  if (rank > 0)
-    buffer = (char *) jm_malloc(jm_globals.slavebytes);
+  if (rank > 0) {
+    if (!(buffer=jm_allocate_slave_buffer(jm_globals.slavebytes)))
+      jm_abort("Failed to allocate %lu bytes of slave memory (%s)",
+               jm_globals.slavebytes, jm_strerror(errno));
+  }
   buffer_addr = (char **) jm_malloc(numranks*sizeof(char *));
   for (i=0; i<_SHMEM_REDUCE_SYNC_SIZE; i++)
     syncarray[i] = _SHMEM_SYNC_VALUE;
@@ -82,7 +87,7 @@ jm_initialize_slaves (void)
 
 /* Start evicting a given page. */
 void *
-jm_evict_begin (char *evict_addr, char *evict_buffer)
+jm_evict_begin (char *evict_addr, char *evict_buffer, size_t numbytes)
 {
   size_t put_offset;     /* Slave buffer offset to which to put a page */
   int put_slave;         /* Slave to which to put a page */
@@ -95,7 +100,7 @@ jm_evict_begin (char *evict_addr, char *evict_buffer)
   put_slave = (int)GET_SLAVE_NUM(evict_addr);
   put_offset = GET_SLAVE_OFFSET(evict_addr);
   shmem_putmem_nb((void *)(buffer_addr[put_slave+1]+put_offset), (void *)evict_buffer,
-                  jm_globals.pagesize, put_slave+1, &put_handle);
+                  numbytes, put_slave+1, &put_handle);
   return put_handle;
 }
 
@@ -114,7 +119,7 @@ jm_evict_end (void *stateobj)
 
 /* Start fetching a given page. */
 void *
-jm_fetch_begin (char *fetch_addr, char *fetch_buffer)
+jm_fetch_begin (char *fetch_addr, char *fetch_buffer, size_t numbytes)
 {
   size_t get_offset;     /* Slave buffer offset to which to get a page */
   int get_slave;         /* Slave to which to get a page */
@@ -127,7 +132,7 @@ jm_fetch_begin (char *fetch_addr, char *fetch_buffer)
   get_slave = (int)GET_SLAVE_NUM(fetch_addr);
   get_offset = GET_SLAVE_OFFSET(fetch_addr);
   shmem_getmem_nb((void *)fetch_buffer, (void *)(buffer_addr[get_slave+1]+get_offset),
-                  jm_globals.pagesize, get_slave+1, &get_handle);
+                  numbytes, get_slave+1, &get_handle);
   return get_handle;
 }
 
@@ -144,6 +149,22 @@ jm_fetch_end (void *stateobj)
 }
 
 
+/* SHMEM can't poll a nonblocking put or get, so simply complete it. */
+int
+jm_evict_test (void *stateobj)
+{
+  jm_evict_end(stateobj);
+  return 1;
+}
+
+int
+jm_fetch_test (void *stateobj)
+{
+  jm_fetch_end(stateobj);
+  return 1;
+}
+
+
 /* Shut down cleanly. */
 void
 jm_finalize_slaves (void)
@@ -29,7 +29,7 @@
  */
 
 #include "jumbomem.h"
-#ifdef HAVE_GETTID_SYSCALL
+#if defined(HAVE_GETTID_SYSCALL) || defined(__linux__)
 # include <sys/syscall.h>
 #endif
 
@@ -38,6 +38,17 @@
 # define MEMINFO_FILE "/proc/meminfo"
 #endif
 
+/* Enable the directory of NUMA nodes to be overridden at compile time. */
+#ifndef NUMA_NODE_DIR
+# define NUMA_NODE_DIR "/sys/devices/system/node"
+#endif
+
+/* Enable the directory of network interfaces to be overridden at
+ * compile time. */
+#ifndef NET_DEVICE_DIR
+# define NET_DEVICE_DIR "/sys/class/net"
+#endif
+
 /* Enable the max_map_count filename to be overridden at compile time. */
 #ifndef MAPCOUNT_FILE
 # define MAPCOUNT_FILE "/proc/sys/vm/max_map_count"
@@ -154,6 +165,79 @@ jm_get_page_size (void)
 }
 
 
+/* Return the default huge-page size or zero if indeterminate. */
+size_t
+jm_get_huge_page_size (void)
+{
+  ssize_t hugepagesize;           /* Hugepagesize key from MEMINFO_FILE */
+
+  jm_parse_meminfo_file(1, "Hugepagesize:", &hugepagesize);
+  return hugepagesize > 0 ? (size_t) hugepagesize : 0;
+}
+
+
+/* Return the number of NUMA nodes (1 if indeterminate). */
+int
+jm_get_numa_node_count (void)
+{
+  FILE *online_file;            /* File listing the online NUMA nodes */
+  char oneline[MAX_LINE_LEN];   /* Contents of the above (e.g., "0-3") */
+  char *lastnum;                /* Last number in the above */
+  int numnodes = 1;             /* Number of NUMA nodes */
+
+  if (!(online_file=fopen(NUMA_NODE_DIR "/online", "r")))
+    return 1;
+  if (fgets(oneline, MAX_LINE_LEN, online_file)) {
+    lastnum = oneline + strcspn(oneline, "\n");
+    while (lastnum > oneline && !isdigit(lastnum[-1]))
+      lastnum--;
+    while (lastnum > oneline && isdigit(lastnum[-1]))
+      lastnum--;
+    if (isdigit(*lastnum))
+      numnodes = atoi(lastnum) + 1;
+  }
+  fclose(online_file);
+  return numnodes;
+}
+
+
+/* Return the NUMA node on which the calling thread is running or -1
+ * if indeterminate. */
+int
+jm_get_current_numa_node (void)
+{
+#ifdef SYS_getcpu
+  unsigned int cpu;             /* CPU on which we're running */
+  unsigned int node;            /* NUMA node containing the above */
+
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+    return (int) node;
+#endif
+  return -1;
+}
+
+
+/* Return the NUMA node to which a network interface is attached or -1
+ * if indeterminate. */
+int
+jm_get_nic_numa_node (const char *ifname)
+{
+  char *filename;               /* Name of the file containing the NUMA node */
+  FILE *node_file;              /* Handle to the above */
+  int node = -1;                /* NUMA node to return */
+
+  filename = (char *) jm_malloc(strlen(NET_DEVICE_DIR) + strlen(ifname) + 50);
+  sprintf(filename, "%s/%s/device/numa_node", NET_DEVICE_DIR, ifname);
+  if ((node_file=fopen(filename, "r"))) {
+    if (fscanf(node_file, "%d", &node) != 1)
+      node = -1;
+    fclose(node_file);
+  }
+  jm_free(filename);
+  return node;
+}
+
+
 /* Parse the kernel meminfo file to return the amount of free memory
  * we can use. */
 size_t
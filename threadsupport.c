@@ -36,10 +36,19 @@
 #endif
 #include <sys/time.h>
 #include <time.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
 
-/* Specify the number of blocks of thread information to allocate
- * statically. */
-#define MAXSTATICBLOCKS 1
+/* Define the number of thread-information structures to allocate at
+ * once and the maximum number of such slabs.  The first slab is
+ * allocated statically. */
+#ifndef JM_THREAD_SLAB_SIZE
+# define JM_THREAD_SLAB_SIZE 1024
+#endif
+#ifndef JM_MAX_THREAD_SLABS
+# define JM_MAX_THREAD_SLABS 4096
+#endif
 
 /* Define the time in milliseconds after which we give up waiting for
  * a thread to freeze. */
@@ -47,59 +56,212 @@
 # define JM_FREEZE_TIMEOUT 1000
 #endif
 
+/* Define the time in microseconds after which a burst of page faults
+ * must let parked threads run again.  The threads then run for at
+ * least as long as they were parked before a new burst can park
+ * them. */
+#ifndef JM_MAX_PARK_TIME
+# define JM_MAX_PARK_TIME 10000
+#endif
+
 /* Define some per-thread information as an element in a linked list. */
 typedef struct thread_info_t {
   pthread_t tid;                     /* Thread identifier (from Pthreads; not necessarily unique) */
   pid_t unique_tid;                  /* Unique thread ID (from gettid(); may be -1 */
   volatile unsigned int blocked;     /* 0=running; >0=blocked on the mega-lock */
+  volatile int parked;               /* 1=waiting in the signal handler for a fault burst to end */
+#ifndef JM_HAVE_TLS
   volatile unsigned int internal_depth;    /* 0=user mode; >0=depth of JumboMem mode */
+#endif
   int cancel_handler;                /* >0=return if in the signal handler; 0=do nothing */
-  int freeable;                      /* 1=struct can be free()'d; 0=cannot */
   int internal;                      /* 1=thread is internal to JumboMem; 0=user thread */
-  struct thread_info_t *next;        /* Pointer to the next thread's info */
+  volatile int exiting;              /* 1=thread has run its destructor and is exiting */
+  volatile int dead;                 /* 1=thread no longer exists */
+  struct thread_info_t *volatile next;     /* Pointer to the next thread's info */
+  struct thread_info_t *next_free;   /* Pointer to the next retired or free struct */
 } THREAD_INFO;
 
 /* Define a lock to serialize JumboMem thread operations. */
 static pthread_mutex_t megalock = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;  /* The lock itself */
 
-/* Manage per-thread information. */
-static THREAD_INFO *per_thread_info = NULL;   /* Linked list of information */
+/* Keep frozen threads parked across bursts of back-to-back page
+ * faults so that each fault in a burst need not signal them again.
+ * All of the following are protected by the mega-lock. */
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;  /* Signaled when a burst ends */
+static uint64_t prev_freeze_time = 0;   /* Time in microseconds of the previous freeze */
+static uint64_t mean_freeze_gap = 0;    /* Moving average of the time between freezes */
+static uint64_t burst_start = 0;        /* Time the current burst began (0=no burst) */
+static uint64_t burst_freezes = 0;      /* Number of freezes in the current burst */
+static uint64_t park_deadline = 0;      /* Time until which frozen threads stay parked */
+static uint64_t park_resume = 0;        /* Earliest time at which a new burst may begin */
+static int park_timer_running = 0;      /* 1=a parked thread is waiting for park_deadline */
+
+/* Manage per-thread information.  When the compiler supports
+ * thread-local storage we keep our thread's element of
+ * per_thread_info and its mega-lock depth in TLS and use the
+ * Pthreads key only to run thread_destructor() at thread exit.
+ *
+ * Threads push themselves onto per_thread_info without locking and
+ * mark themselves as exiting when they terminate.  Only the holder of
+ * the mega-lock traverses the list, so it alone unlinks threads once
+ * they no longer exist.
+ * Unlinked structures are retired and later recycled onto
+ * free_thread_info, but only at a moment when no thread is popping
+ * free_thread_info; this epoch rule keeps a popper from ever seeing a
+ * structure that was popped and pushed back during its
+ * compare-and-swap (the ABA problem). */
+static THREAD_INFO *volatile per_thread_info = NULL;    /* Linked list of information */
+static THREAD_INFO *volatile free_thread_info = NULL;   /* Stack of recyclable structures */
+static THREAD_INFO *retired_thread_info = NULL;         /* Unlinked structures awaiting recycling */
+static volatile unsigned int pops_in_progress = 0;      /* Number of threads popping free_thread_info */
+static THREAD_INFO first_thread_slab[JM_THREAD_SLAB_SIZE];  /* Statically allocated structures */
+static THREAD_INFO *volatile thread_slabs[JM_MAX_THREAD_SLABS] = {first_thread_slab};   /* All slabs of structures */
+static volatile unsigned long slab_entries_used = 0;    /* Number of structures ever carved from a slab */
+#ifdef HAVE_SCHED
+static cpu_set_t validcpus;    /* Set of CPUs on which threads can run */
+#endif
 static pthread_key_t private_ptr_key = (pthread_key_t)(~0);   /* Key to access our thread's element of per_thread_info */
+#ifdef JM_HAVE_TLS
+static JM_THREAD_LOCAL THREAD_INFO *my_thread_info = NULL;   /* Our thread's element of per_thread_info */
+JM_THREAD_LOCAL unsigned int jm_internal_depth = 0;   /* 0=user mode; >0=depth of JumboMem mode */
+# define INTERNAL_DEPTH(PRIVATE) jm_internal_depth
+#else
+# define INTERNAL_DEPTH(PRIVATE) ((PRIVATE)->internal_depth)
+#endif
 
 /* ---------------------------------------------------------------------- */
 
-/* Mark a terminating thread as forever blocked. */
+/* Deregister a terminating thread.  We keep the thread's structure
+ * because the thread may still call back into JumboMem on its way
+ * out; the structure is reclaimed once the thread no longer exists. */
 static void
 thread_destructor (void *private)
 {
-  ((THREAD_INFO *)private)->blocked = ~(volatile unsigned int)0;
+  ((THREAD_INFO *)private)->exiting = 1;
 }
 
 
-/* Initialize the pointer to thread-specific data. */
+/* Map a new slab of thread-information structures without calling
+ * back into JumboMem (which would need thread information). */
+static THREAD_INFO *
+map_thread_slab (void)
+{
+  size_t numbytes = JM_THREAD_SLAB_SIZE*sizeof(THREAD_INFO);  /* Bytes per slab */
+  void *slab;                  /* Newly mapped slab */
+
+#if defined(SYS_mmap2)
+  slab = (void *) syscall(SYS_mmap2, NULL, numbytes, PROT_READ|PROT_WRITE,
+                          MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+#elif defined(SYS_mmap)
+  slab = (void *) syscall(SYS_mmap, NULL, numbytes, PROT_READ|PROT_WRITE,
+                          MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+#else
+  extern void *(*jm_original_mmap)(void *, size_t, int, int, int, off_t);
+
+  slab = jm_original_mmap(NULL, numbytes, PROT_READ|PROT_WRITE,
+                          MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+#endif
+  if (slab == MAP_FAILED)
+    jm_abort("Failed to allocate memory for thread information (%s)", jm_strerror(errno));
+  return (THREAD_INFO *) slab;
+}
+
+
+/* Allocate a thread-information structure without locking.  We
+ * prefer to recycle a structure belonging to a dead thread. */
+static THREAD_INFO *
+allocate_thread_info (void)
+{
+  THREAD_INFO *info;           /* Structure to return */
+  unsigned long entry;         /* Index of a never-used structure */
+  unsigned long slab;          /* Slab containing the above */
+
+  /* Pop a recycled structure if available. */
+  __sync_fetch_and_add(&pops_in_progress, 1);
+  do
+    info = free_thread_info;
+  while (info && !__sync_bool_compare_and_swap(&free_thread_info, info, info->next_free));
+  __sync_fetch_and_sub(&pops_in_progress, 1);
+  if (info)
+    return info;
+
+  /* Carve a new structure from a slab, mapping the slab if we're the
+   * first to need it. */
+  entry = __sync_fetch_and_add(&slab_entries_used, 1);
+  slab = entry / JM_THREAD_SLAB_SIZE;
+  if (slab >= JM_MAX_THREAD_SLABS)
+    jm_abort("More than %lu threads are running concurrently",
+             (unsigned long)JM_THREAD_SLAB_SIZE*JM_MAX_THREAD_SLABS);
+  if (!thread_slabs[slab]) {
+    THREAD_INFO *newslab = map_thread_slab();
+
+    if (!__sync_bool_compare_and_swap(&thread_slabs[slab], NULL, newslab)) {
+#if defined(SYS_munmap)
+      (void) syscall(SYS_munmap, newslab, JM_THREAD_SLAB_SIZE*sizeof(THREAD_INFO));
+#else
+      (void) munmap(newslab, JM_THREAD_SLAB_SIZE*sizeof(THREAD_INFO));
+#endif
+    }
+  }
+  return &thread_slabs[slab][entry % JM_THREAD_SLAB_SIZE];
+}
+
+
+/* Unlink dead threads from per_thread_info and recycle previously
+ * unlinked structures when it's safe to do so.  The caller must hold
+ * the mega-lock. */
 static void
-create_private_key (void)
+reclaim_dead_threads (void)
 {
-  if (pthread_key_create(&private_ptr_key, thread_destructor))
-    jm_abort("pthread_key_create() failed");
+  THREAD_INFO *volatile *prev_threadptr;    /* Pointer to threadptr */
+  THREAD_INFO *threadptr;      /* Pointer to thread-specific information */
+
+  /* Recycle the structures we retired during a previous call if no
+   * thread is in the middle of popping free_thread_info. */
+  if (retired_thread_info && pops_in_progress == 0) {
+    THREAD_INFO *last = retired_thread_info;    /* Last retired structure */
+
+    while (last->next_free)
+      last = last->next_free;
+    do
+      last->next_free = free_thread_info;
+    while (!__sync_bool_compare_and_swap(&free_thread_info, last->next_free, retired_thread_info));
+    retired_thread_info = NULL;
+  }
+
+  /* Unlink dead threads.  Other threads may concurrently push
+   * themselves onto the head of the list, so only the head pointer
+   * needs a compare-and-swap. */
+  prev_threadptr = &per_thread_info;
+  while ((threadptr=*prev_threadptr)) {
+    if (threadptr->exiting && !threadptr->dead
+        && threadptr->unique_tid != -1
+        && jm_get_thread_state(threadptr->unique_tid) == '?')
+      threadptr->dead = 1;
+    if (!threadptr->dead) {
+      prev_threadptr = &threadptr->next;
+      continue;
+    }
+    if (prev_threadptr == &per_thread_info) {
+      if (!__sync_bool_compare_and_swap(&per_thread_info, threadptr, threadptr->next))
+        continue;     /* A new thread was pushed; retry from the new head. */
+    }
+    else
+      *prev_threadptr = threadptr->next;
+    threadptr->next_free = retired_thread_info;
+    retired_thread_info = threadptr;
+  }
 }
 
 
-/* Initialize the calling thread, given a pointer to (uninitialized)
- * thread information. */
+/* Initialize the pointer to thread-specific data.  Also, determine
+ * once the set of CPUs on which threads are allowed to run. */
 static void
-initialize_thread (void)
+create_private_key (void)
 {
-  THREAD_INFO *newinfo;        /* Information about our thread */
-  static pthread_once_t key_create_control = PTHREAD_ONCE_INIT;   /* Control one-shot initialization. */
-  int malloc_okay;             /* 1=safe to call malloc(); 0=unsafe */
-  static pthread_mutex_t initlock = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;  /* Allow only one thread to initialize at a time. */
 #ifdef HAVE_SCHED
-  cpu_set_t validcpus;         /* Set of CPUs on which we can run */
   int i;
 
-  /* Dynamically determine the set of valid CPUs and bind the calling
-   * thread to all of those. */
   CPU_ZERO(&validcpus);
   for (i=0; i<CPU_SETSIZE; i++) {
     CPU_SET(i, &validcpus);
@@ -107,46 +269,47 @@ initialize_thread (void)
       CPU_CLR(i, &validcpus);
   }
 #endif
+  if (pthread_key_create(&private_ptr_key, thread_destructor))
+    jm_abort("pthread_key_create() failed");
+}
+
+
+/* Initialize the calling thread, given a pointer to (uninitialized)
+ * thread information. */
+static void
+initialize_thread (void)
+{
+  THREAD_INFO *newinfo;        /* Information about our thread */
+  static pthread_once_t key_create_control = PTHREAD_ONCE_INIT;   /* Control one-shot initialization. */
 
-  /* Serialize allocations of thread-specific data. */
-  if (pthread_mutex_lock(&initlock))
-    jm_abort("Failed to acquire the thread-initialization lock");
+  /* Bind the calling thread to all valid CPUs, which a launcher may
+   * have restricted for the parent thread. */
+  pthread_once(&key_create_control, create_private_key);
+#ifdef HAVE_SCHED
+  (void) sched_setaffinity(0, sizeof(cpu_set_t), &validcpus);
+#endif
 
   /* Allocate and initialize our thread-specific data. */
-  malloc_okay = jm_memory_is_initialized();
-  if (malloc_okay)
-    newinfo = (THREAD_INFO *) jm_internal_malloc_no_lock(sizeof(THREAD_INFO));
-  else {
-    static THREAD_INFO static_thread_info[MAXSTATICBLOCKS];  /* Statically allocated information blocks */
-    static int numstaticblocks = 0;    /* Number of statically allocated blocks in use */
-
-    newinfo = &static_thread_info[numstaticblocks++];
-    if (numstaticblocks > MAXSTATICBLOCKS)
-      jm_abort("Failed to allocate %d static blocks of thread information");
-  }
+  newinfo = allocate_thread_info();
   memset(newinfo, 0, sizeof(THREAD_INFO));
-  newinfo->freeable = malloc_okay;
   newinfo->tid = pthread_self();
   newinfo->unique_tid = gettid();
-  pthread_once(&key_create_control, create_private_key);
   if (pthread_setspecific(private_ptr_key, newinfo))
     jm_abort("pthread_setspecific() failed");
+#ifdef JM_HAVE_TLS
+  my_thread_info = newinfo;
+#endif
 
-  /* Insert our thread's information at the head of the
-   * thread-information list.  We take the mega-lock while we do this
-   * to avoid a race condition in which another thread's
-   * jm_freeze_other_threads() misses seeing our thread and then our
-   * thread touches data as it's being paged in, thereby resulting in
-   * corrupted user data. */
-  jm_enter_critical_section();
-  newinfo->internal = jm_globals.is_internal;   /* Safe to read jm_globals.is_internal only when we have the lock. */
-  newinfo->next = per_thread_info;
-  per_thread_info = newinfo;
-  jm_exit_critical_section();
-
-  /* Allow other threads to initialize. */
-  if (pthread_mutex_unlock(&initlock))
-    jm_abort("Failed to release the thread-initialization lock");
+  /* Push our thread's information onto the head of the
+   * thread-information list.  We're always called on the way to
+   * acquiring the mega-lock so if a concurrent
+   * jm_freeze_other_threads() misses seeing our thread, our thread
+   * will block on the mega-lock before it can touch data that's
+   * being paged in. */
+  newinfo->internal = jm_globals.is_internal;
+  do
+    newinfo->next = per_thread_info;
+  while (!__sync_bool_compare_and_swap(&per_thread_info, newinfo->next, newinfo));
 }
 
 
@@ -157,17 +320,26 @@ get_thread_specific_data (void)
   THREAD_INFO *private;          /* Thread-private information */
 
   /* Common case -- we can read the data successfully. */
+#ifdef JM_HAVE_TLS
+  if ((private=my_thread_info))
+    return private;
+#else
   if (private_ptr_key != (pthread_key_t)(~0)
       && (private=pthread_getspecific(private_ptr_key)))
     return private;
+#endif
 
   /* We failed to find our thread-specific data.  Is this because we
    * don't yet have any thread-specific data or because of another
    * reason?  Who knows?  We assume the former, initialize our thread,
    * and retry the operation. */
   initialize_thread();
+#ifdef JM_HAVE_TLS
+  if (!(private=my_thread_info))
+#else
   if (!(private=pthread_getspecific(private_ptr_key)))
-    jm_abort("pthread_getspecific() failed");
+#endif
+    jm_abort("Failed to initialize thread-specific data");
   return private;
 }
 
@@ -191,14 +363,25 @@ jm_enter_critical_section (void)
 {
   THREAD_INFO *private;          /* Thread-private information */
 
-  /* Acquire the thread mega-lock. */
+#ifdef JM_HAVE_TLS
+  /* Fast path -- we already hold the mega-lock. */
+  if (jm_internal_depth > 0) {
+    jm_internal_depth++;
+    return;
+  }
+#endif
+
+  /* Acquire the thread mega-lock, avoiding recursive locks.  We
+   * advertise that we're blocked only if the lock is contended. */
   private = get_thread_specific_data();
-  private->blocked = 1;          /* Assume atomic. */
-  if (private->internal_depth == 0         /* Avoid recursive locks. */
-      && pthread_mutex_lock(&megalock))
-    jm_abort("Failed to acquire the thread mega-lock.");
-  private->blocked = 0;
-  private->internal_depth++;
+  if (INTERNAL_DEPTH(private) == 0
+      && pthread_mutex_trylock(&megalock) != 0) {
+    private->blocked = 1;          /* Assume atomic. */
+    if (pthread_mutex_lock(&megalock))
+      jm_abort("Failed to acquire the thread mega-lock.");
+    private->blocked = 0;
+  }
+  INTERNAL_DEPTH(private)++;
 }
 
 
@@ -206,6 +389,11 @@ jm_enter_critical_section (void)
 void
 jm_exit_critical_section (void)
 {
+#ifdef JM_HAVE_TLS
+  if (--jm_internal_depth == 0
+      && pthread_mutex_unlock(&megalock))
+    jm_abort("Failed to release the thread mega-lock.");
+#else
   THREAD_INFO *private;          /* Thread-private information */
 
   private = get_thread_specific_data();
@@ -213,6 +401,7 @@ jm_exit_critical_section (void)
   if (private->internal_depth == 0
       && pthread_mutex_unlock(&megalock))
     jm_abort("Failed to release the thread mega-lock.");
+#endif
 }
 
 
@@ -220,10 +409,14 @@ jm_exit_critical_section (void)
 unsigned int
 jm_get_internal_depth (void)
 {
+#ifdef JM_HAVE_TLS
+  return jm_internal_depth;
+#else
   THREAD_INFO *private;          /* Thread-private information */
 
   private = get_thread_specific_data();
   return private->internal_depth;
+#endif
 }
 
 
@@ -231,29 +424,136 @@ jm_get_internal_depth (void)
 void
 jm_set_internal_depth (unsigned int newdepth)
 {
+#ifdef JM_HAVE_TLS
+  jm_internal_depth = newdepth;
+#else
   THREAD_INFO *private;          /* Thread-private information */
 
   private = get_thread_specific_data();
   private->internal_depth = newdepth;
+#endif
+}
+
+
+/* Wait, without holding the mega-lock, until the current burst of
+ * page faults ends.  Only one parked thread at a time watches the
+ * clock; the rest sleep until it wakes them. */
+static void
+park_thread (THREAD_INFO *private)
+{
+  struct timespec deadline;      /* park_deadline as a timespec */
+
+  private->parked = 1;
+  while (jm_current_time() < park_deadline) {
+    if (park_timer_running) {
+      (void) pthread_cond_wait(&park_cond, &megalock);
+      continue;
+    }
+    park_timer_running = 1;
+    deadline.tv_sec = park_deadline/1000000;
+    deadline.tv_nsec = (park_deadline%1000000)*1000;
+    (void) pthread_cond_timedwait(&park_cond, &megalock, &deadline);
+    park_timer_running = 0;
+  }
+  pthread_cond_broadcast(&park_cond);
+  private->parked = 0;
 }
 
 
 /* Return 1 if we should exit the signal handler immediately, 0 if we
- * can keep going. */
+ * can keep going.  genuine is 1 if the thread entered the handler
+ * because of its own page fault and 0 if another thread froze it.
+ * During a burst of page faults, a frozen thread waits for the burst
+ * to end before exiting, and a thread that was frozen while faulting
+ * services its fault right away, while the other threads are still
+ * parked. */
 int
-jm_must_exit_signal_handler_now (void)
+jm_must_exit_signal_handler_now (int genuine)
 {
   THREAD_INFO *private;          /* Thread-private information */
 
   private = get_thread_specific_data();
   if (private->cancel_handler > 0) {
     private->cancel_handler--;
+    if (jm_globals.park_window > 0 && INTERNAL_DEPTH(private) == 1) {
+      if (genuine)
+        return 0;
+      park_thread(private);
+    }
     return 1;
   }
   return 0;
 }
 
 
+/* Decide whether the threads we're about to freeze should stay parked
+ * until a subsequent fault.  A burst begins when freezes come less
+ * than park_window microseconds apart, and each freeze extends it by
+ * twice the typical time between freezes.  The burst ends when
+ * the fault rate drops or the burst has lasted JM_MAX_PARK_TIME
+ * microseconds. */
+static void
+update_park_deadline (void)
+{
+  uint64_t now = jm_current_time();       /* Current time in microseconds */
+  uint64_t prev = prev_freeze_time;       /* Time of the previous freeze */
+  uint64_t gap = now - prev;              /* Time since the previous freeze */
+  uint64_t window = jm_globals.park_window;   /* Cache of the maximum gap */
+  uint64_t extension;                     /* Time to add to park_deadline */
+
+  prev_freeze_time = now;
+  if (window == 0)
+    return;
+  if (gap > window)
+    gap = window;
+  mean_freeze_gap = (3*mean_freeze_gap + gap)/4;
+
+  /* End the burst if faults are no longer back-to-back or if parked
+   * threads have waited long enough. */
+  if (burst_start
+      && (gap == window || now - burst_start >= JM_MAX_PARK_TIME)) {
+    jm_debug_printf(4, "Ending a %lu-microsecond burst of %lu page faults.\n",
+                    (unsigned long)(prev - burst_start), (unsigned long)burst_freezes);
+    if (gap < window)
+      park_resume = now + (now - burst_start);
+    burst_start = 0;
+    park_deadline = 0;
+    pthread_cond_broadcast(&park_cond);
+    return;
+  }
+  if (gap == window || now < park_resume)
+    return;
+
+  /* Begin or extend the burst. */
+  if (!burst_start) {
+    burst_start = now;
+    burst_freezes = 0;
+  }
+  burst_freezes++;
+  extension = 2*mean_freeze_gap;
+  if (extension < gap)
+    extension = gap;
+  if (extension > window)
+    extension = window;
+  park_deadline = now + extension;
+}
+
+
+/* Mark the calling thread as internal to JumboMem.  Internal threads
+ * are never frozen by jm_freeze_other_threads() so they must not
+ * touch the global address space. */
+void
+jm_mark_thread_internal (void)
+{
+  THREAD_INFO *private;          /* Thread-private information */
+
+  private = get_thread_specific_data();
+  jm_enter_critical_section();
+  private->internal = 1;
+  jm_exit_critical_section();
+}
+
+
 /* Instruct all other threads (except JumboMem-internal threads) to
  * freeze execution then wait until they're all frozen before
  * returning. */
@@ -261,50 +561,44 @@ void
 jm_freeze_other_threads (void)
 {
   THREAD_INFO *threadptr;        /* Pointer to thread-specific information */
-  THREAD_INFO **prev_threadptr;  /* Pointer to threadptr */
   uint64_t starting_time_ms;     /* Time in milliseconds we began waiting for threads to freeze */
 
-  /* Tell all unblocked threads to enter the signal handler and block.
-   * Remove terminated threads from the thread list as we go. */
+  /* Forget about threads that have exited. */
   JM_RECORD_CYCLE("Freezing other threads");
-  prev_threadptr = &per_thread_info;
-  threadptr = *prev_threadptr;
-  while (threadptr) {
-    /* Skip our thread, all threads that are already blocked, and any
-     * internal threads. */
+  reclaim_dead_threads();
+  update_park_deadline();
+
+  /* Tell all unblocked threads to enter the signal handler and block. */
+  for (threadptr=per_thread_info; threadptr; threadptr=threadptr->next) {
+    /* Skip our thread, all threads that are already blocked or parked,
+     * exiting, or dead, and any internal threads. */
     if (!pthread_equal(pthread_self(), threadptr->tid)
         && !threadptr->blocked
+        && !threadptr->parked
+        && !threadptr->exiting
+        && !threadptr->dead
         && !threadptr->internal) {
 
       /* Order the thread to enter its signal handler, where it will
        * immediately block on the mega-lock. */
       jm_debug_printf(5, "Signaling thread %lu (LWP %d) to freeze\n", threadptr->tid, threadptr->unique_tid);
-      if (pthread_kill(threadptr->tid, SIGSEGV) == ESRCH) {
-        /* We failed to signal a thread.  It must be dead.  Hence, we
-         * remove it from future consideration. */
-        *prev_threadptr = threadptr->next;
-        if (threadptr->freeable)
-          jm_free(threadptr);
-        threadptr = *prev_threadptr;
-        continue;
-      }
+      if (pthread_kill(threadptr->tid, SIGSEGV) == ESRCH)
+        /* We failed to signal a thread.  It must be dead even though
+         * it didn't deregister itself. */
+        threadptr->dead = 1;
     }
-
-    /* Proceed with the next thread. */
-    prev_threadptr = &threadptr->next;
-    threadptr = *prev_threadptr;
   }
 
   /* Wait until all other threads are blocked. */
   starting_time_ms = current_time_ms();
   for (threadptr=per_thread_info; threadptr; threadptr=threadptr->next) {
     if (!pthread_equal(pthread_self(), threadptr->tid) && !threadptr->internal)
-      while (1) {
+      while (!threadptr->exiting && !threadptr->dead) {
         char state;    /* Current thread state */
 
         /* It's safe to continue if the thread is blocked waiting for
-         * the mega-lock. */
-        if (threadptr->blocked)
+         * the mega-lock or parked in its signal handler. */
+        if (threadptr->blocked || threadptr->parked)
           break;
 
         /* It's safe to continue if the thread is blocked in the
@@ -314,6 +608,13 @@ jm_freeze_other_threads (void)
         if (state == 'D' || state == 'Z' || state == 'T')
           break;
 
+        /* The thread no longer exists if the kernel doesn't know
+         * about it. */
+        if (state == '?' && threadptr->unique_tid != -1) {
+          threadptr->dead = 1;
+          break;
+        }
+
         /* If the thread hasn't acknowledged our signal after a very
          * long time, take a chance and assume that it won't touch the
          * page that we're currently faulting in.  This is a risky
@@ -342,8 +643,12 @@ jm_freeze_other_threads (void)
    * page fault, it will automatically re-enter the signal handler
    * when it retries the faulting operation.) */
   for (threadptr=per_thread_info; threadptr; threadptr=threadptr->next) {
-    /* Skip our thread and any internal threads. */
+    /* Skip our thread and any parked, exiting, dead, or internal
+     * threads. */
     if (!pthread_equal(pthread_self(), threadptr->tid)
+        && !threadptr->parked
+        && !threadptr->exiting
+        && !threadptr->dead
         && !threadptr->internal)
       threadptr->cancel_handler++;
   }